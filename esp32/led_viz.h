@@ -8,6 +8,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "led_viz_math.h" // sin8/sin16, beatsin8, scale8, easing curves
+
 // ============================================================================
 // RGB Color Type
 // ============================================================================
@@ -30,6 +32,26 @@ typedef RGB Palette16[16];
 RGB palette_sample(const Palette16 palette, uint8_t index, uint8_t brightness,
                    bool interpolate);
 
+// 256-entry expanded gradient: one precomputed color per palette index
+typedef RGB Palette256[256];
+
+// Expand a palette so that out[i] == palette_sample(palette, i, 255,
+// interpolate) for every index. Build once, then sample with a table load.
+void palette_expand(Palette256 out, const Palette16 palette, bool interpolate);
+
+// Batch lookup: out[i] = palette[indices[i]] scaled by brightness, bit-for-bit
+// equal to palette_sample() on the source palette
+void palette256_sample(const Palette256 palette, const uint8_t *indices,
+                       uint8_t brightness, RGB *out, int count);
+
+// Interpolated expansion of the active palette (built by the runtime whenever
+// the palette changes; NULL if the runtime provides none)
+const RGB *get_palette256(void);
+
+// Internal: called by runtime to publish the expanded palette (do not call
+// from programs)
+void _led_viz_set_palette256(const Palette256 *palette);
+
 // Built-in palettes
 extern const Palette16 PALETTE_RAINBOW;
 extern const Palette16 PALETTE_HEAT;
@@ -39,10 +61,57 @@ extern const Palette16 PALETTE_LAVA;
 extern const Palette16 PALETTE_CLOUD;
 extern const Palette16 PALETTE_PARTY;
 
+// ============================================================================
+// Batch Color Kernels
+// ============================================================================
+
+// Whole-span versions of the per-pixel color math. They are vectorized
+// (AVX2/SSE2/NEON) when the compiler targets those, plain C otherwise, and
+// return identical results on every platform.
+
+// out[i] = palette_sample(palette, indices[i], brightness, interpolate)
+void palette_sample_n(const Palette16 palette, const uint8_t *indices,
+                      uint8_t brightness, bool interpolate, RGB *out,
+                      int count);
+
+// Scale every channel by scale/256 (255 leaves colors unchanged)
+void scale8_n(RGB *leds, int count, uint8_t scale);
+
+// Mix src into dst: amount 0 keeps dst, 255 copies src
+void blend_n(RGB *dst, const RGB *src, int count, uint8_t amount);
+
+// Fade toward black: amount 0 keeps colors, 255 turns them off
+void fade_n(RGB *leds, int count, uint8_t amount);
+
+// How a layer combines with the layers below it (per channel, 0-255)
+typedef enum {
+  LAYER_ALPHA,    // replace (opacity gives a plain crossfade)
+  LAYER_ADD,      // saturating sum, good for sparkles and strobes
+  LAYER_SCREEN,   // 255 - (255 - a) * (255 - b) / 255, a softer add
+  LAYER_MULTIPLY, // a * b / 255, masks and tints
+  LAYER_MAX,      // brightest channel wins
+} LayerBlend;
+
+// Combine src onto dst with the given mode, then mix the result into dst by
+// opacity (0 keeps dst, 255 applies the blend fully)
+void composite_n(RGB *dst, const RGB *src, int count, LayerBlend mode,
+                 uint8_t opacity);
+
 // ============================================================================
 // Strip Configuration
 // ============================================================================
 
+// Matrix wiring (StripDef.matrix_layout): one order, optionally OR'ed with
+// flip flags. x runs left to right and y bottom to top before flipping.
+typedef enum {
+  MATRIX_COLUMN_SERPENTINE = 0,  // default: columns alternate up/down
+  MATRIX_ROW_SERPENTINE = 1,     // rows alternate left/right
+  MATRIX_COLUMN_PROGRESSIVE = 2, // every column runs bottom to top
+  MATRIX_ROW_PROGRESSIVE = 3,    // every row runs left to right
+  MATRIX_FLIP_X = 1 << 4,        // first LED on the right
+  MATRIX_FLIP_Y = 1 << 5,        // first LED at the top
+} MatrixLayout;
+
 // Strip definition - defines a single LED strip or matrix
 typedef struct {
   int num_leds;       // Total LEDs (auto-calculated as width*height for matrices)
@@ -50,6 +119,7 @@ typedef struct {
   float length_cm;    // Physical length/width in centimeters
   int matrix_width;   // 0 = strip, >0 = matrix columns
   int matrix_height;  // 0 = strip, >0 = matrix rows
+  int matrix_layout;  // MatrixLayout wiring (0 = column serpentine)
 } StripDef;
 
 // Runtime accessors (call from update functions)
@@ -63,18 +133,74 @@ int get_matrix_width(int strip);
 int get_matrix_height(int strip);
 bool is_matrix(int strip);
 
-// Map (x, y) to linear index for matrices (serpentine layout)
+// Map (x, y) to linear index for matrices (using the strip's matrix_layout)
 // x = column (0 to width-1), y = row (0 to height-1)
 int get_matrix_index(int strip, int x, int y);
 
+// Precomputed XY table in row-major order: entry [y * width + x] is the LED
+// index of (x, y). Built once per strip setup; NULL for regular strips.
+const uint32_t *get_matrix_xy_table(int strip);
+
+// LED indices of row y (width contiguous entries of the XY table)
+const uint32_t *get_matrix_row(int strip, int y);
+
+// Write a whole row (width colors, left to right) or column (height colors,
+// bottom to top) from a contiguous array straight into the framebuffer
+void set_matrix_row(int strip, int y, const RGB *colors);
+void set_matrix_column(int strip, int x, const RGB *colors);
+
+// Normalized LED positions as separate x/y/z arrays, indexed by LED index.
+// The whole installation is centered on the origin and its longest side spans
+// -1 to 1 (x = left/right, y = up, z = depth). Built once per strip setup, so
+// spatial effects are plain loops over contiguous floats.
+typedef struct {
+  const float *x;
+  const float *y;
+  const float *z;
+} LedCoords;
+
+// Coordinates for one strip (all pointers NULL if unavailable)
+LedCoords get_strip_coords(int strip);
+
 // Internal: called by runtime to set strip setup (do not call from programs)
 void _led_viz_set_strip_setup(const StripDef *setup, int num_strips);
 
+// ============================================================================
+// Direct Framebuffer Access
+// ============================================================================
+
+// All strips live in one runtime-owned framebuffer. Strip s starts at
+// pixels + s * stride and its LEDs are contiguous.
+typedef struct {
+  RGB *pixels; // first LED of strip 0 (NULL if the runtime provides none)
+  int stride;  // RGB entries between the first LEDs of consecutive strips
+} StripFramebuffer;
+
+// Contiguous span of get_strip_num_leds(strip) LEDs, or NULL.
+// Writing here is equivalent to calling pixel() for every LED, without the
+// per-call overhead. Both may be mixed within one update. Call it again every
+// update rather than keeping the pointer: the runtime only looks for changes
+// on strips whose span was requested this frame.
+RGB *get_strip_leds(int strip);
+
+// Framebuffer descriptor for programs that walk all strips at once (marks
+// every strip as possibly changed)
+StripFramebuffer get_framebuffer(void);
+
+// Internal: called by runtime to set the framebuffer (do not call from
+// programs)
+void _led_viz_set_framebuffer(RGB *pixels, int stride);
+
+// Internal: called by runtime with one flag per strip, set to 1 whenever a
+// span of that strip is handed out (do not call from programs)
+void _led_viz_set_touched_flags(uint8_t *flags);
+
 // ============================================================================
 // Program Interface
 // ============================================================================
 
 // Pixel setter function: sets the pixel at (strip, led) to the given RGB color
+// (use get_strip_leds() to write whole strips directly)
 typedef void (*PixelFunc)(int strip, int led, uint8_t *r, uint8_t *g,
                           uint8_t *b);
 
@@ -84,20 +210,77 @@ typedef struct Program {
   void (*update)(double time_ms, PixelFunc pixel, const Palette16 palette);
   void (*init)(void);    // optional: called when program becomes active
   void (*cleanup)(void); // optional: called when switching away
+  // optional: renders a single strip or matrix. When set, the runtime may
+  // call it for several strips in parallel instead of calling update, so it
+  // must only write its own strip and must not modify shared state.
+  void (*update_strip)(int strip, double time_ms, PixelFunc pixel,
+                       const Palette16 palette);
+  // optional: carry state across hot reloads. Before a new build replaces
+  // this one, save_state returns a malloc'ed snapshot (plain data, no
+  // pointers into the program) and its size, or NULL. The runtime passes it
+  // to restore_state of the program with the same name in the new build,
+  // after that program's init, then frees it.
+  void *(*save_state)(size_t *size);
+  void (*restore_state)(const void *data, size_t size);
 } Program;
 
+// Layer definition: runs a program from programs[] into its own buffer and
+// stacks it on the layers before it (first entry is the bottom layer)
+typedef struct {
+  const char *program; // name of an entry in programs[]
+  LayerBlend blend;    // how this layer combines with the ones below
+  uint8_t opacity;     // 0-255 (255 = full strength)
+} LayerDef;
+
+// ============================================================================
+// Transitions
+// ============================================================================
+
+// Mix one strip of the outgoing (from) and incoming (to) program into out as
+// progress runs from 0 (only from) to 255 (only to). out may alias from.
+// Runtimes call one of these per strip while switching programs; any function
+// with this signature can be used as a custom transition.
+typedef void (*TransitionFunc)(int strip, const RGB *from, const RGB *to,
+                               RGB *out, int count, uint8_t progress);
+
+// Built-in transitions. Wipes follow get_strip_coords() and fall back to a
+// crossfade when coordinates are unavailable.
+void transition_crossfade(int strip, const RGB *from, const RGB *to, RGB *out,
+                          int count, uint8_t progress);
+void transition_wipe(int strip, const RGB *from, const RGB *to, RGB *out,
+                     int count, uint8_t progress); // left to right
+void transition_radial(int strip, const RGB *from, const RGB *to, RGB *out,
+                       int count, uint8_t progress); // from the center out
+
 // ============================================================================
 // Your programs.c must define:
 //
 //   const StripDef strip_setup[] = {
 //       {.num_leds = 144, .position = -0.5f},
 //       {.num_leds = 144, .position = 0.5f},
+//       // Row-wired panel whose first LED sits top-left
+//       {.num_leds = 64, .position = 0.8f, .length_cm = 8.0f,
+//        .matrix_width = 8, .matrix_height = 8,
+//        .matrix_layout = MATRIX_ROW_SERPENTINE | MATRIX_FLIP_Y},
 //   };
 //   const int NUM_STRIPS = sizeof(strip_setup) / sizeof(strip_setup[0]);
 //
 //   const Program programs[] = {
 //       {"My Program", my_update_func, NULL, NULL},
+//       // per-strip program (strips may render in parallel)
+//       {"My Strip Program", NULL, NULL, NULL, my_update_strip_func},
+//       // keeps its state across hot reloads
+//       {"My Particles", my_particles_update, NULL, NULL, NULL,
+//        my_particles_save, my_particles_restore},
 //   };
 //   const int NUM_PROGRAMS = sizeof(programs) / sizeof(programs[0]);
 //
+// Optionally, to run several programs at once as stacked layers:
+//
+//   const LayerDef layer_setup[] = {
+//       {"My Program", LAYER_ALPHA, 255},     // ambient base
+//       {"My Strip Program", LAYER_ADD, 180}, // sparkles on top
+//   };
+//   const int NUM_LAYERS = sizeof(layer_setup) / sizeof(layer_setup[0]);
+//
 // ============================================================================
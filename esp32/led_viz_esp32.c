@@ -2,14 +2,22 @@
 
 #include "led_viz_esp32.h"
 #include "led_strip.h"
+#include "led_viz_recording.h"
 #include <esp_log.h>
 #include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 static const char *TAG = "led_viz";
 
+// How far the timecode clock runs on past the last timecode when updates
+// stop, and the backwards jitter it hides instead of following
+#define TIMECODE_FREEWHEEL_MS 1000.0
+#define TIMECODE_JITTER_MS 100.0
+
 // Strip setup from program file
 extern const StripDef strip_setup[];
 extern const int NUM_STRIPS;
@@ -26,10 +34,60 @@ static struct {
 
   volatile bool running;
   int64_t start_time_us;
+
+  // Program time (see LedVizClock)
+  LedVizClock clock;
+  double time_ms;  // of the last frame rendered
+  uint32_t frames; // rendered so far
+  volatile uint32_t timecode_ms; // written by led_viz_set_timecode
+  volatile uint32_t timecode_seq;
+  uint32_t timecode_seen; // timecode_seq last taken by the loop
+  double timecode_base_ms;
+  int64_t timecode_us; // when the loop took it
+
+  // Program switch transition (see led_viz_set_transition)
+  TransitionFunc transition_func;
+  double transition_ms;
+  RGB *transition_from_pixels; // heap, same layout as pixel_buffer
+  RGB *transition_to_pixels;
+  const Program *transition_from; // outgoing program while one runs
+  double transition_start_ms; // program time it started at
+  bool transition_warned;
+  int64_t program_cost_us; // smoothed render time of the current program
+
+  // Recording played in place of the programs (see led_viz_play)
+  LedVizRecording recording;
+  uint8_t *recording_pixels; // heap, last frame decoded
+  double recording_ms;       // length, to loop
+  bool playing;
 } state;
 
 // Pixel buffer (written by programs, sent to strips)
-static uint8_t pixel_buffer[LED_VIZ_MAX_STRIPS][LED_VIZ_MAX_LEDS_PER_STRIP][3];
+static RGB pixel_buffer[LED_VIZ_MAX_STRIPS][LED_VIZ_MAX_LEDS_PER_STRIP];
+
+// Expanded active palette (rebuilt by led_viz_set_palette)
+static Palette256 palette256;
+
+// Buffer programs currently draw into: pixel_buffer, or a layer buffer
+static RGB *render_target = &pixel_buffer[0][0];
+
+// Change tracking so unchanged strips are not re-sent. esp32_pixel marks
+// strips it changes; strips whose spans were handed out (touched, set by the
+// SDK) are compared against what was last sent.
+static RGB sent_buffer[LED_VIZ_MAX_STRIPS][LED_VIZ_MAX_LEDS_PER_STRIP];
+static uint8_t strip_dirty[LED_VIZ_MAX_STRIPS];
+static uint8_t strip_touched[LED_VIZ_MAX_STRIPS];
+
+// Layer stack (set by led_viz_set_layers, buffers on the heap)
+typedef struct {
+  const Program *program;
+  LayerBlend blend;
+  uint8_t opacity;
+  RGB *pixels;
+} Layer;
+
+static Layer layers[LED_VIZ_MAX_LAYERS];
+static int num_layers;
 
 // PixelFunc implementation - writes to buffer
 static void esp32_pixel(int strip, int led, uint8_t *r, uint8_t *g,
@@ -39,30 +97,149 @@ static void esp32_pixel(int strip, int led, uint8_t *r, uint8_t *g,
   if (led < 0 || led >= state.num_leds[strip])
     return;
 
-  if (r && g && b) {
-    pixel_buffer[strip][led][0] = *r;
-    pixel_buffer[strip][led][1] = *g;
-    pixel_buffer[strip][led][2] = *b;
+  RGB *px = &render_target[strip * LED_VIZ_MAX_LEDS_PER_STRIP + led];
+  if (r && g && b && (px->r != *r || px->g != *g || px->b != *b)) {
+    px->r = *r;
+    px->g = *g;
+    px->b = *b;
+    if (render_target == &pixel_buffer[0][0])
+      strip_dirty[strip] = 1;
   }
-  *r = pixel_buffer[strip][led][0];
-  *g = pixel_buffer[strip][led][1];
-  *b = pixel_buffer[strip][led][2];
+  *r = px->r;
+  *g = px->g;
+  *b = px->b;
 }
 
-// Send pixel buffer to actual LED strips
+// Run a program into target (laid out like pixel_buffer)
+static void render_program(const Program *program, RGB *target,
+                           double time_ms) {
+  render_target = target;
+  _led_viz_set_framebuffer(target, LED_VIZ_MAX_LEDS_PER_STRIP);
+
+  // Per-strip programs run strip by strip here. update_strip wins over
+  // update, as in the desktop runtime, so both render the same frames.
+  if (program->update_strip) {
+    for (int s = 0; s < state.num_strips; s++) {
+      program->update_strip(s, time_ms, esp32_pixel, *state.current_palette);
+    }
+  } else if (program->update) {
+    program->update(time_ms, esp32_pixel, *state.current_palette);
+  }
+
+  render_target = &pixel_buffer[0][0];
+  _led_viz_set_framebuffer(render_target, LED_VIZ_MAX_LEDS_PER_STRIP);
+}
+
+// Render every layer and flatten them into pixel_buffer, bottom to top
+static void render_layers(double time_ms) {
+  int count = state.num_strips * LED_VIZ_MAX_LEDS_PER_STRIP;
+  RGB *out = &pixel_buffer[0][0];
+
+  for (int i = 0; i < num_layers; i++) {
+    render_program(layers[i].program, layers[i].pixels, time_ms);
+  }
+
+  memset(out, 0, (size_t)count * sizeof(RGB));
+  for (int i = 0; i < num_layers; i++) {
+    composite_n(out, layers[i].pixels, count, layers[i].blend,
+                layers[i].opacity);
+  }
+  memset(strip_touched, 1, sizeof(strip_touched));
+}
+
+static void finish_transition(void) {
+  if (!state.transition_from)
+    return;
+  if (state.transition_from->cleanup) {
+    state.transition_from->cleanup();
+  }
+  state.transition_from = NULL;
+}
+
+// Run both programs of a transition into their buffers and mix them into
+// pixel_buffer, warning once if the overlap does not fit the frame. Progress
+// follows program time, as in the visualizer.
+static void run_transition(double time_ms, int64_t frame_time_us) {
+  double p = (time_ms - state.transition_start_ms) / state.transition_ms;
+  uint8_t progress = p <= 0.0 ? 0 : p >= 1.0 ? 255 : (uint8_t)(p * 255.0);
+
+  int64_t now = esp_timer_get_time();
+  render_program(state.transition_from, state.transition_from_pixels,
+                 time_ms);
+  int64_t from_done = esp_timer_get_time();
+  render_program(state.current_program, state.transition_to_pixels, time_ms);
+  int64_t from_us = from_done - now;
+  int64_t to_us = esp_timer_get_time() - from_done;
+
+  if (!state.transition_warned && from_us + to_us > frame_time_us) {
+    ESP_LOGW(TAG,
+             "Transition overlap takes %lld us (%lld + %lld), over the %lld "
+             "us frame budget",
+             (long long)(from_us + to_us), (long long)from_us,
+             (long long)to_us, (long long)frame_time_us);
+    state.transition_warned = true;
+  }
+
+  for (int s = 0; s < state.num_strips; s++) {
+    size_t off = (size_t)s * LED_VIZ_MAX_LEDS_PER_STRIP;
+    state.transition_func(s, state.transition_from_pixels + off,
+                          state.transition_to_pixels + off, pixel_buffer[s],
+                          state.num_leds[s], progress);
+  }
+  memset(strip_touched, 1, sizeof(strip_touched));
+
+  if (progress == 255) {
+    finish_transition();
+  }
+}
+
+// Decode the recorded frame showing at time_ms into pixel_buffer
+static void play_recording(double time_ms) {
+  LedVizRecording *rec = &state.recording;
+  int frame = led_viz_recording_find(rec, fmod(time_ms, state.recording_ms));
+  if (frame == rec->frame)
+    return;
+  if (!led_viz_recording_decode(rec, frame, state.recording_pixels, NULL)) {
+    ESP_LOGE(TAG, "Recording is corrupt at frame %d, stopping playback",
+             frame);
+    led_viz_play(NULL, 0);
+    return;
+  }
+
+  const uint8_t *pixels = state.recording_pixels;
+  for (int s = 0; s < state.num_strips; s++) {
+    size_t bytes = (size_t)state.num_leds[s] * sizeof(RGB);
+    memcpy(pixel_buffer[s], pixels, bytes);
+    pixels += bytes;
+  }
+  memset(strip_touched, 1, sizeof(strip_touched));
+}
+
+// Send changed strips of the pixel buffer to the actual LED strips
 static void refresh_strips(void) {
   for (int s = 0; s < state.num_strips; s++) {
+    const RGB *pixels = pixel_buffer[s];
+    size_t bytes = (size_t)state.num_leds[s] * sizeof(RGB);
+    bool changed = strip_dirty[s] ||
+                   (strip_touched[s] && memcmp(pixels, sent_buffer[s], bytes));
+    strip_dirty[s] = 0;
+    strip_touched[s] = 0;
+    if (!changed)
+      continue;
+
     for (int i = 0; i < state.num_leds[s]; i++) {
-      led_strip_set_pixel(state.strips[s], i, pixel_buffer[s][i][0],
-                          pixel_buffer[s][i][1], pixel_buffer[s][i][2]);
+      led_strip_set_pixel(state.strips[s], i, pixels[i].r, pixels[i].g,
+                          pixels[i].b);
     }
     led_strip_refresh(state.strips[s]);
+    memcpy(sent_buffer[s], pixels, bytes);
   }
 }
 
 int led_viz_init(const LedVizConfig *config) {
   memset(&state, 0, sizeof(state));
   memset(pixel_buffer, 0, sizeof(pixel_buffer));
+  memset(sent_buffer, 0, sizeof(sent_buffer)); // strips start cleared
 
   // Read strip config from program file
   state.num_strips = NUM_STRIPS;
@@ -70,9 +247,13 @@ int led_viz_init(const LedVizConfig *config) {
     state.num_strips = LED_VIZ_MAX_STRIPS;
 
   state.target_fps = config->target_fps > 0 ? config->target_fps : 60;
+  state.clock = config->clock;
 
-  // Set strip setup for accessor functions
+  // Set strip setup and framebuffer for accessor functions
   _led_viz_set_strip_setup(strip_setup, state.num_strips);
+  _led_viz_set_framebuffer(&pixel_buffer[0][0], LED_VIZ_MAX_LEDS_PER_STRIP);
+  _led_viz_set_palette256(&palette256);
+  _led_viz_set_touched_flags(strip_touched);
 
   // Initialize each strip using ESP-IDF's led_strip component
   for (int i = 0; i < state.num_strips; i++) {
@@ -120,10 +301,37 @@ void led_viz_set_program(int index) {
   extern const int NUM_PROGRAMS;
 
   if (index >= 0 && index < NUM_PROGRAMS) {
-    if (state.current_program && state.current_program->cleanup) {
-      state.current_program->cleanup();
-    }
+    // A switch during a transition lands the previous one first
+    finish_transition();
+
+    const Program *outgoing = state.current_program;
     state.current_program = &programs[index];
+
+    // Keep the outgoing program running while it fades out (only once
+    // frames are rendered and no layers replace the program output)
+    if (outgoing && outgoing != state.current_program && state.frames > 0 &&
+        state.transition_func && num_layers == 0) {
+      size_t bytes = (size_t)state.num_strips * LED_VIZ_MAX_LEDS_PER_STRIP *
+                     sizeof(RGB);
+      memcpy(state.transition_from_pixels, pixel_buffer, bytes);
+      memset(state.transition_to_pixels, 0, bytes);
+      state.transition_start_ms = state.time_ms;
+      state.transition_warned = false;
+      state.transition_from = outgoing;
+
+      int64_t frame_time_us = 1000000 / state.target_fps;
+      if (2 * state.program_cost_us > frame_time_us) {
+        ESP_LOGW(TAG,
+                 "'%s' takes %lld us per frame, running two programs will "
+                 "likely exceed the %lld us frame budget",
+                 outgoing->name, (long long)state.program_cost_us,
+                 (long long)frame_time_us);
+        state.transition_warned = true;
+      }
+    } else if (outgoing && outgoing->cleanup) {
+      outgoing->cleanup();
+    }
+
     if (state.current_program->init) {
       state.current_program->init();
     }
@@ -131,35 +339,211 @@ void led_viz_set_program(int index) {
   }
 }
 
+int led_viz_set_transition(TransitionFunc func, int duration_ms) {
+  finish_transition();
+  free(state.transition_from_pixels);
+  free(state.transition_to_pixels);
+  state.transition_from_pixels = NULL;
+  state.transition_to_pixels = NULL;
+  state.transition_func = NULL;
+  if (!func || duration_ms <= 0)
+    return 0;
+
+  size_t bytes =
+      (size_t)state.num_strips * LED_VIZ_MAX_LEDS_PER_STRIP * sizeof(RGB);
+  state.transition_from_pixels = malloc(bytes);
+  state.transition_to_pixels = malloc(bytes);
+  if (!state.transition_from_pixels || !state.transition_to_pixels) {
+    ESP_LOGE(TAG, "No memory for transition buffers (2 x %u bytes)",
+             (unsigned)bytes);
+    free(state.transition_from_pixels);
+    free(state.transition_to_pixels);
+    state.transition_from_pixels = NULL;
+    state.transition_to_pixels = NULL;
+    return -1;
+  }
+
+  state.transition_func = func;
+  state.transition_ms = duration_ms;
+  return 0;
+}
+
+static void free_layers(void) {
+  for (int i = 0; i < num_layers; i++) {
+    free(layers[i].pixels);
+  }
+  memset(layers, 0, sizeof(layers));
+  num_layers = 0;
+}
+
+int led_viz_set_layers(const LayerDef *defs, int count) {
+  extern const Program programs[];
+  extern const int NUM_PROGRAMS;
+
+  free_layers();
+  if (count > LED_VIZ_MAX_LAYERS) {
+    ESP_LOGW(TAG, "Only %d layers supported", LED_VIZ_MAX_LAYERS);
+    count = LED_VIZ_MAX_LAYERS;
+  }
+
+  size_t bytes = (size_t)state.num_strips * LED_VIZ_MAX_LEDS_PER_STRIP *
+                 sizeof(RGB);
+  for (int i = 0; i < count; i++) {
+    const Program *program = NULL;
+    for (int p = 0; p < NUM_PROGRAMS; p++) {
+      if (defs[i].program && strcmp(programs[p].name, defs[i].program) == 0) {
+        program = &programs[p];
+        break;
+      }
+    }
+    if (!program) {
+      ESP_LOGE(TAG, "Layer %d: no program named '%s'", i,
+               defs[i].program ? defs[i].program : "(null)");
+      free_layers();
+      return -1;
+    }
+
+    RGB *pixels = calloc(1, bytes);
+    if (!pixels) {
+      ESP_LOGE(TAG, "Layer %d: out of memory (%u bytes)", i,
+               (unsigned)bytes);
+      free_layers();
+      return -1;
+    }
+
+    layers[num_layers++] = (Layer){
+        .program = program,
+        .blend = defs[i].blend,
+        .opacity = defs[i].opacity,
+        .pixels = pixels,
+    };
+    if (program->init) {
+      program->init();
+    }
+  }
+
+  ESP_LOGI(TAG, "Compositing %d layer(s)", num_layers);
+  return 0;
+}
+
+int led_viz_play(const void *recording, size_t size) {
+  free(state.recording_pixels);
+  state.recording_pixels = NULL;
+  state.playing = false;
+  if (!recording)
+    return 0;
+
+  LedVizRecording *rec = &state.recording;
+  if (!led_viz_recording_open(rec, recording, size) ||
+      rec->num_frames == 0) {
+    ESP_LOGE(TAG, "Not a complete recording");
+    return -1;
+  }
+  bool matches = (int)rec->header.num_strips == state.num_strips;
+  for (int s = 0; matches && s < state.num_strips; s++) {
+    matches = rec->strips[s].num_leds == state.num_leds[s];
+  }
+  if (!matches) {
+    ESP_LOGE(TAG, "The recording's strips don't match strip_setup");
+    return -1;
+  }
+
+  state.recording_pixels = malloc(rec->header.frame_size + 1);
+  if (!state.recording_pixels) {
+    ESP_LOGE(TAG, "No memory for the recording (%u bytes)",
+             (unsigned)rec->header.frame_size);
+    return -1;
+  }
+  state.recording_ms = led_viz_recording_duration(rec);
+  state.playing = true;
+  ESP_LOGI(TAG, "Playing %d recorded frame(s)", rec->num_frames);
+  return 0;
+}
+
 void led_viz_set_palette(const Palette16 *palette) {
   state.current_palette = palette;
+  palette_expand(palette256, *palette, true);
+}
+
+// Time from the last timecode, run on by esp_timer time since the loop took
+// it. Updates land at the next frame.
+static double timecode_time(int64_t now_us) {
+  uint32_t seq = state.timecode_seq;
+  if (seq != state.timecode_seen) {
+    state.timecode_seen = seq;
+    state.timecode_base_ms = state.timecode_ms;
+    state.timecode_us = now_us;
+  }
+  if (state.timecode_seen == 0)
+    return 0.0; // hold until the first one
+
+  double since_ms = (now_us - state.timecode_us) / 1000.0;
+  if (since_ms > TIMECODE_FREEWHEEL_MS)
+    since_ms = TIMECODE_FREEWHEEL_MS;
+  double time_ms = state.timecode_base_ms + since_ms;
+  // A timecode arriving late would step back a little: hold instead, but
+  // follow real jumps (a seek)
+  if (state.frames > 0 && time_ms < state.time_ms &&
+      state.time_ms - time_ms < TIMECODE_JITTER_MS)
+    time_ms = state.time_ms;
+  return time_ms;
+}
+
+void led_viz_set_timecode(uint32_t time_ms) {
+  state.timecode_ms = time_ms;
+  state.timecode_seq++;
+}
+
+void led_viz_render_frame(double time_ms) {
+  if (!state.current_palette) {
+    led_viz_set_palette(&PALETTE_RAINBOW);
+  }
+
+  // Play the recording if one is set, else run the layer stack, a running
+  // transition, or the current program
+  if (state.playing) {
+    play_recording(time_ms);
+  } else if (num_layers > 0) {
+    render_layers(time_ms);
+  } else if (state.transition_from) {
+    run_transition(time_ms, 1000000 / state.target_fps);
+  } else if (state.current_program) {
+    int64_t render_start = esp_timer_get_time();
+    render_program(state.current_program, &pixel_buffer[0][0], time_ms);
+    int64_t cost = esp_timer_get_time() - render_start;
+    state.program_cost_us = (state.program_cost_us * 7 + cost) / 8;
+  }
+  state.time_ms = time_ms;
+  state.frames++;
+
+  // Send to hardware
+  refresh_strips();
 }
 
 void led_viz_run(void) {
-  if (!state.current_program) {
+  if (!state.current_program && num_layers == 0 && !state.playing) {
     ESP_LOGE(TAG, "No program set");
     return;
   }
-  if (!state.current_palette) {
-    state.current_palette = &PALETTE_RAINBOW;
-  }
 
   state.running = true;
   int64_t frame_time_us = 1000000 / state.target_fps;
 
   ESP_LOGI(TAG, "Starting animation loop");
 
-  while (state.running) {
+  for (uint32_t frame = 0; state.running; frame++) {
     int64_t frame_start = esp_timer_get_time();
 
-    // Calculate time since start
-    double time_ms = (frame_start - state.start_time_us) / 1000.0;
-
-    // Run the program
-    state.current_program->update(time_ms, esp32_pixel, *state.current_palette);
-
-    // Send to hardware
-    refresh_strips();
+    // Program time from the configured clock
+    double time_ms;
+    if (state.clock == LED_VIZ_CLOCK_FIXED) {
+      time_ms = frame * 1000.0 / state.target_fps;
+    } else if (state.clock == LED_VIZ_CLOCK_TIMECODE) {
+      time_ms = timecode_time(frame_start);
+    } else {
+      time_ms = (frame_start - state.start_time_us) / 1000.0;
+    }
+    led_viz_render_frame(time_ms);
 
     // Frame timing
     int64_t frame_end = esp_timer_get_time();
@@ -176,6 +560,9 @@ void led_viz_stop(void) { state.running = false; }
 
 void led_viz_deinit(void) {
   state.running = false;
+  free_layers();
+  led_viz_set_transition(NULL, 0);
+  led_viz_play(NULL, 0);
 
   for (int i = 0; i < state.num_strips; i++) {
     if (state.strips[i]) {
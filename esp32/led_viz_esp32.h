@@ -5,24 +5,56 @@
 
 #include "led_viz.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 // Hardware limits
 #define LED_VIZ_MAX_STRIPS 8
 #define LED_VIZ_MAX_LEDS_PER_STRIP 300
+#define LED_VIZ_MAX_LAYERS 4
+
+// Where program time comes from in led_viz_run()
+typedef enum {
+  LED_VIZ_CLOCK_WALL,     // esp_timer time since led_viz_init (default)
+  LED_VIZ_CLOCK_FIXED,    // exactly 1000 / target_fps ms per frame, from 0
+  LED_VIZ_CLOCK_TIMECODE, // led_viz_set_timecode(), run on between updates
+} LedVizClock;
 
 // Runtime configuration (GPIO pins only - strip config comes from program file)
 typedef struct {
   int gpio_pins[LED_VIZ_MAX_STRIPS];
   int target_fps;
+  LedVizClock clock;
 } LedVizConfig;
 
 // Initialize the runtime with given configuration
 // Returns 0 on success, -1 on error
 int led_viz_init(const LedVizConfig *config);
 
-// Set the active program (index into your programs[] array)
+// Set the active program (index into your programs[] array). While the
+// animation loop runs, this starts the transition set below.
 void led_viz_set_program(int index);
 
+// Transition used by led_viz_set_program(), e.g. transition_crossfade or
+// transition_wipe (NULL or 0 ms = hard cut, the default). Allocates two
+// NUM_STRIPS * LED_VIZ_MAX_LEDS_PER_STRIP pixel buffers on the heap.
+// Returns 0 on success, -1 if out of memory.
+int led_viz_set_transition(TransitionFunc func, int duration_ms);
+
+// Run several programs at once as stacked layers (e.g. your layer_setup[]).
+// Each layer gets a heap buffer of NUM_STRIPS * LED_VIZ_MAX_LEDS_PER_STRIP
+// pixels. While layers are set they replace the active program; pass 0 layers
+// to go back to it. Returns 0 on success, -1 on an unknown name or no memory.
+int led_viz_set_layers(const LayerDef *layers, int num_layers);
+
+// Play a recording (made with led_viz --record or led_viz_headless --format
+// rec) in place of the programs, looping. recording points at the whole file,
+// 4-byte aligned, and must stay valid while it plays, e.g. a data partition
+// mapped with esp_partition_mmap(). Its strips must match strip_setup[].
+// Decoding needs one heap buffer of a frame. Pass NULL to stop. Returns 0 on
+// success, -1 on a bad file, other strips or no memory.
+int led_viz_play(const void *recording, size_t size);
+
 // Set the active palette
 void led_viz_set_palette(const Palette16 *palette);
 
@@ -33,5 +65,16 @@ void led_viz_run(void);
 // Stop the animation loop
 void led_viz_stop(void);
 
+// Feed the timecode clock (e.g. from MIDI timecode, Art-Net or a serial
+// line), from any task. Frames between updates run on by esp_timer time, for
+// at most a second.
+void led_viz_set_timecode(uint32_t time_ms);
+
+// Render one frame at time_ms and send it to the strips, without the loop or
+// its timing. Stepping the same time_ms sequence (e.g. frame * 1000.0 / fps)
+// gives the same frames as led_viz_headless, also on a host build with
+// led_strip stubbed out.
+void led_viz_render_frame(double time_ms);
+
 // Cleanup and release resources
 void led_viz_deinit(void);
@@ -0,0 +1,425 @@
+// LED Visualizer SDK - Batch color kernels
+// Span versions of the per-pixel color math, shared by the SDK runtime
+// (led_viz_sdk.c, compiled into programs) and the visualizer core
+// (src/palette.c, for layers and transitions), so both always compute the
+// same colors. Not a regular header: it defines the functions, so include it
+// exactly once per binary, after led_viz.h or palette.h (RGB, Palette16,
+// LayerBlend).
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// All kernels treat RGB spans as flat byte arrays (every channel gets the same
+// math), so they vectorize without shuffles. The implementation is picked at
+// compile time: AVX2 or SSE2 on x86, NEON on ARM, plain C everywhere else
+// (including ESP32). Every path produces identical results.
+
+// out = w ? (a * (255 - w) + b * w) >> 8 : a, per byte (palette_sample lerp)
+static void lerp_bytes(uint8_t *out, const uint8_t *a, const uint8_t *b,
+                       const uint8_t *w, size_t n) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi8((char)0xFF);
+  for (; i + 32 <= n; i += 32) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+    __m256i vw = _mm256_loadu_si256((const __m256i *)(w + i));
+    __m256i vi = _mm256_xor_si256(vw, ones); // 255 - w
+    __m256i lo = _mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero),
+                           _mm256_unpacklo_epi8(vi, zero)),
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero),
+                           _mm256_unpacklo_epi8(vw, zero)));
+    __m256i hi = _mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero),
+                           _mm256_unpackhi_epi8(vi, zero)),
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero),
+                           _mm256_unpackhi_epi8(vw, zero)));
+    __m256i res = _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+                                      _mm256_srli_epi16(hi, 8));
+    __m256i keep = _mm256_cmpeq_epi8(vw, zero);
+    res = _mm256_blendv_epi8(res, va, keep);
+    _mm256_storeu_si256((__m256i *)(out + i), res);
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+    for (; i + 16 <= n; i += 16) {
+      __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+      __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+      __m128i vw = _mm_loadu_si128((const __m128i *)(w + i));
+      __m128i vi = _mm_xor_si128(vw, ones); // 255 - w
+      __m128i lo = _mm_add_epi16(
+          _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero),
+                          _mm_unpacklo_epi8(vi, zero)),
+          _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero),
+                          _mm_unpacklo_epi8(vw, zero)));
+      __m128i hi = _mm_add_epi16(
+          _mm_mullo_epi16(_mm_unpackhi_epi8(va, zero),
+                          _mm_unpackhi_epi8(vi, zero)),
+          _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero),
+                          _mm_unpackhi_epi8(vw, zero)));
+      __m128i res =
+          _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+      __m128i keep = _mm_cmpeq_epi8(vw, zero);
+      res = _mm_or_si128(_mm_and_si128(keep, va), _mm_andnot_si128(keep, res));
+      _mm_storeu_si128((__m128i *)(out + i), res);
+    }
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t va = vld1q_u8(a + i);
+    uint8x16_t vb = vld1q_u8(b + i);
+    uint8x16_t vw = vld1q_u8(w + i);
+    uint8x16_t vi = vmvnq_u8(vw); // 255 - w
+    uint16x8_t lo = vmull_u8(vget_low_u8(va), vget_low_u8(vi));
+    uint16x8_t hi = vmull_u8(vget_high_u8(va), vget_high_u8(vi));
+    lo = vmlal_u8(lo, vget_low_u8(vb), vget_low_u8(vw));
+    hi = vmlal_u8(hi, vget_high_u8(vb), vget_high_u8(vw));
+    uint8x16_t res = vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+    vst1q_u8(out + i, vbslq_u8(vceqq_u8(vw, vdupq_n_u8(0)), va, res));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = w[i] ? (uint8_t)((a[i] * (255 - w[i]) + b[i] * w[i]) >> 8) : a[i];
+  }
+}
+
+// p = (p * scale) >> 8, per byte
+static void scale_bytes(uint8_t *p, size_t n, uint8_t scale) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i vs = _mm256_set1_epi16(scale);
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i lo =
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), vs);
+    __m256i hi =
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), vs);
+    _mm256_storeu_si256((__m256i *)(p + i),
+                        _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+                                            _mm256_srli_epi16(hi, 8)));
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i vs = _mm_set1_epi16(scale);
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+      __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), vs);
+      __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), vs);
+      _mm_storeu_si128(
+          (__m128i *)(p + i),
+          _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+  }
+#elif defined(__ARM_NEON)
+  const uint8x8_t vs = vdup_n_u8(scale);
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8(p + i);
+    uint16x8_t lo = vmull_u8(vget_low_u8(v), vs);
+    uint16x8_t hi = vmull_u8(vget_high_u8(v), vs);
+    vst1q_u8(p + i, vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+  }
+#endif
+  for (; i < n; i++) {
+    p[i] = (uint8_t)((p[i] * scale) >> 8);
+  }
+}
+
+// dst = (dst * (255 - amount) + src * amount) >> 8, per byte
+static void blend_bytes(uint8_t *dst, const uint8_t *src, size_t n,
+                        uint8_t amount) {
+  size_t i = 0;
+  uint8_t inv = 255 - amount;
+#if defined(__AVX2__)
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i va = _mm256_set1_epi16(amount);
+  const __m256i vi = _mm256_set1_epi16(inv);
+  for (; i + 32 <= n; i += 32) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i lo = _mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), vi),
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), va));
+    __m256i hi = _mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), vi),
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), va));
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+                                            _mm256_srli_epi16(hi, 8)));
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i va = _mm_set1_epi16(amount);
+    const __m128i vi = _mm_set1_epi16(inv);
+    for (; i + 16 <= n; i += 16) {
+      __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+      __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i lo =
+          _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), vi),
+                        _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), va));
+      __m128i hi =
+          _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), vi),
+                        _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), va));
+      _mm_storeu_si128(
+          (__m128i *)(dst + i),
+          _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+  }
+#elif defined(__ARM_NEON)
+  const uint8x8_t va = vdup_n_u8(amount);
+  const uint8x8_t vi = vdup_n_u8(inv);
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t d = vld1q_u8(dst + i);
+    uint8x16_t s = vld1q_u8(src + i);
+    uint16x8_t lo = vmull_u8(vget_low_u8(d), vi);
+    uint16x8_t hi = vmull_u8(vget_high_u8(d), vi);
+    lo = vmlal_u8(lo, vget_low_u8(s), va);
+    hi = vmlal_u8(hi, vget_high_u8(s), va);
+    vst1q_u8(dst + i, vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+  }
+#endif
+  for (; i < n; i++) {
+    dst[i] = (uint8_t)((dst[i] * inv + src[i] * amount) >> 8);
+  }
+}
+
+// out = blend(a, b) per byte for the separable layer modes. multiply and
+// screen divide by 255 with rounding: (t + (t >> 8)) >> 8, t = x + 128.
+static void combine_bytes(uint8_t *out, const uint8_t *a, const uint8_t *b,
+                          size_t n, LayerBlend mode) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  {
+    const bool screen = mode == LAYER_SCREEN;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi8((char)0xFF);
+    const __m256i half = _mm256_set1_epi16(128);
+    for (; i + 32 <= n; i += 32) {
+      __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+      __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+      __m256i res;
+      if (mode == LAYER_ADD) {
+        res = _mm256_adds_epu8(va, vb);
+      } else if (mode == LAYER_MAX) {
+        res = _mm256_max_epu8(va, vb);
+      } else {
+        if (screen) {
+          va = _mm256_xor_si256(va, ones);
+          vb = _mm256_xor_si256(vb, ones);
+        }
+        __m256i lo = _mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero),
+                               _mm256_unpacklo_epi8(vb, zero)),
+            half);
+        __m256i hi = _mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero),
+                               _mm256_unpackhi_epi8(vb, zero)),
+            half);
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)),
+                               8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)),
+                               8);
+        res = _mm256_packus_epi16(lo, hi);
+        if (screen)
+          res = _mm256_xor_si256(res, ones);
+      }
+      _mm256_storeu_si256((__m256i *)(out + i), res);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const bool screen = mode == LAYER_SCREEN;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+    const __m128i half = _mm_set1_epi16(128);
+    for (; i + 16 <= n; i += 16) {
+      __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+      __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+      __m128i res;
+      if (mode == LAYER_ADD) {
+        res = _mm_adds_epu8(va, vb);
+      } else if (mode == LAYER_MAX) {
+        res = _mm_max_epu8(va, vb);
+      } else {
+        if (screen) {
+          va = _mm_xor_si128(va, ones);
+          vb = _mm_xor_si128(vb, ones);
+        }
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero),
+                                                   _mm_unpacklo_epi8(vb, zero)),
+                                   half);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero),
+                                                   _mm_unpackhi_epi8(vb, zero)),
+                                   half);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+        res = _mm_packus_epi16(lo, hi);
+        if (screen)
+          res = _mm_xor_si128(res, ones);
+      }
+      _mm_storeu_si128((__m128i *)(out + i), res);
+    }
+  }
+#elif defined(__ARM_NEON)
+  const bool screen = mode == LAYER_SCREEN;
+  const uint16x8_t half = vdupq_n_u16(128);
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t va = vld1q_u8(a + i);
+    uint8x16_t vb = vld1q_u8(b + i);
+    uint8x16_t res;
+    if (mode == LAYER_ADD) {
+      res = vqaddq_u8(va, vb);
+    } else if (mode == LAYER_MAX) {
+      res = vmaxq_u8(va, vb);
+    } else {
+      if (screen) {
+        va = vmvnq_u8(va);
+        vb = vmvnq_u8(vb);
+      }
+      uint16x8_t lo =
+          vaddq_u16(vmull_u8(vget_low_u8(va), vget_low_u8(vb)), half);
+      uint16x8_t hi =
+          vaddq_u16(vmull_u8(vget_high_u8(va), vget_high_u8(vb)), half);
+      res = vcombine_u8(vshrn_n_u16(vsraq_n_u16(lo, lo, 8), 8),
+                        vshrn_n_u16(vsraq_n_u16(hi, hi, 8), 8));
+      if (screen)
+        res = vmvnq_u8(res);
+    }
+    vst1q_u8(out + i, res);
+  }
+#endif
+  for (; i < n; i++) {
+    unsigned x = a[i], y = b[i], t;
+    switch (mode) {
+    case LAYER_ADD:
+      out[i] = (uint8_t)(x + y > 255 ? 255 : x + y);
+      break;
+    case LAYER_MAX:
+      out[i] = (uint8_t)(x > y ? x : y);
+      break;
+    case LAYER_SCREEN:
+      t = (255 - x) * (255 - y) + 128;
+      out[i] = (uint8_t)(255 - ((t + (t >> 8)) >> 8));
+      break;
+    default: // LAYER_MULTIPLY
+      t = x * y + 128;
+      out[i] = (uint8_t)((t + (t >> 8)) >> 8);
+      break;
+    }
+  }
+}
+
+void palette_sample_n(const Palette16 palette, const uint8_t *indices,
+                      uint8_t brightness, bool interpolate, RGB *out,
+                      int count) {
+  // Gather both gradient endpoints per LED, then lerp whole chunks at once
+  enum { CHUNK = 64 };
+  RGB next[CHUNK];
+  uint8_t weight[CHUNK * 3];
+
+  for (int start = 0; start < count; start += CHUNK) {
+    int n = count - start < CHUNK ? count - start : CHUNK;
+    RGB *dst = out + start;
+
+    if (!interpolate) {
+      for (int i = 0; i < n; i++) {
+        dst[i] = palette[indices[start + i] >> 4];
+      }
+    } else {
+      for (int i = 0; i < n; i++) {
+        uint8_t index = indices[start + i];
+        uint8_t blend = (uint8_t)((index & 0x0F) << 4);
+        dst[i] = palette[index >> 4];
+        next[i] = palette[((index >> 4) + 1) & 0x0F];
+        weight[i * 3 + 0] = blend;
+        weight[i * 3 + 1] = blend;
+        weight[i * 3 + 2] = blend;
+      }
+      lerp_bytes((uint8_t *)dst, (const uint8_t *)dst, (const uint8_t *)next,
+                 weight, (size_t)n * 3);
+    }
+  }
+
+  if (brightness < 255) {
+    scale_bytes((uint8_t *)out, (size_t)count * 3, brightness);
+  }
+}
+
+void scale8_n(RGB *leds, int count, uint8_t scale) {
+  if (scale == 255 || count <= 0)
+    return;
+  scale_bytes((uint8_t *)leds, (size_t)count * 3, scale);
+}
+
+void blend_n(RGB *dst, const RGB *src, int count, uint8_t amount) {
+  if (amount == 0 || count <= 0)
+    return;
+  if (amount == 255) {
+    memmove(dst, src, (size_t)count * sizeof(RGB));
+    return;
+  }
+  blend_bytes((uint8_t *)dst, (const uint8_t *)src, (size_t)count * 3, amount);
+}
+
+void fade_n(RGB *leds, int count, uint8_t amount) {
+  scale8_n(leds, count, 255 - amount);
+}
+
+void composite_n(RGB *dst, const RGB *src, int count, LayerBlend mode,
+                 uint8_t opacity) {
+  if (opacity == 0 || count <= 0)
+    return;
+  if (mode == LAYER_ALPHA) {
+    blend_n(dst, src, count, opacity);
+    return;
+  }
+
+  // Blend into a scratch chunk, then mix it in by opacity
+  enum { CHUNK = 64 };
+  RGB mixed[CHUNK];
+  for (int start = 0; start < count; start += CHUNK) {
+    int n = count - start < CHUNK ? count - start : CHUNK;
+    uint8_t *out = opacity == 255 ? (uint8_t *)(dst + start) : (uint8_t *)mixed;
+    combine_bytes(out, (const uint8_t *)(dst + start),
+                  (const uint8_t *)(src + start), (size_t)n * 3, mode);
+    if (opacity < 255) {
+      blend_n(dst + start, mixed, n, opacity);
+    }
+  }
+}
+
+void palette_expand(Palette256 out, const Palette16 palette, bool interpolate) {
+  for (int i = 0; i < 256; i++) {
+    out[i] = palette_sample(palette, (uint8_t)i, 255, interpolate);
+  }
+}
+
+void palette256_sample(const Palette256 palette, const uint8_t *indices,
+                       uint8_t brightness, RGB *out, int count) {
+  for (int i = 0; i < count; i++) {
+    out[i] = palette[indices[i]];
+  }
+  scale8_n(out, count, brightness);
+}
@@ -0,0 +1,186 @@
+// LED Visualizer SDK - Fixed-point math
+// Table-driven integer replacements for sin/exp/fmod style float math, so the
+// same program runs fast on the desktop and on MCUs without an FPU for double.
+// Included by led_viz.h; everything here is header-only.
+
+#pragma once
+
+#include <stdint.h>
+
+// ============================================================================
+// Lookup tables (generated at compile time)
+// ============================================================================
+
+// sin(x) for 0 <= x <= pi/2 as a constant expression (Taylor series to x^11,
+// error < 1e-7), so tables below are built by the compiler, not at runtime
+#define LVM_SIN_POLY(x)                                                        \
+  ((x) * (1.0 - (x) * (x) / 6.0 *                                              \
+                    (1.0 - (x) * (x) / 20.0 *                                  \
+                               (1.0 - (x) * (x) / 42.0 *                       \
+                                          (1.0 - (x) * (x) / 72.0 *            \
+                                                     (1.0 - (x) * (x) /        \
+                                                                110.0))))))
+
+// Quarter-wave entry i of 256: round(32767 * sin(i / 256 * pi / 2))
+#define LVM_SIN_Q15(i)                                                         \
+  (int16_t)(32767.0 * LVM_SIN_POLY((i) * (1.5707963267948966 / 256.0)) + 0.5)
+
+#define LVM_SIN_Q15_4(i)                                                       \
+  LVM_SIN_Q15(i), LVM_SIN_Q15((i) + 1), LVM_SIN_Q15((i) + 2),                  \
+      LVM_SIN_Q15((i) + 3)
+#define LVM_SIN_Q15_16(i)                                                      \
+  LVM_SIN_Q15_4(i), LVM_SIN_Q15_4((i) + 4), LVM_SIN_Q15_4((i) + 8),            \
+      LVM_SIN_Q15_4((i) + 12)
+#define LVM_SIN_Q15_64(i)                                                      \
+  LVM_SIN_Q15_16(i), LVM_SIN_Q15_16((i) + 16), LVM_SIN_Q15_16((i) + 32),       \
+      LVM_SIN_Q15_16((i) + 48)
+
+// 257 entries: 0 .. pi/2 inclusive, so interpolation never needs a wrap
+static const int16_t led_viz_sin_quarter[257] = {
+    LVM_SIN_Q15_64(0),   LVM_SIN_Q15_64(64), LVM_SIN_Q15_64(128),
+    LVM_SIN_Q15_64(192), LVM_SIN_Q15(256),
+};
+
+// ============================================================================
+// Scaling and saturating arithmetic
+// ============================================================================
+
+// i * scale / 256; 255 leaves i unchanged (same rule as scale8_n() and the
+// brightness argument of palette_sample())
+static inline uint8_t scale8(uint8_t i, uint8_t scale) {
+  return scale == 255 ? i : (uint8_t)(((uint16_t)i * scale) >> 8);
+}
+
+// Like scale8(), but a non-zero input never scales down to zero
+static inline uint8_t scale8_video(uint8_t i, uint8_t scale) {
+  if (scale == 255)
+    return i;
+  return (uint8_t)((((uint16_t)i * scale) >> 8) + (i && scale ? 1 : 0));
+}
+
+// i * scale / 65536; 65535 leaves i unchanged
+static inline uint16_t scale16(uint16_t i, uint16_t scale) {
+  return scale == 65535 ? i : (uint16_t)(((uint32_t)i * scale) >> 16);
+}
+
+// Saturating add/subtract
+static inline uint8_t qadd8(uint8_t a, uint8_t b) {
+  unsigned sum = (unsigned)a + b;
+  return sum > 255 ? 255 : (uint8_t)sum;
+}
+
+static inline uint8_t qsub8(uint8_t a, uint8_t b) {
+  return a > b ? (uint8_t)(a - b) : 0;
+}
+
+// Mix b into a: amount 0 returns a, 255 returns b (same math as blend_n())
+static inline uint8_t blend8(uint8_t a, uint8_t b, uint8_t amount) {
+  if (amount == 0)
+    return a;
+  if (amount == 255)
+    return b;
+  return (uint8_t)(((uint16_t)a * (255 - amount) + (uint16_t)b * amount) >> 8);
+}
+
+// ============================================================================
+// Trigonometry
+// ============================================================================
+
+// theta: 0-65535 is one full turn. Returns -32767..32767, within 1.51 of
+// 32767 * sin() (src/tests/math_test.c checks every input).
+static inline int16_t sin16(uint16_t theta) {
+  uint16_t offset = theta & 0x3FFF;
+  if (theta & 0x4000)
+    offset = 0x4000 - offset; // second/fourth quadrant run backwards
+
+  uint16_t idx = offset >> 6;
+  int32_t frac = offset & 0x3F;
+  int32_t a = led_viz_sin_quarter[idx];
+  int32_t b = led_viz_sin_quarter[idx + (frac != 0)];
+  int16_t value = (int16_t)(a + (((b - a) * frac) >> 6));
+
+  return (theta & 0x8000) ? (int16_t)-value : value;
+}
+
+static inline int16_t cos16(uint16_t theta) {
+  return sin16((uint16_t)(theta + 16384));
+}
+
+// theta: 0-255 is one full turn. Returns 0..255 centered on 128: sin16 >> 8,
+// so truncated, up to 1 below (32767 * sin() + 32768) / 256.
+static inline uint8_t sin8(uint8_t theta) {
+  return (uint8_t)((sin16((uint16_t)(theta << 8)) + 32768) >> 8);
+}
+
+static inline uint8_t cos8(uint8_t theta) {
+  return sin8((uint8_t)(theta + 64));
+}
+
+// ============================================================================
+// Waveforms and easing (input 0-255 is one period)
+// ============================================================================
+
+// Linear up/down: 0 -> 0, 128 -> 254, 255 -> 0
+static inline uint8_t triwave8(uint8_t in) {
+  if (in & 0x80)
+    in = 255 - in;
+  return (uint8_t)(in << 1);
+}
+
+static inline uint8_t ease8_in_out_quad(uint8_t i) {
+  uint8_t j = (i & 0x80) ? 255 - i : i;
+  uint8_t jj = (uint8_t)(scale8(j, j) << 1);
+  return (i & 0x80) ? 255 - jj : jj;
+}
+
+static inline uint8_t ease8_in_out_cubic(uint8_t i) {
+  uint8_t ii = scale8(i, i);
+  uint8_t iii = scale8(ii, i);
+  unsigned r = 3u * ii - 2u * iii;
+  return r > 255 ? 255 : (uint8_t)r;
+}
+
+// Smoother variants of triwave8 (spend more time near 0 and 255)
+static inline uint8_t quadwave8(uint8_t in) {
+  return ease8_in_out_quad(triwave8(in));
+}
+
+static inline uint8_t cubicwave8(uint8_t in) {
+  return ease8_in_out_cubic(triwave8(in));
+}
+
+// ============================================================================
+// Beat generators (pass the time_ms given to update, cast to uint32_t)
+// ============================================================================
+
+// Sawtooth 0-65535 at bpm88 beats per minute in Q8.8 (e.g. 120 << 8)
+static inline uint16_t beat88(uint16_t bpm88, uint32_t time_ms) {
+  // 65536 / 60000 ms ~= 280 / 256; the product may wrap, the phase stays exact
+  return (uint16_t)((time_ms * bpm88 * 280u) >> 16);
+}
+
+// Sawtooth 0-65535 at bpm beats per minute (values >= 256 are read as Q8.8)
+static inline uint16_t beat16(uint16_t bpm, uint32_t time_ms) {
+  if (bpm < 256)
+    bpm <<= 8;
+  return beat88(bpm, time_ms);
+}
+
+static inline uint8_t beat8(uint16_t bpm, uint32_t time_ms) {
+  return (uint8_t)(beat16(bpm, time_ms) >> 8);
+}
+
+// Sine oscillating between lowest and highest at bpm, phase_offset 0-255
+static inline uint8_t beatsin8(uint16_t bpm, uint8_t lowest, uint8_t highest,
+                               uint32_t time_ms, uint8_t phase_offset) {
+  uint8_t beatsin = sin8((uint8_t)(beat8(bpm, time_ms) + phase_offset));
+  return (uint8_t)(lowest + scale8(beatsin, (uint8_t)(highest - lowest)));
+}
+
+static inline uint16_t beatsin16(uint16_t bpm, uint16_t lowest,
+                                 uint16_t highest, uint32_t time_ms,
+                                 uint16_t phase_offset) {
+  uint16_t beat = (uint16_t)(beat16(bpm, time_ms) + phase_offset);
+  uint16_t beatsin = (uint16_t)(sin16(beat) + 32768);
+  return (uint16_t)(lowest + scale16(beatsin, (uint16_t)(highest - lowest)));
+}
@@ -0,0 +1,366 @@
+// LED Visualizer Recordings
+// Decoder shared by the desktop runtime and the ESP32 runtime
+
+#include "led_viz_recording.h"
+#include <string.h>
+
+#define CHUNK_HEADER_SIZE 8  // u32 num_frames, u32 size
+#define FRAME_HEADER_SIZE 12 // f64 time_ms, u32 length
+#define INDEX_ENTRY_SIZE 16  // u64 offset, f64 first time_ms
+#define PROB_SCALE (1u << LED_VIZ_RECORDING_PROB_BITS)
+
+static uint32_t read_u32(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static uint64_t read_u64(const uint8_t *p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static double read_f64(const uint8_t *p) {
+  double value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+bool led_viz_recording_open(LedVizRecording *rec, const void *data,
+                            size_t size) {
+  memset(rec, 0, sizeof(*rec));
+  rec->frame = -1;
+  rec->table_chunk = -1;
+  const uint8_t *bytes = data;
+  const LedVizRecordingHeader *header = data;
+  LedVizRecordingTrailer trailer;
+  if (size < sizeof(*header) + sizeof(trailer))
+    return false;
+  memcpy(&rec->header, header, sizeof(rec->header));
+  memcpy(&trailer, bytes + size - sizeof(trailer), sizeof(trailer));
+
+  if (memcmp(rec->header.magic, LED_VIZ_RECORDING_MAGIC, 4) != 0 ||
+      memcmp(trailer.magic, LED_VIZ_RECORDING_INDEX_MAGIC, 4) != 0 ||
+      rec->header.version != LED_VIZ_RECORDING_VERSION ||
+      rec->header.codec > LED_VIZ_RECORDING_CODEC_PREDICT ||
+      rec->header.chunk_frames == 0 || rec->header.chunk_frames > 0xFFFF)
+    return false;
+
+  // Everything the index and strip table claim has to be inside the file
+  uint64_t strips_end = sizeof(*header) + (uint64_t)rec->header.num_strips *
+                                              sizeof(LedVizRecordingStrip);
+  uint64_t index_end = trailer.index_offset +
+                       (uint64_t)trailer.num_chunks * INDEX_ENTRY_SIZE;
+  if (strips_end > size || trailer.index_offset < strips_end ||
+      trailer.index_offset > size ||
+      index_end != size - sizeof(trailer) || trailer.num_frames > INT32_MAX ||
+      trailer.num_chunks != (trailer.num_frames + rec->header.chunk_frames -
+                             1) / rec->header.chunk_frames)
+    return false;
+
+  // And the frame has to be exactly the strips' pixels
+  const LedVizRecordingStrip *strips =
+      (const LedVizRecordingStrip *)(bytes + sizeof(*header));
+  uint64_t num_leds = 0;
+  for (uint32_t s = 0; s < rec->header.num_strips; s++) {
+    if (strips[s].num_leds < 0)
+      return false;
+    num_leds += (uint64_t)strips[s].num_leds;
+  }
+  if (num_leds * 3 != rec->header.frame_size)
+    return false;
+
+  rec->data = bytes;
+  rec->size = size;
+  rec->strips = strips;
+  rec->num_frames = (int)trailer.num_frames;
+  rec->num_chunks = (int)trailer.num_chunks;
+  rec->index = bytes + trailer.index_offset;
+  return true;
+}
+
+// The record after this one, or NULL if this one is cut off
+static const uint8_t *next_record(const LedVizRecording *rec,
+                                  const uint8_t *record) {
+  if (!record || rec->index - record < FRAME_HEADER_SIZE)
+    return NULL;
+  uint32_t length = read_u32(record + 8);
+  if ((size_t)(rec->index - record - FRAME_HEADER_SIZE) < length)
+    return NULL;
+  return record + FRAME_HEADER_SIZE + length;
+}
+
+// XOR a codec 0 delta into pixels; false if it writes past the frame
+static bool apply_xor(const LedVizRecording *rec, const uint8_t *code,
+                      const uint8_t *codes_end, uint8_t *pixels) {
+  uint32_t pos = 0, frame_size = rec->header.frame_size;
+  while (code < codes_end) {
+    uint8_t op = *code++;
+    if (op < 0x80) {
+      pos += op + 1u;
+      if (pos > frame_size)
+        return false;
+      continue;
+    }
+    uint32_t count = op - 0x7Fu;
+    if (count > frame_size - pos || count > (size_t)(codes_end - code))
+      return false;
+    for (uint32_t i = 0; i < count; i++) {
+      pixels[pos + i] ^= code[i];
+    }
+    code += count;
+    pos += count;
+  }
+  return true;
+}
+
+// Next residual of a rANS stream (x is the coder state, code the next
+// byte); false if the stream ends early
+static inline bool next_residual(const LedVizRecording *rec, uint32_t *x,
+                                 const uint8_t **code,
+                                 const uint8_t *codes_end, uint8_t *residual) {
+  uint32_t slot = *x & (PROB_SCALE - 1);
+  uint8_t r = rec->slot_symbol[slot];
+  uint32_t state =
+      rec->freq[r] * (*x >> LED_VIZ_RECORDING_PROB_BITS) + slot - rec->cum[r];
+  while (state < LED_VIZ_RECORDING_RANS_LOW) {
+    if (*code == codes_end)
+      return false;
+    state = (state << 8) | *(*code)++;
+  }
+  *x = state;
+  *residual = r;
+  return true;
+}
+
+// Undo a codec 1 delta on pixels, which hold the frame before it. False if
+// the stream ends early.
+static bool apply_predicted(const LedVizRecording *rec, const uint8_t *code,
+                            const uint8_t *codes_end, uint8_t *pixels) {
+  uint32_t num_strips = rec->header.num_strips;
+  const uint8_t *modes = code;
+  code += (num_strips + 3) / 4;
+  if (code > codes_end)
+    return false;
+
+  // Two coder states take turns, so consecutive symbols decode in parallel
+  uint32_t x = 0, x_other = 0;
+  bool started = false;
+  for (uint32_t s = 0; s < num_strips; s++) {
+    int mode = (modes[s / 4] >> (2 * (s % 4))) & 3;
+    size_t bytes = (size_t)rec->strips[s].num_leds * 3;
+    uint8_t *p = pixels;
+    pixels += bytes;
+    if (mode == LED_VIZ_PREDICT_UNCHANGED || bytes == 0)
+      continue;
+    if (!started) {
+      if (codes_end - code < 8)
+        return false;
+      x = read_u32(code);
+      x_other = read_u32(code + 4);
+      code += 8;
+      started = true;
+    }
+
+    // One loop per prediction, an LED (3 channels) at a time; r holds the
+    // previous LED's value (space) or change (time and space) per channel
+    uint8_t r[3] = {0, 0, 0}, residual[3];
+    for (size_t i = 0; i < bytes; i += 3) {
+      for (int c = 0; c < 3; c++) {
+        if (!next_residual(rec, &x, &code, codes_end, &residual[c]))
+          return false;
+        uint32_t swap = x;
+        x = x_other;
+        x_other = swap;
+      }
+      if (mode == LED_VIZ_PREDICT_TIME) {
+        p[i] += residual[0];
+        p[i + 1] += residual[1];
+        p[i + 2] += residual[2];
+      } else if (mode == LED_VIZ_PREDICT_SPACE) {
+        p[i] = r[0] += residual[0];
+        p[i + 1] = r[1] += residual[1];
+        p[i + 2] = r[2] += residual[2];
+      } else {
+        p[i] += r[0] += residual[0];
+        p[i + 1] += r[1] += residual[1];
+        p[i + 2] += r[2] += residual[2];
+      }
+    }
+  }
+  return true;
+}
+
+// Apply one delta record to pixels; returns the record after it, or NULL if
+// the record is cut off or corrupt
+static const uint8_t *apply_delta(const LedVizRecording *rec,
+                                  const uint8_t *record, uint8_t *pixels,
+                                  double *time_ms) {
+  const uint8_t *codes_end = next_record(rec, record);
+  if (!codes_end)
+    return NULL;
+  if (time_ms)
+    *time_ms = read_f64(record);
+
+  const uint8_t *code = record + FRAME_HEADER_SIZE;
+  bool ok = rec->header.codec == LED_VIZ_RECORDING_CODEC_PREDICT
+                ? apply_predicted(rec, code, codes_end, pixels)
+                : apply_xor(rec, code, codes_end, pixels);
+  return ok ? codes_end : NULL;
+}
+
+// Chunk payload, after its header; NULL if the chunk is out of bounds
+static const uint8_t *chunk_start(const LedVizRecording *rec, int chunk) {
+  uint64_t offset = read_u64(rec->index + (size_t)chunk * INDEX_ENTRY_SIZE);
+  if (offset + CHUNK_HEADER_SIZE > (uint64_t)(rec->index - rec->data))
+    return NULL;
+  return rec->data + offset + CHUNK_HEADER_SIZE;
+}
+
+// The frequency table of a codec 1 chunk and its size, or NULL if cut off
+static const uint8_t *chunk_table(const LedVizRecording *rec, int chunk,
+                                  uint32_t *size) {
+  const uint8_t *table = chunk_start(rec, chunk);
+  if (!table || rec->index - table < 4)
+    return NULL;
+  *size = read_u32(table);
+  if ((size_t)(rec->index - table - 4) < *size)
+    return NULL;
+  return table + 4;
+}
+
+// Build the decoding tables of a codec 1 chunk; false if its table is
+// corrupt
+static bool load_table(LedVizRecording *rec, int chunk) {
+  if (rec->table_chunk == chunk)
+    return true;
+  rec->table_chunk = -1;
+  uint32_t size;
+  const uint8_t *table = chunk_table(rec, chunk, &size);
+  if (!table)
+    return false;
+
+  const uint8_t *end = table + size;
+  uint32_t total = 0;
+  for (int s = 0; s < 256;) {
+    if (table == end)
+      return false;
+    uint32_t f = *table++;
+    if (f == 0) {
+      if (table == end)
+        return false;
+      int run = *table++ + 1;
+      for (; run > 0 && s < 256; run--) {
+        rec->freq[s] = 0;
+        rec->cum[s++] = (uint16_t)total;
+      }
+      continue;
+    }
+    if (f >= 0x80) {
+      if (table == end)
+        return false;
+      f = (f & 0x7F) << 8 | *table++;
+    }
+    if (f > PROB_SCALE - total)
+      return false;
+    rec->freq[s] = (uint16_t)f;
+    rec->cum[s] = (uint16_t)total;
+    memset(rec->slot_symbol + total, s, f);
+    total += f;
+    s++;
+  }
+  if (total != PROB_SCALE)
+    return false;
+  rec->table_chunk = chunk;
+  return true;
+}
+
+// First frame record of a chunk, or NULL if the chunk is out of bounds
+static const uint8_t *chunk_records(const LedVizRecording *rec, int chunk) {
+  if (rec->header.codec != LED_VIZ_RECORDING_CODEC_PREDICT)
+    return chunk_start(rec, chunk);
+  uint32_t size;
+  const uint8_t *table = chunk_table(rec, chunk, &size);
+  return table ? table + size : NULL;
+}
+
+// Time of a frame record; false if it is cut off
+static bool record_time(const LedVizRecording *rec, const uint8_t *record,
+                        double *time_ms) {
+  if (!next_record(rec, record))
+    return false;
+  *time_ms = read_f64(record);
+  return true;
+}
+
+bool led_viz_recording_decode(LedVizRecording *rec, int frame,
+                              uint8_t *pixels, double *time_ms) {
+  if (frame < 0 || frame >= rec->num_frames)
+    return false;
+
+  int chunk_frames = (int)rec->header.chunk_frames;
+  const uint8_t *record = rec->next;
+  int from = rec->frame + 1;
+  if (frame != rec->frame + 1 || frame % chunk_frames == 0 || !record) {
+    // Start over from the chunk's keyframe
+    from = frame - frame % chunk_frames;
+    record = chunk_records(rec, from / chunk_frames);
+    if (rec->header.codec == LED_VIZ_RECORDING_CODEC_PREDICT &&
+        !load_table(rec, from / chunk_frames))
+      record = NULL;
+    memset(pixels, 0, rec->header.frame_size);
+  }
+
+  for (int f = from; record && f <= frame; f++) {
+    record = apply_delta(rec, record, pixels, time_ms);
+  }
+  rec->frame = record ? frame : -1;
+  rec->next = record;
+  return record != NULL;
+}
+
+int led_viz_recording_find(const LedVizRecording *rec, double time_ms) {
+  if (rec->num_frames == 0)
+    return 0;
+
+  // Last chunk starting at or before time_ms
+  int lo = 0, hi = rec->num_chunks - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (read_f64(rec->index + (size_t)mid * INDEX_ENTRY_SIZE + 8) <= time_ms)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  // Then the last frame in it at or before time_ms
+  int chunk_frames = (int)rec->header.chunk_frames;
+  int frame = lo * chunk_frames;
+  int last = frame + chunk_frames - 1;
+  if (last >= rec->num_frames)
+    last = rec->num_frames - 1;
+  const uint8_t *record = chunk_records(rec, lo);
+  for (; frame < last; frame++) {
+    record = next_record(rec, record);
+    double next_ms;
+    if (!record_time(rec, record, &next_ms) || next_ms > time_ms)
+      break;
+  }
+  return frame;
+}
+
+double led_viz_recording_duration(const LedVizRecording *rec) {
+  if (rec->num_frames == 0)
+    return 0.0;
+  int last = rec->num_frames - 1;
+  int chunk_frames = (int)rec->header.chunk_frames;
+  const uint8_t *record = chunk_records(rec, last / chunk_frames);
+  for (int f = last - last % chunk_frames; f < last; f++) {
+    record = next_record(rec, record);
+  }
+  double first_ms = read_f64(rec->index + 8), last_ms;
+  if (!record_time(rec, record, &last_ms))
+    return 0.0;
+  return last > 0 ? last_ms + (last_ms - first_ms) / last : last_ms;
+}
@@ -0,0 +1,92 @@
+// LED Visualizer SDK - Built-in transitions
+// The TransitionFuncs of led_viz.h, shared by the SDK runtime (led_viz_sdk.c)
+// and the desktop runtime (src/transition.c), which mixes program switches
+// with the same code. Like led_viz_kernels.h this defines the functions:
+// include it exactly once per binary, after led_viz.h or transition.h.
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+void transition_crossfade(int strip, const RGB *from, const RGB *to, RGB *out,
+                          int count, uint8_t progress) {
+  (void)strip;
+  if (out != from)
+    memcpy(out, from, (size_t)count * sizeof(RGB));
+  blend_n(out, to, count, progress);
+}
+
+// Mix per LED by weight (0 = from, 255 = to). During a wipe almost every LED
+// sits fully on one side, so those are plain copies.
+static void mix_by_weight(const RGB *from, const RGB *to, RGB *out,
+                          const uint8_t *weight, int count) {
+  for (int i = 0; i < count; i++) {
+    uint8_t w = weight[i];
+    if (w == 0) {
+      out[i] = from[i];
+    } else if (w == 255) {
+      out[i] = to[i];
+    } else {
+      out[i] = (RGB){blend8(from[i].r, to[i].r, w),
+                     blend8(from[i].g, to[i].g, w),
+                     blend8(from[i].b, to[i].b, w)};
+    }
+  }
+}
+
+// Weight of an LED at distance d behind an edge that travels from start to
+// start + span as progress goes 0 -> 255, with a soft band of width soft
+static void edge_weights(const float *d, uint8_t *weight, int count,
+                         uint8_t progress, float start, float span,
+                         float soft) {
+  float edge = start + span * (float)progress / 255.0f;
+  for (int i = 0; i < count; i++) {
+    float w = (edge - d[i]) / soft * 255.0f;
+    weight[i] = (uint8_t)(w <= 0.0f ? 0 : w >= 255.0f ? 255 : w);
+  }
+}
+
+void transition_wipe(int strip, const RGB *from, const RGB *to, RGB *out,
+                     int count, uint8_t progress) {
+  LedCoords pos = get_strip_coords(strip);
+  if (!pos.x) {
+    transition_crossfade(strip, from, to, out, count, progress);
+    return;
+  }
+
+  // Left to right; the soft band starts fully left of -1 and ends right of 1
+  enum { CHUNK = 64 };
+  const float soft = 0.25f;
+  uint8_t weight[CHUNK];
+  for (int start = 0; start < count; start += CHUNK) {
+    int n = count - start < CHUNK ? count - start : CHUNK;
+    edge_weights(pos.x + start, weight, n, progress, -1.0f, 2.0f + soft, soft);
+    mix_by_weight(from + start, to + start, out + start, weight, n);
+  }
+}
+
+void transition_radial(int strip, const RGB *from, const RGB *to, RGB *out,
+                       int count, uint8_t progress) {
+  LedCoords pos = get_strip_coords(strip);
+  if (!pos.x) {
+    transition_crossfade(strip, from, to, out, count, progress);
+    return;
+  }
+
+  // A circle grows from the center until it covers the corners (sqrt(2))
+  enum { CHUNK = 64 };
+  const float soft = 0.25f;
+  float dist[CHUNK];
+  uint8_t weight[CHUNK];
+  for (int start = 0; start < count; start += CHUNK) {
+    int n = count - start < CHUNK ? count - start : CHUNK;
+    for (int i = 0; i < n; i++) {
+      float x = pos.x[start + i], y = pos.y[start + i];
+      dist[i] = sqrtf(x * x + y * y);
+    }
+    edge_weights(dist, weight, n, progress, 0.0f, 1.4143f + soft, soft);
+    mix_by_weight(from + start, to + start, out + start, weight, n);
+  }
+}
@@ -2,6 +2,9 @@
 // Usage: led_viz ./demo_programs.c
 
 #include <led_viz.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 // Strip setup - 4 strips + 1 matrix
 const StripDef strip_setup[] = {
@@ -17,18 +20,21 @@ const StripDef strip_setup[] = {
 };
 const int NUM_STRIPS = sizeof(strip_setup) / sizeof(strip_setup[0]);
 
-// Simple rainbow scroll
+// Simple rainbow scroll (table lookups into the expanded palette)
 static void rainbow_update(double time_ms, PixelFunc pixel,
                            const Palette16 palette) {
+  (void)pixel;
+  (void)palette;
   long shift_value = time_ms / 20;
+  const RGB *gradient = get_palette256();
 
   int num_strips = get_num_strips();
   for (int s = 0; s < num_strips; s++) {
     int num_leds = get_strip_num_leds(s);
+    RGB *leds = get_strip_leds(s);
     for (int i = 0; i < num_leds; i++) {
       uint8_t index = (shift_value + i) % 255;
-      RGB color = palette_sample(palette, index, 255, true);
-      pixel(s, i, &color.r, &color.g, &color.b);
+      leds[i] = gradient[index];
     }
   }
 }
@@ -36,9 +42,8 @@ static void rainbow_update(double time_ms, PixelFunc pixel,
 // Breathing effect
 static void breathe_update(double time_ms, PixelFunc pixel,
                            const Palette16 palette) {
-  float t = (float)(time_ms / 1000.0);
-  float breath = (sinf(t * 2.0f) + 1.0f) * 0.5f; // 0.0 - 1.0
-  uint8_t brightness = (uint8_t)(breath * 255.0f);
+  // One breath every pi seconds (~19.1 bpm, given in Q8.8)
+  uint8_t brightness = beatsin8(4889, 0, 255, (uint32_t)time_ms, 0);
 
   int num_strips = get_num_strips();
   for (int s = 0; s < num_strips; s++) {
@@ -81,11 +86,96 @@ static void sparkle_update(double time_ms, PixelFunc pixel,
   }
 }
 
+// Rings expanding from the center of the installation
+static void radial_wave_update(double time_ms, PixelFunc pixel,
+                               const Palette16 palette) {
+  (void)pixel;
+  (void)palette;
+  const RGB *gradient = get_palette256();
+  uint16_t phase = beat16(30, (uint32_t)time_ms);
+
+  int num_strips = get_num_strips();
+  for (int s = 0; s < num_strips; s++) {
+    int num_leds = get_strip_num_leds(s);
+    RGB *leds = get_strip_leds(s);
+    LedCoords pos = get_strip_coords(s);
+    if (!pos.x)
+      continue;
+    for (int i = 0; i < num_leds; i++) {
+      float dist = sqrtf(pos.x[i] * pos.x[i] + pos.y[i] * pos.y[i]);
+      uint16_t theta = (uint16_t)((int)(dist * 98304.0f) - phase);
+      leds[i] = gradient[sin8((uint8_t)(theta >> 8))];
+    }
+  }
+}
+
+// Comets with fading trails. Their positions survive hot reloads through
+// save_state/restore_state, so editing this file doesn't restart them.
+typedef struct {
+  float pos;   // LED index along the strip
+  float speed; // LEDs per millisecond
+  int strip;
+  uint8_t hue;
+} Comet;
+
+static Comet comets[] = {
+    {0.0f, 0.030f, 0, 0},   {40.0f, 0.045f, 1, 40}, {10.0f, 0.020f, 2, 80},
+    {90.0f, 0.060f, 3, 120}, {70.0f, 0.035f, 4, 160},
+};
+#define NUM_COMETS (int)(sizeof(comets) / sizeof(comets[0]))
+static double comets_last_ms = -1.0;
+
+static void comets_update(double time_ms, PixelFunc pixel,
+                          const Palette16 palette) {
+  (void)pixel;
+  double dt = comets_last_ms < 0.0 ? 0.0 : time_ms - comets_last_ms;
+  comets_last_ms = time_ms;
+
+  int num_strips = get_num_strips();
+  for (int s = 0; s < num_strips; s++) {
+    fade_n(get_strip_leds(s), get_strip_num_leds(s), 40);
+  }
+
+  for (int k = 0; k < NUM_COMETS; k++) {
+    Comet *c = &comets[k];
+    int s = c->strip % num_strips;
+    int num_leds = get_strip_num_leds(s);
+    c->pos = fmodf(c->pos + c->speed * (float)dt, (float)num_leds);
+    get_strip_leds(s)[(int)c->pos] = palette_sample(palette, c->hue, 255, true);
+  }
+}
+
+static void *comets_save(size_t *size) {
+  Comet *copy = malloc(sizeof(comets));
+  if (copy) {
+    memcpy(copy, comets, sizeof(comets));
+    *size = sizeof(comets);
+  }
+  return copy;
+}
+
+static void comets_restore(const void *data, size_t size) {
+  // Only if the layout still matches (e.g. NUM_COMETS unchanged)
+  if (size == sizeof(comets)) {
+    memcpy(comets, data, size);
+  }
+}
+
 // Required exports
 const Program programs[] = {
     {"Rainbow", rainbow_update, NULL, NULL},
     {"Breathe", breathe_update, NULL, NULL},
     {"Sparkle", sparkle_update, NULL, NULL},
+    {"Radial Wave", radial_wave_update, NULL, NULL},
+    {"Comets", comets_update, NULL, NULL, NULL, comets_save, comets_restore},
 };
 
 const int NUM_PROGRAMS = sizeof(programs) / sizeof(programs[0]);
+
+// Optional: Radial Wave under sparkles (toggle with L in the visualizer)
+const LayerDef layer_setup[] = {
+    {"Radial Wave", LAYER_ALPHA, 255},
+    {"Sparkle", LAYER_ADD, 255},
+};
+
+const int NUM_LAYERS = sizeof(layer_setup) / sizeof(layer_setup[0]);
@@ -0,0 +1,129 @@
+// LED Visualizer Recordings
+// Reading recorded LED output, on the desktop and on the ESP32
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A recording holds every frame of a show with its time_ms, so it can be
+// played back without running the program. Frames are grouped in chunks: the
+// first frame of a chunk is a keyframe, the others are deltas against the
+// frame before them. An index at the end of the file points at every chunk,
+// so any frame is at most one chunk of deltas away. All fields are
+// little-endian.
+//
+//   header        LedVizRecordingHeader
+//   strip table   num_strips x LedVizRecordingStrip
+//   chunks        u32 num_frames, u32 size, (codec 1: u32 table size,
+//                 frequency table), then per frame:
+//                 f64 time_ms, u32 length, length bytes of delta
+//   index         num_chunks x (u64 offset, f64 first time_ms)
+//   trailer       LedVizRecordingTrailer
+//
+// Keyframes are deltas against an all-black frame. How a delta is coded
+// depends on the codec:
+//
+// 0 (XOR): a sequence of codes. 0x00-0x7F skips that many plus one unchanged
+// bytes, 0x80-0xFF is followed by that many minus 0x7F bytes to XOR into the
+// frame. Bytes after the last code are unchanged.
+//
+// 1 (predict): 2 bits per strip (strip s in byte s / 4, bits 2 * (s % 4))
+// pick how its bytes are predicted, LED_VIZ_PREDICT_*. The residuals (byte
+// minus prediction, mod 256) of all predicted strips follow, in order, as
+// rANS with byte-wise renormalization: two u32 initial states, which take
+// turns decoding one residual each starting with the first, then the bytes
+// both read, in the order they read them. Symbol frequencies are per chunk
+// and add up to 1 << LED_VIZ_RECORDING_PROB_BITS; the table lists them for
+// symbols 0-255 as a byte f: 0 means f2 + 1 symbols with frequency 0 (f2
+// being the next byte), 0x01-0x7F is the frequency and 0x80-0xFF the high
+// bits of one, the next byte holding the low bits.
+
+#define LED_VIZ_RECORDING_MAGIC "LVRC"
+#define LED_VIZ_RECORDING_INDEX_MAGIC "LVRI"
+#define LED_VIZ_RECORDING_VERSION 1
+
+// Delta codecs
+#define LED_VIZ_RECORDING_CODEC_XOR 0
+#define LED_VIZ_RECORDING_CODEC_PREDICT 1
+
+// Per-strip predictions of codec 1 (time: the frame before; space: the
+// previous LED's same channel, black for the first LED)
+#define LED_VIZ_PREDICT_UNCHANGED 0 // same as the frame before, no residuals
+#define LED_VIZ_PREDICT_TIME 1
+#define LED_VIZ_PREDICT_SPACE 2
+#define LED_VIZ_PREDICT_TIME_SPACE 3 // the change predicted by the last LED's
+
+// rANS parameters of codec 1: frequency precision and the lower bound of
+// the coder state (which stays below LED_VIZ_RECORDING_RANS_LOW << 8)
+#define LED_VIZ_RECORDING_PROB_BITS 12
+#define LED_VIZ_RECORDING_RANS_LOW (1u << 23)
+
+typedef struct {
+  char magic[4];
+  uint16_t version;
+  uint16_t codec;        // LED_VIZ_RECORDING_CODEC_*
+  uint32_t num_strips;
+  uint32_t frame_size;   // bytes per frame: 3 per LED, strips back to back
+  uint32_t chunk_frames; // frames per chunk (the keyframe interval)
+  uint32_t reserved[3];
+} LedVizRecordingHeader;
+
+// Strip as configured when recording (same fields as StripDef)
+typedef struct {
+  int32_t num_leds;
+  float position;
+  float length_cm;
+  int32_t matrix_width;
+  int32_t matrix_height;
+  int32_t matrix_layout;
+} LedVizRecordingStrip;
+
+typedef struct {
+  uint64_t index_offset;
+  uint32_t num_chunks;
+  uint32_t num_frames;
+  char magic[4];
+  uint32_t reserved;
+} LedVizRecordingTrailer;
+
+// An opened recording: points into the caller's copy of the file (mapped or
+// in flash), plus where sequential decoding left off and the decoding
+// tables of codec 1 (about 5 KB)
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  LedVizRecordingHeader header;
+  const LedVizRecordingStrip *strips;
+  int num_frames;
+  int num_chunks;
+  const uint8_t *index;
+  // Last frame decoded (-1 = none) and the record after it in its chunk
+  int frame;
+  const uint8_t *next;
+  // Frequency table of the chunk last started (-1 = none): frequency and
+  // start of each symbol, and the symbol of every slot
+  int table_chunk;
+  uint16_t freq[256];
+  uint16_t cum[256];
+  uint8_t slot_symbol[1 << LED_VIZ_RECORDING_PROB_BITS];
+} LedVizRecording;
+
+// Check the file in data (4-byte aligned, e.g. mapped) and open it. Returns
+// false if it isn't a complete recording this code can read.
+bool led_viz_recording_open(LedVizRecording *rec, const void *data,
+                            size_t size);
+
+// Decode a frame into pixels (header.frame_size bytes of rgb). Stepping to
+// the next frame applies one delta on top of pixels, which must then still
+// hold the frame decoded last; any other frame is rebuilt from its chunk's
+// keyframe. Returns false on a corrupt file.
+bool led_viz_recording_decode(LedVizRecording *rec, int frame,
+                              uint8_t *pixels, double *time_ms);
+
+// The frame showing at time_ms (the last one at or before it, or frame 0)
+int led_viz_recording_find(const LedVizRecording *rec, double time_ms);
+
+// Length of the recording: the last frame's time plus one frame interval
+double led_viz_recording_duration(const LedVizRecording *rec);
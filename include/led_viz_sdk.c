@@ -2,22 +2,258 @@
 // This file is compiled together with user programs
 
 #include "led_viz.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 // Strip setup (set by runtime before calling program)
 static const StripDef *g_strip_setup = NULL;
 static int g_num_strips = 0;
 
+// Framebuffer (set by runtime before calling program)
+static RGB *g_framebuffer = NULL;
+static int g_framebuffer_stride = 0;
+
+// Per-strip flags the runtime checks for changes (set when spans are handed
+// out, since writes through them bypass the PixelFunc)
+static uint8_t *g_touched = NULL;
+
+// Expanded active palette (set by runtime when the palette changes)
+static const Palette256 *g_palette256 = NULL;
+
+// Matrix XY tables, rebuilt with the strip setup (one block for all strips)
+static const uint32_t **g_matrix_xy = NULL;
+static uint32_t *g_matrix_xy_data = NULL;
+
+// Linear LED index of (x, y) for a matrix wired in the given layout
+static uint32_t matrix_layout_index(int width, int height, int layout, int x,
+                                    int y) {
+  if (layout & MATRIX_FLIP_X)
+    x = width - 1 - x;
+  if (layout & MATRIX_FLIP_Y)
+    y = height - 1 - y;
+
+  switch (layout & 0x0F) {
+  case MATRIX_ROW_SERPENTINE:
+    return (uint32_t)(y * width + ((y & 1) ? width - 1 - x : x));
+  case MATRIX_COLUMN_PROGRESSIVE:
+    return (uint32_t)(x * height + y);
+  case MATRIX_ROW_PROGRESSIVE:
+    return (uint32_t)(y * width + x);
+  case MATRIX_COLUMN_SERPENTINE:
+  default:
+    // Even columns go up, odd columns come back down
+    return (uint32_t)(x * height + ((x & 1) ? height - 1 - y : y));
+  }
+}
+
+static void build_matrix_tables(void) {
+  free(g_matrix_xy);
+  free(g_matrix_xy_data);
+  g_matrix_xy = NULL;
+  g_matrix_xy_data = NULL;
+
+  size_t total = 0;
+  for (int s = 0; s < g_num_strips; s++) {
+    if (is_matrix(s))
+      total += (size_t)g_strip_setup[s].matrix_width *
+               g_strip_setup[s].matrix_height;
+  }
+  if (total == 0)
+    return;
+
+  g_matrix_xy = calloc((size_t)g_num_strips, sizeof(*g_matrix_xy));
+  g_matrix_xy_data = malloc(total * sizeof(*g_matrix_xy_data));
+  if (!g_matrix_xy || !g_matrix_xy_data) {
+    free(g_matrix_xy);
+    free(g_matrix_xy_data);
+    g_matrix_xy = NULL;
+    g_matrix_xy_data = NULL;
+    return;
+  }
+
+  uint32_t *table = g_matrix_xy_data;
+  for (int s = 0; s < g_num_strips; s++) {
+    if (!is_matrix(s))
+      continue;
+    int width = g_strip_setup[s].matrix_width;
+    int height = g_strip_setup[s].matrix_height;
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        table[y * width + x] = matrix_layout_index(
+            width, height, g_strip_setup[s].matrix_layout, x, y);
+      }
+    }
+    g_matrix_xy[s] = table;
+    table += (size_t)width * height;
+  }
+}
+
+// Normalized LED coordinates, rebuilt with the strip setup. x, y and z are
+// separate arrays; each strip owns a contiguous slice starting at its offset.
+static float *g_led_coords = NULL;
+static size_t *g_led_coord_offset = NULL;
+
+// Number of coordinate slots a strip needs (a matrix may list fewer num_leds)
+static int strip_coord_count(int s) {
+  int count = g_strip_setup[s].num_leds;
+  if (is_matrix(s)) {
+    int cells = g_strip_setup[s].matrix_width * g_strip_setup[s].matrix_height;
+    if (cells > count)
+      count = cells;
+  }
+  return count > 0 ? count : 0;
+}
+
+// Physical LED positions in meters, using the same layout as the simulator:
+// strips stand upright at x = position * 0.75, matrices are centered on it
+static void layout_strip_coords(int s, float *x, float *y, float *z) {
+  const StripDef *def = &g_strip_setup[s];
+  float base_x = def->position * 0.75f;
+
+  if (is_matrix(s)) {
+    int width = def->matrix_width;
+    int height = def->matrix_height;
+    float width_m =
+        def->length_cm > 0 ? def->length_cm / 100.0f : (float)width * 0.01f;
+    float spacing = width > 1 ? width_m / (float)(width - 1) : 0.01f;
+    const uint32_t *table = g_matrix_xy ? g_matrix_xy[s] : NULL;
+    for (int my = 0; my < height; my++) {
+      for (int mx = 0; mx < width; mx++) {
+        uint32_t idx = table ? table[my * width + mx]
+                             : matrix_layout_index(
+                                   width, height, def->matrix_layout, mx, my);
+        x[idx] = base_x + (mx - (width - 1) / 2.0f) * spacing;
+        y[idx] = (my - (height - 1) / 2.0f) * spacing;
+        z[idx] = 0.0f;
+      }
+    }
+    return;
+  }
+
+  int num_leds = def->num_leds;
+  float length_m = def->length_cm > 0 ? def->length_cm / 100.0f : 1.0f;
+  float spacing = num_leds > 1 ? length_m / (float)(num_leds - 1) : 0.0f;
+  for (int i = 0; i < num_leds; i++) {
+    x[i] = base_x;
+    y[i] = (float)i * spacing;
+    z[i] = 0.0f;
+  }
+}
+
+static void build_led_coords(void) {
+  free(g_led_coords);
+  free(g_led_coord_offset);
+  g_led_coords = NULL;
+  g_led_coord_offset = NULL;
+  if (g_num_strips <= 0 || !g_strip_setup)
+    return;
+
+  g_led_coord_offset = malloc((size_t)g_num_strips * sizeof(size_t));
+  if (!g_led_coord_offset)
+    return;
+  size_t total = 0;
+  for (int s = 0; s < g_num_strips; s++) {
+    g_led_coord_offset[s] = total;
+    total += (size_t)strip_coord_count(s);
+  }
+  if (total == 0 || !(g_led_coords = calloc(total * 3, sizeof(float)))) {
+    free(g_led_coord_offset);
+    g_led_coord_offset = NULL;
+    return;
+  }
+
+  float *xs = g_led_coords;
+  float *ys = xs + total;
+  float *zs = ys + total;
+  for (int s = 0; s < g_num_strips; s++) {
+    size_t off = g_led_coord_offset[s];
+    layout_strip_coords(s, xs + off, ys + off, zs + off);
+  }
+
+  // Center the bounding box on the origin and scale its longest side to
+  // [-1, 1], so distances stay proportional on every axis
+  float lo[3], hi[3];
+  float *axes[3] = {xs, ys, zs};
+  for (int a = 0; a < 3; a++) {
+    lo[a] = hi[a] = axes[a][0];
+    for (size_t i = 1; i < total; i++) {
+      if (axes[a][i] < lo[a])
+        lo[a] = axes[a][i];
+      if (axes[a][i] > hi[a])
+        hi[a] = axes[a][i];
+    }
+  }
+  float extent = 0.0f;
+  for (int a = 0; a < 3; a++) {
+    if (hi[a] - lo[a] > extent)
+      extent = hi[a] - lo[a];
+  }
+  float scale = extent > 0.0f ? 2.0f / extent : 0.0f;
+  for (int a = 0; a < 3; a++) {
+    float center = (lo[a] + hi[a]) * 0.5f;
+    for (size_t i = 0; i < total; i++) {
+      axes[a][i] = (axes[a][i] - center) * scale;
+    }
+  }
+}
+
 void _led_viz_set_strip_setup(const StripDef *setup, int num_strips) {
   g_strip_setup = setup;
   g_num_strips = num_strips;
+  build_matrix_tables();
+  build_led_coords();
+}
+
+// Free the tables when a hot reload unloads this library
+__attribute__((destructor)) static void release_strip_tables(void) {
+  free(g_matrix_xy);
+  free(g_matrix_xy_data);
+  free(g_led_coords);
+  free(g_led_coord_offset);
+}
+
+void _led_viz_set_framebuffer(RGB *pixels, int stride) {
+  g_framebuffer = pixels;
+  g_framebuffer_stride = stride;
 }
 
+void _led_viz_set_touched_flags(uint8_t *flags) { g_touched = flags; }
+
 int get_num_strips(void) { return g_num_strips; }
 
 int get_strip_num_leds(int strip) {
   if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
     return 0;
-  return g_strip_setup[strip].num_leds;
+  int num_leds = g_strip_setup[strip].num_leds;
+  // The runtime never drives more LEDs than fit in a framebuffer row
+  if (g_framebuffer && num_leds > g_framebuffer_stride)
+    num_leds = g_framebuffer_stride;
+  return num_leds;
+}
+
+RGB *get_strip_leds(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_framebuffer)
+    return NULL;
+  if (g_touched)
+    g_touched[strip] = 1;
+  return g_framebuffer + (size_t)strip * g_framebuffer_stride;
+}
+
+StripFramebuffer get_framebuffer(void) {
+  if (g_touched && g_framebuffer)
+    memset(g_touched, 1, (size_t)g_num_strips);
+  return (StripFramebuffer){g_framebuffer, g_framebuffer_stride};
+}
+
+LedCoords get_strip_coords(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_led_coords)
+    return (LedCoords){NULL, NULL, NULL};
+
+  size_t total = g_led_coord_offset[g_num_strips - 1] +
+                 (size_t)strip_coord_count(g_num_strips - 1);
+  const float *x = g_led_coords + g_led_coord_offset[strip];
+  return (LedCoords){x, x + total, x + 2 * total};
 }
 
 float get_strip_position(int strip) {
@@ -52,28 +288,68 @@ bool is_matrix(int strip) {
 }
 
 int get_matrix_index(int strip, int x, int y) {
-  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
+  const uint32_t *table = get_matrix_xy_table(strip);
+  if (!table)
     return 0;
 
   int width = g_strip_setup[strip].matrix_width;
   int height = g_strip_setup[strip].matrix_height;
 
-  if (width <= 0 || height <= 0)
-    return 0;
-
   // Clamp coordinates
   if (x < 0) x = 0;
   if (x >= width) x = width - 1;
   if (y < 0) y = 0;
   if (y >= height) y = height - 1;
 
-  // Serpentine layout: even columns go down, odd columns go up
-  if (x & 1) {
-    // Odd column, reverse y
-    return x * height + (height - 1 - y);
-  } else {
-    // Even column, straight y
-    return x * height + y;
+  return (int)table[y * width + x];
+}
+
+const uint32_t *get_matrix_xy_table(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_matrix_xy)
+    return NULL;
+  return g_matrix_xy[strip];
+}
+
+const uint32_t *get_matrix_row(int strip, int y) {
+  const uint32_t *table = get_matrix_xy_table(strip);
+  if (!table || y < 0 || y >= g_strip_setup[strip].matrix_height)
+    return NULL;
+  return table + (size_t)y * g_strip_setup[strip].matrix_width;
+}
+
+void set_matrix_row(int strip, int y, const RGB *colors) {
+  const uint32_t *row = get_matrix_row(strip, y);
+  RGB *leds = get_strip_leds(strip);
+  if (!row || !leds)
+    return;
+
+  int width = g_strip_setup[strip].matrix_width;
+  int num_leds = get_strip_num_leds(strip);
+  if (row[0] + (uint32_t)width - 1 == row[width - 1] &&
+      row[width - 1] < (uint32_t)num_leds) {
+    // Row wired left to right in one run (progressive or even serpentine row)
+    memcpy(leds + row[0], colors, (size_t)width * sizeof(RGB));
+    return;
+  }
+  for (int x = 0; x < width; x++) {
+    if (row[x] < (uint32_t)num_leds)
+      leds[row[x]] = colors[x];
+  }
+}
+
+void set_matrix_column(int strip, int x, const RGB *colors) {
+  const uint32_t *table = get_matrix_xy_table(strip);
+  RGB *leds = get_strip_leds(strip);
+  if (!table || !leds || x < 0 || x >= g_strip_setup[strip].matrix_width)
+    return;
+
+  int width = g_strip_setup[strip].matrix_width;
+  int height = g_strip_setup[strip].matrix_height;
+  int num_leds = get_strip_num_leds(strip);
+  for (int y = 0; y < height; y++) {
+    uint32_t idx = table[y * width + x];
+    if (idx < (uint32_t)num_leds)
+      leds[idx] = colors[y];
   }
 }
 
@@ -111,6 +387,28 @@ RGB palette_sample(const Palette16 palette, uint8_t index, uint8_t brightness,
   return color;
 }
 
+// ============================================================================
+// Batch color kernels
+// ============================================================================
+
+// Shared with the visualizer core (src/palette.c)
+#include "led_viz_kernels.h"
+
+void _led_viz_set_palette256(const Palette256 *palette) {
+  g_palette256 = palette;
+}
+
+const RGB *get_palette256(void) {
+  return g_palette256 ? *g_palette256 : NULL;
+}
+
+// ============================================================================
+// Transitions
+// ============================================================================
+
+// Shared with the desktop runtime (src/transition.c)
+#include "led_viz_transitions.h"
+
 // Built-in palettes
 
 const Palette16 PALETTE_RAINBOW = {
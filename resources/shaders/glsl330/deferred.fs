@@ -9,8 +9,9 @@ uniform sampler2D gPosition;
 uniform sampler2D gNormal;
 uniform sampler2D gAlbedo;
 
-// Light data texture: each row is one light
-// Row format: pixel 0 = (posX, posY, posZ, intensity), pixel 1 = (r, g, b, enabled)
+// Light data texture: each light is 2 consecutive texels, in rows of
+// lightTexWidth texels (as many rows as the lights need)
+// Texel 0 = (posX, posY, posZ, intensity), texel 1 = (r, g, b, enabled)
 uniform sampler2D lightData;
 uniform int numLights;
 uniform int lightTexWidth;
@@ -39,15 +40,14 @@ void main() {
     vec3 specular = vec3(0.0);
     vec3 fogScatter = vec3(0.0);
 
-    float texelSize = 1.0 / float(lightTexWidth);
-
     for (int i = 0; i < numLights; i++) {
-        // Each light uses 2 texels: (pos+intensity), (color+enabled)
-        float u0 = (float(i * 2) + 0.5) * texelSize;
-        float u1 = (float(i * 2 + 1) + 0.5) * texelSize;
+        // Each light uses 2 texels: (pos+intensity), (color+enabled); the
+        // width is even, so both are in the same row
+        int texel = i * 2;
+        ivec2 at = ivec2(texel % lightTexWidth, texel / lightTexWidth);
 
-        vec4 posIntensity = texture(lightData, vec2(u0, 0.5));
-        vec4 colorEnabled = texture(lightData, vec2(u1, 0.5));
+        vec4 posIntensity = texelFetch(lightData, at, 0);
+        vec4 colorEnabled = texelFetch(lightData, at + ivec2(1, 0), 0);
 
         if (colorEnabled.a < 0.5) continue; // light disabled
 
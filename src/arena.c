@@ -0,0 +1,33 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool arena_reset(Arena *arena, size_t size) {
+  arena->used = 0;
+  if (size > arena->size) {
+    // Nothing in the block needs keeping, so no realloc copy
+    free(arena->base);
+    arena->base = malloc(size);
+    arena->size = arena->base ? size : 0;
+    if (!arena->base)
+      return false;
+  }
+  if (size > 0)
+    memset(arena->base, 0, size);
+  return true;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  size = arena_size(size);
+  if (!arena->base || size > arena->size - arena->used)
+    return NULL;
+  void *ptr = arena->base + arena->used;
+  arena->used += size;
+  return ptr;
+}
+
+void arena_release(Arena *arena) {
+  free(arena->base);
+  *arena = (Arena){0};
+}
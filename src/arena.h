@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One block of memory for everything sized from the strip setup. Users work
+// out the total up front (arena_size of each part), reset the arena to it and
+// carve the parts out; a new setup resets it again. The block only grows, so
+// reconfiguring to the same or fewer LEDs allocates nothing, and nothing is
+// freed piece by piece.
+
+#define ARENA_ALIGN 16
+
+typedef struct {
+  uint8_t *base;
+  size_t size; // bytes in the block
+  size_t used; // bytes handed out since the last reset
+} Arena;
+
+// Bytes an allocation of size takes from an arena
+static inline size_t arena_size(size_t size) {
+  return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// Drop every allocation and make room for size zeroed bytes. Pointers into
+// the arena are invalid afterwards. Returns false without memory, leaving
+// the arena empty.
+bool arena_reset(Arena *arena, size_t size);
+
+// size bytes (zeroed, ARENA_ALIGN aligned) from the room made by the last
+// reset, or NULL if they don't fit
+void *arena_alloc(Arena *arena, size_t size);
+
+// Free the block
+void arena_release(Arena *arena);
@@ -0,0 +1,411 @@
+#include "core.h"
+#include "log.h"
+#include "program_build.h"
+#include "program_library.h"
+#include "programs.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// Times every program on a set of strip layouts, one frame at a time, to
+// tell ahead of deploying whether a program fits the frame budget. Runs the
+// built-in programs (src/programs.c) or builds the given sources like
+// led_viz does. Results go to stdout as a table and optionally as JSON.
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_WARMUP 60
+#define FRAME_STEP_MS (1000.0 / 60.0)
+
+typedef struct {
+  const char *name;
+  const StripDef *strips;
+  int num_strips;
+} BenchLayout;
+
+// The layouts every program runs on, besides the program file's own
+static StripDef strips_4x144[4];
+static StripDef strips_8x300[8];
+static StripDef matrices_8x20x15[8];
+static StripDef strips_48x150[48]; // an installation-sized setup
+static StripDef matrices_4x64x64[4]; // large panels, 16384 LEDs
+
+typedef struct {
+  const char *layout;
+  int num_leds;
+  const char *program;
+  double ns_per_frame; // mean
+  double ns_per_led;
+  int64_t p50_ns, p99_ns, max_ns;
+  double cycles_per_frame; // negative without perf counters
+} BenchResult;
+
+static int64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Evenly spaced strips, or matrices when width and height are set
+static void fill_layout(StripDef *strips, int count, int num_leds, int width,
+                        int height) {
+  for (int s = 0; s < count; s++) {
+    strips[s] = (StripDef){
+        .num_leds = width ? width * height : num_leds,
+        .position = (2.0f * s + 1.0f) / count - 1.0f,
+        .length_cm = width ? 50.0f : 100.0f,
+        .matrix_width = width,
+        .matrix_height = height,
+    };
+  }
+}
+
+// CPU cycles of this process's threads, counting threads started after the
+// counter is opened (the worker pool's). Inherited counts are only added up
+// when those threads exit, so read after the pool is gone.
+static int cycle_counter_open(void) {
+#ifdef __linux__
+  struct perf_event_attr attr = {
+      .type = PERF_TYPE_HARDWARE,
+      .size = sizeof(attr),
+      .config = PERF_COUNT_HW_CPU_CYCLES,
+      .disabled = 1,
+      .inherit = 1,
+      .exclude_kernel = 1,
+      .exclude_hv = 1,
+  };
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+static void cycle_counter_enable(int fd, bool enable) {
+#ifdef __linux__
+  if (fd >= 0)
+    ioctl(fd, enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+#else
+  (void)fd;
+  (void)enable;
+#endif
+}
+
+// Cycles counted, or -1; closes the counter
+static double cycle_counter_close(int fd) {
+  if (fd < 0)
+    return -1.0;
+  uint64_t count;
+  bool ok = read(fd, &count, sizeof(count)) == sizeof(count);
+  close(fd);
+  return ok ? (double)count : -1.0;
+}
+
+static int compare_ns(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples
+static int64_t percentile(const int64_t *sorted, int count, int percent) {
+  int rank = (count * percent + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Run one program on one layout: warmup frames, then frames timed one by
+// one. The core (and its worker threads) is set up fresh for every run.
+static void bench_program(CoreState *core, const LoadedPrograms *loaded,
+                          const BenchLayout *layout, int index, int frames,
+                          int warmup, int64_t *samples, BenchResult *result) {
+  int counter = cycle_counter_open();
+  core_init(core, FRAME_STEP_MS);
+  program_library_attach(core, loaded);
+  if (loaded->set_strip_setup) {
+    loaded->set_strip_setup(layout->strips, layout->num_strips);
+  }
+  core_configure_strips(core, layout->strips, layout->num_strips);
+  core->programs = loaded->programs;
+  core->num_programs = *loaded->num_programs;
+  core->active_program = index;
+  core->current_program = &core->programs[index];
+  if (core->current_program->init) {
+    core->current_program->init();
+  }
+
+  for (int frame = 0; frame < warmup; frame++) {
+    core->time_ms = frame * FRAME_STEP_MS;
+    core_render(core);
+  }
+  int64_t total_ns = 0;
+  cycle_counter_enable(counter, true);
+  for (int frame = 0; frame < frames; frame++) {
+    core->time_ms = (warmup + frame) * FRAME_STEP_MS;
+    int64_t start = monotonic_ns();
+    core_render(core);
+    samples[frame] = monotonic_ns() - start;
+    total_ns += samples[frame];
+  }
+  cycle_counter_enable(counter, false);
+
+  // (the strips go with the core)
+  int num_leds = 0;
+  for (int s = 0; s < core->num_strips; s++) {
+    num_leds += core->layout[s].num_leds;
+  }
+  const Program *program = core->current_program;
+  if (program->cleanup) {
+    program->cleanup();
+  }
+  core_release_programs(core);
+  core_shutdown(core);
+  double cycles = cycle_counter_close(counter);
+
+  qsort(samples, frames, sizeof(*samples), compare_ns);
+  *result = (BenchResult){
+      .layout = layout->name,
+      .num_leds = num_leds,
+      .program = program->name,
+      .ns_per_frame = (double)total_ns / frames,
+      .ns_per_led = num_leds ? (double)total_ns / frames / num_leds : 0.0,
+      .p50_ns = percentile(samples, frames, 50),
+      .p99_ns = percentile(samples, frames, 99),
+      .max_ns = samples[frames - 1],
+      .cycles_per_frame = cycles >= 0.0 ? cycles / frames : -1.0,
+  };
+}
+
+static void print_table(FILE *out, const BenchResult *results, int count,
+                        double budget_ms) {
+  fprintf(out, "%-10s %5s  %-20s %10s %8s %10s %10s %10s %12s\n", "layout",
+          "LEDs", "program", "ns/frame", "ns/LED", "p50", "p99", "max",
+          "cycles/frame");
+  for (int i = 0; i < count; i++) {
+    const BenchResult *r = &results[i];
+    fprintf(out, "%-10s %5d  %-20.20s %10.0f %8.2f %10lld %10lld %10lld",
+            r->layout, r->num_leds, r->program, r->ns_per_frame,
+            r->ns_per_led, (long long)r->p50_ns, (long long)r->p99_ns,
+            (long long)r->max_ns);
+    if (r->cycles_per_frame >= 0.0) {
+      fprintf(out, " %12.0f", r->cycles_per_frame);
+    } else {
+      fprintf(out, " %12s", "-");
+    }
+    if (budget_ms > 0.0 && r->p99_ns > budget_ms * 1e6) {
+      fprintf(out, "  over budget");
+    }
+    fprintf(out, "\n");
+  }
+}
+
+static void write_json_string(FILE *out, const char *text) {
+  fputc('"', out);
+  for (const unsigned char *c = (const unsigned char *)text; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(out, "\\%c", *c);
+    } else if (*c < 0x20) {
+      fprintf(out, "\\u%04x", *c);
+    } else {
+      fputc(*c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void write_json(FILE *out, const BenchResult *results, int count,
+                       int frames, int warmup) {
+  fprintf(out, "{\n  \"frames\": %d,\n  \"warmup\": %d,\n  \"results\": [",
+          frames, warmup);
+  for (int i = 0; i < count; i++) {
+    const BenchResult *r = &results[i];
+    fprintf(out, "%s\n    {\"layout\": ", i ? "," : "");
+    write_json_string(out, r->layout);
+    fprintf(out, ", \"leds\": %d, \"program\": ", r->num_leds);
+    write_json_string(out, r->program);
+    fprintf(out,
+            ", \"ns_per_frame\": %.1f, \"ns_per_led\": %.3f, "
+            "\"p50_ns\": %lld, \"p99_ns\": %lld, \"max_ns\": %lld, "
+            "\"cycles_per_frame\": ",
+            r->ns_per_frame, r->ns_per_led, (long long)r->p50_ns,
+            (long long)r->p99_ns, (long long)r->max_ns);
+    if (r->cycles_per_frame >= 0.0) {
+      fprintf(out, "%.0f}", r->cycles_per_frame);
+    } else {
+      fprintf(out, "null}");
+    }
+  }
+  fprintf(out, "\n  ]\n}\n");
+}
+
+static void print_usage(const char *prog) {
+  fprintf(stderr, "LED Visualizer - program benchmark\n\n");
+  fprintf(stderr, "Usage: %s [options] [programs.c more sources...]\n\n",
+          prog);
+  fprintf(stderr, "Without sources the built-in programs are timed.\n\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  --frames <n>          Timed frames per program and "
+                  "layout (default %d)\n",
+          DEFAULT_FRAMES);
+  fprintf(stderr, "  --warmup <n>          Untimed frames before those "
+                  "(default %d)\n",
+          DEFAULT_WARMUP);
+  fprintf(stderr, "  --program <name>      Only time this program\n");
+  fprintf(stderr, "  --layout <name>       Only use this layout: own, 4x144, "
+                  "8x300, 8x20x15,\n"
+                  "                        48x150 or 4x64x64\n");
+  fprintf(stderr, "  --budget-ms <ms>      Fail if a program's p99 frame "
+                  "takes longer\n");
+  fprintf(stderr, "  --json <file>         Also write the results as JSON "
+                  "(- for stdout)\n");
+  fprintf(stderr, "  -v, --verbose         Show build and setup messages\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *source_args[MAX_SOURCE_UNITS];
+  int num_sources = 0;
+  int frames = DEFAULT_FRAMES;
+  int warmup = DEFAULT_WARMUP;
+  const char *program_name = NULL;
+  const char *layout_name = NULL;
+  double budget_ms = 0.0;
+  const char *json_path = NULL;
+  bool verbose = false;
+
+  // Parse arguments
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      print_usage(argv[0]);
+      return 0;
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+      warmup = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--program") == 0 && i + 1 < argc) {
+      program_name = argv[++i];
+    } else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+      layout_name = argv[++i];
+    } else if (strcmp(argv[i], "--budget-ms") == 0 && i + 1 < argc) {
+      budget_ms = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_path = argv[++i];
+    } else if (strcmp(argv[i], "-v") == 0 ||
+               strcmp(argv[i], "--verbose") == 0) {
+      verbose = true;
+    } else if (argv[i][0] != '-') {
+      if (num_sources == MAX_SOURCE_UNITS) {
+        fprintf(stderr, "Error: At most %d source files are supported\n",
+                MAX_SOURCE_UNITS);
+        return 1;
+      }
+      source_args[num_sources++] = argv[i];
+    }
+  }
+
+  if (frames < 1 || warmup < 0) {
+    fprintf(stderr, "Error: --frames must be >= 1 and --warmup >= 0\n");
+    return 1;
+  }
+  log_set_quiet(!verbose);
+
+  // Built-in programs, or a library built from the given sources
+  LoadedPrograms loaded = {
+      .programs = programs,
+      .num_programs = &NUM_PROGRAMS,
+      .strip_setup = strip_setup,
+      .num_strips = &NUM_STRIPS,
+  };
+  if (num_sources > 0) {
+    if (!program_library_setup(source_args, num_sources)) {
+      return 1;
+    }
+    char lib_path[4096];
+    BuildStats stats;
+    program_library_next_path(lib_path, sizeof(lib_path));
+    if (!program_build_run(NULL, lib_path, &stats) ||
+        !program_library_open(&loaded, lib_path)) {
+      fprintf(stderr, "Compilation failed.\n");
+      program_build_shutdown();
+      return 1;
+    }
+  }
+
+  fill_layout(strips_4x144, 4, 144, 0, 0);
+  fill_layout(strips_8x300, 8, 300, 0, 0);
+  fill_layout(matrices_8x20x15, 8, 0, 20, 15);
+  fill_layout(strips_48x150, 48, 150, 0, 0);
+  fill_layout(matrices_4x64x64, 4, 0, 64, 64);
+  const BenchLayout layouts[] = {
+      {"own", loaded.strip_setup, *loaded.num_strips},
+      {"4x144", strips_4x144, 4},
+      {"8x300", strips_8x300, 8},
+      {"8x20x15", matrices_8x20x15, 8},
+      {"48x150", strips_48x150, 48},
+      {"4x64x64", matrices_4x64x64, 4},
+  };
+  int num_layouts = sizeof(layouts) / sizeof(layouts[0]);
+
+  int num_programs = *loaded.num_programs;
+  BenchResult *results =
+      malloc(num_layouts * num_programs * sizeof(*results));
+  int64_t *samples = malloc(frames * sizeof(*samples));
+  CoreState *core = calloc(1, sizeof(*core));
+  int count = 0;
+  if (!results || !samples || !core) {
+    fprintf(stderr, "Error: Out of memory\n");
+  } else {
+    for (int l = 0; l < num_layouts; l++) {
+      if (layout_name && strcmp(layouts[l].name, layout_name) != 0)
+        continue;
+      for (int p = 0; p < num_programs; p++) {
+        if (program_name && strcmp(loaded.programs[p].name, program_name) != 0)
+          continue;
+        bench_program(core, &loaded, &layouts[l], p, frames, warmup,
+                      samples, &results[count++]);
+      }
+    }
+    if (count == 0) {
+      fprintf(stderr, "Error: No program or layout matched\n");
+    }
+  }
+
+  bool ok = count > 0;
+  if (count > 0) {
+    // Keep stdout parseable when the JSON goes there
+    bool json_stdout = json_path && strcmp(json_path, "-") == 0;
+    print_table(json_stdout ? stderr : stdout, results, count, budget_ms);
+    if (json_path) {
+      FILE *out = json_stdout ? stdout : fopen(json_path, "w");
+      if (out) {
+        write_json(out, results, count, frames, warmup);
+        if (out != stdout && fclose(out) != 0) {
+          perror(json_path);
+          ok = false;
+        }
+      } else {
+        perror(json_path);
+        ok = false;
+      }
+    }
+    for (int i = 0; budget_ms > 0.0 && i < count; i++) {
+      if (results[i].p99_ns > budget_ms * 1e6)
+        ok = false;
+    }
+  }
+
+  free(core);
+  free(samples);
+  free(results);
+  program_library_close(&loaded);
+  if (num_sources > 0) {
+    program_build_shutdown();
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,229 @@
+#include "build_job.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Commands one build may run at the same time (see build_job_run_command)
+#define MAX_BUILD_COMMANDS 64
+
+struct BuildJob {
+  pthread_t thread;
+  BuildFunc build;
+  BuildDiscardFunc discard;
+  void *ctx;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake; // signalled on a new request (or on shutdown)
+  bool shutdown;       // under lock
+  // Process groups of running commands (under lock)
+  pid_t children[MAX_BUILD_COMMANDS];
+  int num_children;
+
+  atomic_ulong requested; // bumped by every request
+  atomic_ulong started;   // request the build thread is working on
+  _Atomic(void *) result; // finished result waiting to be taken
+};
+
+// Drop a finished result nobody has taken yet
+static void discard_pending(BuildJob *job) {
+  void *old = atomic_exchange(&job->result, NULL);
+  if (old) {
+    job->discard(old, job->ctx);
+  }
+}
+
+// Kill every running command (call under lock)
+static void kill_children(BuildJob *job) {
+  for (int i = 0; i < job->num_children; i++) {
+    kill(-job->children[i], SIGKILL);
+  }
+}
+
+static void *build_main(void *arg) {
+  BuildJob *job = arg;
+  trace_name_thread("build");
+
+  for (;;) {
+    pthread_mutex_lock(&job->lock);
+    while (!job->shutdown &&
+           atomic_load(&job->requested) == atomic_load(&job->started)) {
+      pthread_cond_wait(&job->wake, &job->lock);
+    }
+    if (job->shutdown) {
+      pthread_mutex_unlock(&job->lock);
+      return NULL;
+    }
+    unsigned long generation = atomic_load(&job->requested);
+    atomic_store(&job->started, generation);
+    pthread_mutex_unlock(&job->lock);
+
+    // A newer build makes any result still waiting obsolete
+    discard_pending(job);
+
+    uint64_t trace_start = trace_begin();
+    void *result = job->build(job, job->ctx);
+    trace_end(TRACE_BUILD, trace_start);
+    if (!result)
+      continue;
+
+    if (build_job_cancelled(job)) {
+      job->discard(result, job->ctx);
+    } else {
+      atomic_store(&job->result, result);
+    }
+  }
+}
+
+BuildJob *build_job_create(BuildFunc build, BuildDiscardFunc discard,
+                           void *ctx) {
+  BuildJob *job = calloc(1, sizeof(*job));
+  if (!job)
+    return NULL;
+
+  job->build = build;
+  job->discard = discard;
+  job->ctx = ctx;
+  atomic_init(&job->requested, 0);
+  atomic_init(&job->started, 0);
+  atomic_init(&job->result, NULL);
+  pthread_mutex_init(&job->lock, NULL);
+  pthread_cond_init(&job->wake, NULL);
+
+  if (pthread_create(&job->thread, NULL, build_main, job) != 0) {
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->wake);
+    free(job);
+    return NULL;
+  }
+  return job;
+}
+
+void build_job_request(BuildJob *job) {
+  pthread_mutex_lock(&job->lock);
+  atomic_fetch_add(&job->requested, 1);
+  kill_children(job);
+  pthread_cond_signal(&job->wake);
+  pthread_mutex_unlock(&job->lock);
+}
+
+void *build_job_take(BuildJob *job) {
+  // Cheap load first so the common empty frame never writes the line
+  if (!job || !atomic_load_explicit(&job->result, memory_order_relaxed))
+    return NULL;
+  return atomic_exchange(&job->result, NULL);
+}
+
+bool build_job_cancelled(BuildJob *job) {
+  return job && (atomic_load(&job->requested) != atomic_load(&job->started));
+}
+
+int build_job_run_command(BuildJob *job, const char *cmd, char *output,
+                          size_t size) {
+  if (size > 0)
+    output[0] = '\0';
+
+  int fds[2];
+  if (pipe(fds) != 0)
+    return -1;
+
+  // Own process group, so cancelling also kills what the shell started
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attr, 0);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+  posix_spawn_file_actions_addclose(&actions, fds[0]);
+  posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+  char *argv[] = {"sh", "-c", (char *)cmd, NULL};
+  pid_t pid;
+  int err = posix_spawn(&pid, "/bin/sh", &actions, &attr, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  close(fds[1]);
+  if (err != 0) {
+    close(fds[0]);
+    return -1;
+  }
+
+  bool tracked = false;
+  if (job) {
+    pthread_mutex_lock(&job->lock);
+    if (job->num_children < MAX_BUILD_COMMANDS) {
+      job->children[job->num_children++] = pid;
+      tracked = true;
+    }
+    if (build_job_cancelled(job)) {
+      kill(-pid, SIGKILL);
+    }
+    pthread_mutex_unlock(&job->lock);
+  }
+
+  // Keep draining after the buffer is full so the command never blocks
+  size_t total = 0;
+  char buf[256];
+  ssize_t len;
+  while ((len = read(fds[0], buf, sizeof(buf))) > 0) {
+    size_t n = (size_t)len;
+    if (size > 0 && total < size - 1) {
+      if (n > size - 1 - total)
+        n = size - 1 - total;
+      memcpy(output + total, buf, n);
+      total += n;
+      output[total] = '\0';
+    }
+  }
+  close(fds[0]);
+
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+
+  if (tracked) {
+    pthread_mutex_lock(&job->lock);
+    for (int i = 0; i < job->num_children; i++) {
+      if (job->children[i] == pid) {
+        job->children[i] = job->children[--job->num_children];
+        break;
+      }
+    }
+    pthread_mutex_unlock(&job->lock);
+  }
+
+  if (build_job_cancelled(job) || !WIFEXITED(status))
+    return -1;
+  return WEXITSTATUS(status);
+}
+
+void build_job_destroy(BuildJob *job) {
+  if (!job)
+    return;
+
+  pthread_mutex_lock(&job->lock);
+  job->shutdown = true;
+  atomic_fetch_add(&job->requested, 1); // cancels the running build
+  kill_children(job);
+  pthread_cond_signal(&job->wake);
+  pthread_mutex_unlock(&job->lock);
+
+  pthread_join(job->thread, NULL);
+  discard_pending(job);
+
+  pthread_mutex_destroy(&job->lock);
+  pthread_cond_destroy(&job->wake);
+  free(job);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Background builder: runs one build at a time on a helper thread and hands
+// the result to the render thread, which picks it up between frames without
+// blocking. Requesting a new build while one is running cancels it (any
+// command it started is killed) and starts over.
+
+typedef struct BuildJob BuildJob;
+
+// Runs on the build thread. Returns the finished result, or NULL on failure
+// or cancellation. job is NULL when called synchronously.
+typedef void *(*BuildFunc)(BuildJob *job, void *ctx);
+
+// Frees a result that will never be taken (superseded or cancelled)
+typedef void (*BuildDiscardFunc)(void *result, void *ctx);
+
+// Start the build thread. Returns NULL on failure.
+BuildJob *build_job_create(BuildFunc build, BuildDiscardFunc discard,
+                           void *ctx);
+
+// Start a build, cancelling the one in progress (if any)
+void build_job_request(BuildJob *job);
+
+// Result of the latest build if it finished since the last call, else NULL.
+// Lock-free; the caller owns the returned result.
+void *build_job_take(BuildJob *job);
+
+// True if the build in progress has been superseded (call from BuildFunc)
+bool build_job_cancelled(BuildJob *job);
+
+// Run a shell command, collecting stdout and stderr into output
+// (NUL-terminated, truncated to size). The command is killed if the build is
+// cancelled. Returns the exit status, or -1 if it could not run or was
+// cancelled. job may be NULL to run without cancellation. Safe to call from
+// several threads at once (e.g. a WorkerPool compiling files in parallel).
+int build_job_run_command(BuildJob *job, const char *cmd, char *output,
+                          size_t size);
+
+// Cancel any running build, join the thread and discard pending results
+void build_job_destroy(BuildJob *job);
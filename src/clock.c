@@ -0,0 +1,178 @@
+#include "clock.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Largest wall delta the wall clock takes in one frame (e.g. after a
+// window drag), and its smoothing factor (~0.2 smooths strongly)
+#define MAX_WALL_DELTA_S 0.1
+#define WALL_ALPHA 0.2
+
+// How far the timecode clock runs on past the last timecode when updates
+// stop, and the backwards jitter it hides instead of following
+#define TIMECODE_FREEWHEEL_MS 1000.0
+#define TIMECODE_JITTER_MS 100.0
+
+void clock_init(Clock *clock, ClockMode mode, double fps, double now_s) {
+  memset(clock, 0, sizeof(*clock));
+  clock->mode = mode;
+  clock->fps = fps;
+  clock->last_s = now_s;
+  clock->smoothed_delta_s = 1.0 / fps;
+  clock->fd = -1;
+}
+
+bool clock_open_timecode(Clock *clock, const char *path, double fps) {
+  clock_close(clock);
+  // Read-write keeps a FIFO open (and reads non-blocking) between writers
+  int fd = strcmp(path, "-") == 0 ? dup(STDIN_FILENO)
+                                  : open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+  }
+  if (fd < 0) {
+    log_error("Cannot open timecode source %s: %s", path, strerror(errno));
+    return false;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  clock->fd = fd;
+  clock->timecode_fps = fps;
+  clock->mode = CLOCK_TIMECODE;
+  log_info("Following timecode from %s", path);
+  return true;
+}
+
+void clock_close(Clock *clock) {
+  if (clock->fd >= 0) {
+    close(clock->fd);
+    clock->fd = -1;
+  }
+}
+
+// Take every complete line waiting on the timecode source; the last valid
+// one wins
+static void read_timecode(Clock *clock, double now_s) {
+  char buffer[256];
+  ssize_t count;
+  while (clock->fd >= 0 &&
+         (count = read(clock->fd, buffer, sizeof(buffer))) > 0) {
+    for (ssize_t i = 0; i < count; i++) {
+      char c = buffer[i];
+      if (c != '\n' && c != '\r') {
+        if (clock->line_length < (int)sizeof(clock->line) - 1)
+          clock->line[clock->line_length++] = c;
+        continue;
+      }
+      clock->line[clock->line_length] = '\0';
+      double time_ms;
+      if (clock->line_length > 0 &&
+          clock_parse_timecode(clock->line, clock->timecode_fps, &time_ms)) {
+        clock->timecode_ms = time_ms;
+        clock->received_s = now_s;
+        clock->have_timecode = true;
+      }
+      clock->line_length = 0;
+    }
+  }
+}
+
+// Time from the last timecode, run on by the wall time since it arrived
+static double timecode_time(Clock *clock, double now_s) {
+  read_timecode(clock, now_s);
+  if (!clock->have_timecode)
+    return 0.0; // hold until the first one
+
+  double since_ms = (now_s - clock->received_s) * 1000.0;
+  if (since_ms > TIMECODE_FREEWHEEL_MS)
+    since_ms = TIMECODE_FREEWHEEL_MS;
+  double time_ms = clock->timecode_ms + since_ms;
+  // A timecode arriving late would step back a little: hold instead, but
+  // follow real jumps (a seek)
+  if (clock->frame > 0 && time_ms < clock->time_ms &&
+      clock->time_ms - time_ms < TIMECODE_JITTER_MS)
+    time_ms = clock->time_ms;
+  return time_ms;
+}
+
+double clock_next(Clock *clock, double now_s) {
+  double time_ms = 0.0;
+  switch (clock->mode) {
+  case CLOCK_FIXED:
+    // Counted rather than summed, so no rounding error builds up (and the
+    // ESP32 runtime computes the same doubles)
+    time_ms = clock->frame * 1000.0 / clock->fps;
+    break;
+
+  case CLOCK_WALL: {
+    double raw_delta = now_s - clock->last_s;
+    clock->last_s = now_s;
+    if (raw_delta > MAX_WALL_DELTA_S)
+      raw_delta = MAX_WALL_DELTA_S;
+    if (raw_delta < 0.0)
+      raw_delta = 0.0;
+    clock->smoothed_delta_s =
+        WALL_ALPHA * raw_delta + (1.0 - WALL_ALPHA) * clock->smoothed_delta_s;
+    time_ms = clock->time_ms + clock->smoothed_delta_s * 1000.0;
+    break;
+  }
+
+  case CLOCK_TIMECODE:
+    time_ms = timecode_time(clock, now_s);
+    break;
+  }
+  clock->time_ms = time_ms;
+  clock->frame++;
+  return time_ms;
+}
+
+bool clock_parse_timecode(const char *text, double fps, double *time_ms) {
+  int hours, minutes, seconds, frames, length = 0;
+  char separator;
+  double value;
+  if (sscanf(text, " %d:%d:%d%c%d %n", &hours, &minutes, &seconds,
+             &separator, &frames, &length) == 5 &&
+      text[length] == '\0' && (separator == ':' || separator == ';')) {
+    if (fps <= 0.0 || hours < 0 || minutes < 0 || seconds < 0 || frames < 0 ||
+        frames >= fps)
+      return false;
+    *time_ms = ((hours * 60.0 + minutes) * 60.0 + seconds) * 1000.0 +
+               frames * 1000.0 / fps;
+    return true;
+  }
+  length = 0;
+  if (sscanf(text, " %d:%d:%lf %n", &hours, &minutes, &value, &length) ==
+          3 &&
+      text[length] == '\0') {
+    if (hours < 0 || minutes < 0 || value < 0.0)
+      return false;
+    *time_ms = ((hours * 60.0 + minutes) * 60.0 + value) * 1000.0;
+    return true;
+  }
+  length = 0;
+  if (sscanf(text, " %lf %n", &value, &length) == 1 &&
+      text[length] == '\0' && value >= 0.0) {
+    *time_ms = value;
+    return true;
+  }
+  return false;
+}
+
+static const char *mode_names[] = {"wall", "fixed", "timecode"};
+
+bool clock_parse_mode(const char *name, ClockMode *mode) {
+  for (int i = 0; i < (int)(sizeof(mode_names) / sizeof(mode_names[0]));
+       i++) {
+    if (strcmp(name, mode_names[i]) == 0) {
+      *mode = (ClockMode)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *clock_mode_name(ClockMode mode) { return mode_names[mode]; }
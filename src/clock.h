@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Where program time (CoreState.time_ms) comes from. The runner asks for the
+// next frame's time once per frame, passing the wall time it sees, so the
+// clock itself needs no window or GPU.
+
+typedef enum {
+  CLOCK_WALL,     // wall time, with the frame delta smoothed against jitter
+  CLOCK_FIXED,    // exactly one step per frame, from 0: reproducible
+  CLOCK_TIMECODE, // an external timecode, interpolated between updates
+} ClockMode;
+
+typedef struct {
+  ClockMode mode;
+  double fps;     // frame rate (fixed step; first wall delta)
+  long frame;     // frames stepped so far
+  double time_ms; // last time returned
+  // Wall clock
+  double last_s;
+  double smoothed_delta_s;
+  // Timecode: read as lines from fd, see clock_parse_timecode()
+  int fd;
+  double timecode_fps;
+  char line[64];
+  int line_length;
+  bool have_timecode;
+  double timecode_ms; // last timecode received
+  double received_s;  // wall time it arrived
+} Clock;
+
+// Start a clock at time 0 stepping at fps (the fixed step, and what the wall
+// clock assumes before it has measured a frame)
+void clock_init(Clock *clock, ClockMode mode, double fps, double now_s);
+
+// Follow timecode lines written to path (a FIFO, file or - for stdin).
+// fps is the frame rate of HH:MM:SS:FF timecodes. Logs and returns false if
+// it can't be opened.
+bool clock_open_timecode(Clock *clock, const char *path, double fps);
+void clock_close(Clock *clock);
+
+// Program time of the next frame, now_s being the current wall time in
+// seconds (unused by the fixed step)
+double clock_next(Clock *clock, double now_s);
+
+// Parse a timecode: milliseconds ("83500", "83500.25") or SMPTE-style
+// HH:MM:SS:FF (frames at fps, ';' for drop-frame is read the same) or
+// HH:MM:SS.mmm
+bool clock_parse_timecode(const char *text, double fps, double *time_ms);
+
+// "wall", "fixed" or "timecode"
+bool clock_parse_mode(const char *name, ClockMode *mode);
+const char *clock_mode_name(ClockMode mode);
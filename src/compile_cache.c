@@ -0,0 +1,131 @@
+#include "compile_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FNV_PRIME 0x100000001b3ull
+
+static char cache_dir[4096];
+static bool cache_enabled = false;
+
+uint64_t cache_hash_bytes(uint64_t hash, const void *data, size_t size) {
+  const uint8_t *bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+uint64_t cache_hash_string(uint64_t hash, const char *str) {
+  // Include the terminator so "ab" + "c" and "a" + "bc" differ
+  return cache_hash_bytes(hash, str, strlen(str) + 1);
+}
+
+bool cache_hash_file(uint64_t *hash, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  uint8_t buf[16384];
+  ssize_t len;
+  while ((len = read(fd, buf, sizeof(buf))) > 0) {
+    *hash = cache_hash_bytes(*hash, buf, (size_t)len);
+  }
+  close(fd);
+  // Separate consecutive files
+  *hash = cache_hash_bytes(*hash, "", 1);
+  return len == 0;
+}
+
+static bool make_dir(const char *path) {
+  return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+bool compile_cache_init(void) {
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  char parent[4096];
+  if (xdg && xdg[0]) {
+    snprintf(parent, sizeof(parent), "%s", xdg);
+  } else if (home && home[0]) {
+    snprintf(parent, sizeof(parent), "%s/.cache", home);
+  } else {
+    snprintf(parent, sizeof(parent), "/tmp/led_viz_cache.%d", (int)getuid());
+  }
+
+  snprintf(cache_dir, sizeof(cache_dir), "%s/led_viz", parent);
+  cache_enabled = make_dir(parent) && make_dir(cache_dir);
+  return cache_enabled;
+}
+
+void compile_cache_path(char *path, size_t size, const char *name,
+                        uint64_t key, const char *ext) {
+  snprintf(path, size, "%s/%s-%016" PRIx64 "%s", cache_dir, name, key, ext);
+}
+
+static bool copy_file(const char *src, const char *dest) {
+  int in = open(src, O_RDONLY);
+  if (in < 0)
+    return false;
+  int out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+  if (out < 0) {
+    close(in);
+    return false;
+  }
+
+  bool ok = true;
+  char buf[65536];
+  ssize_t len;
+  while ((len = read(in, buf, sizeof(buf))) > 0) {
+    if (write(out, buf, (size_t)len) != len) {
+      ok = false;
+      break;
+    }
+  }
+  if (len < 0)
+    ok = false;
+
+  close(in);
+  if (close(out) != 0)
+    ok = false;
+  if (!ok)
+    unlink(dest);
+  return ok;
+}
+
+bool compile_cache_fetch(const char *name, uint64_t key, const char *ext,
+                         const char *dest) {
+  if (!cache_enabled)
+    return false;
+
+  char path[4096];
+  compile_cache_path(path, sizeof(path), name, key, ext);
+  if (access(path, R_OK) != 0)
+    return false;
+  return copy_file(path, dest);
+}
+
+bool compile_cache_store(const char *name, uint64_t key, const char *ext,
+                         const char *src) {
+  if (!cache_enabled)
+    return false;
+
+  // Write under a temporary name and rename, so a reader never sees a
+  // partial entry
+  char path[4096], tmp[4200];
+  compile_cache_path(path, sizeof(path), name, key, ext);
+  snprintf(tmp, sizeof(tmp), "%s.tmp%d", path, (int)getpid());
+  if (!copy_file(src, tmp))
+    return false;
+  if (rename(tmp, path) != 0) {
+    unlink(tmp);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Content-addressed store for build outputs. Entries are keyed by a hash of
+// everything that went into them (sources, headers, compiler and flags), so
+// rebuilding an input that was seen before is a file copy instead of a
+// compile. Lives in $XDG_CACHE_HOME/led_viz (or ~/.cache/led_viz).
+
+// Starting value for the hash functions below
+#define CACHE_HASH_INIT 0xcbf29ce484222325ull
+
+// Fold bytes, a string or a file's contents into a running hash (64-bit
+// FNV-1a). hash_file returns false if the file can't be read.
+uint64_t cache_hash_bytes(uint64_t hash, const void *data, size_t size);
+uint64_t cache_hash_string(uint64_t hash, const char *str);
+bool cache_hash_file(uint64_t *hash, const char *path);
+
+// Create the cache directory. Returns false (and the cache stays disabled) if
+// it can't be created.
+bool compile_cache_init(void);
+
+// Path of the entry for key, e.g. <dir>/<name>-<key><ext>. Entries may be
+// used in place; they are only ever replaced atomically.
+void compile_cache_path(char *path, size_t size, const char *name,
+                        uint64_t key, const char *ext);
+
+// Copy the entry into dest. False if there is no such entry.
+bool compile_cache_fetch(const char *name, uint64_t key, const char *ext,
+                         const char *dest);
+
+// Copy src into the cache
+bool compile_cache_store(const char *name, uint64_t key, const char *ext,
+                         const char *src);
@@ -0,0 +1,72 @@
+#include "compositor.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const Program *find_program(const Program *programs, int num_programs,
+                                   const char *name) {
+  if (!name)
+    return NULL;
+  for (int i = 0; i < num_programs; i++) {
+    if (programs[i].name && strcmp(programs[i].name, name) == 0)
+      return &programs[i];
+  }
+  return NULL;
+}
+
+int compositor_configure(Compositor *comp, const LayerDef *layers,
+                         int num_layers, const Program *programs,
+                         int num_programs, int num_pixels) {
+  compositor_release(comp);
+  comp->num_pixels = num_pixels;
+
+  for (int i = 0; i < num_layers; i++) {
+    if (comp->num_layers == MAX_LAYERS) {
+      log_warning("Only %d layers supported, ignoring the rest", MAX_LAYERS);
+      break;
+    }
+
+    const Program *program =
+        find_program(programs, num_programs, layers[i].program);
+    if (!program) {
+      log_warning("Layer %d: no program named '%s'", i,
+                  layers[i].program ? layers[i].program : "(null)");
+      continue;
+    }
+
+    RGB *pixels = calloc((size_t)num_pixels, sizeof(RGB));
+    if (!pixels) {
+      log_error("Layer %d: out of memory", i);
+      break;
+    }
+
+    comp->layers[comp->num_layers++] = (Layer){
+        .program = program,
+        .blend = layers[i].blend,
+        .opacity = layers[i].opacity,
+        .pixels = pixels,
+    };
+  }
+
+  if (comp->num_layers > 0) {
+    log_info("Configured %d layer(s)", comp->num_layers);
+  }
+  return comp->num_layers;
+}
+
+void compositor_flatten(const Compositor *comp, RGB *out) {
+  memset(out, 0, (size_t)comp->num_pixels * sizeof(RGB));
+  for (int i = 0; i < comp->num_layers; i++) {
+    const Layer *layer = &comp->layers[i];
+    composite_n(out, layer->pixels, comp->num_pixels, layer->blend,
+                layer->opacity);
+  }
+}
+
+void compositor_release(Compositor *comp) {
+  for (int i = 0; i < comp->num_layers; i++) {
+    free(comp->layers[i].pixels);
+  }
+  memset(comp->layers, 0, sizeof(comp->layers));
+  comp->num_layers = 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// Layer compositor: several programs render into their own buffers, which are
+// flattened bottom to top with per-layer blend modes and opacity.
+
+#include "programs.h"
+#include <stdbool.h>
+
+#define MAX_LAYERS 4
+
+typedef struct {
+  const Program *program;
+  LayerBlend blend;
+  uint8_t opacity;
+  RGB *pixels; // layer buffer, same layout as the visualizer framebuffer
+} Layer;
+
+typedef struct {
+  Layer layers[MAX_LAYERS];
+  int num_layers;
+  bool enabled;     // layers replace the active program while set
+  bool seen_layers; // a stack was configured once; enabled is up to the user
+  int num_pixels;
+} Compositor;
+
+// Whether layers replace the active program (on, and there are some)
+static inline bool compositor_active(const Compositor *comp) {
+  return comp->enabled && comp->num_layers > 0;
+}
+
+// Resolve layer definitions against the loaded programs and allocate a buffer
+// of num_pixels LEDs per layer. Unknown program names are skipped with a
+// warning. Returns the number of usable layers.
+int compositor_configure(Compositor *comp, const LayerDef *layers,
+                         int num_layers, const Program *programs,
+                         int num_programs, int num_pixels);
+
+// Flatten all layers into out (num_pixels LEDs), starting from black
+void compositor_flatten(const Compositor *comp, RGB *out);
+
+// Free layer buffers
+void compositor_release(Compositor *comp);
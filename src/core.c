@@ -0,0 +1,727 @@
+#include "core.h"
+#include "log.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEG_TO_RAD (3.14159265358979323846f / 180.0f)
+
+// Framebuffer for pixel function and direct access (set in
+// core_configure_strips)
+static RGB *g_framebuffer = NULL;
+static int g_stride = 0;
+
+// Expanded active palette (set in core_init)
+static const Palette256 *g_palette256 = NULL;
+
+// Strips flagged for the consumer of the framebuffer (core->strip_touched,
+// also set by the loaded library)
+static uint8_t *g_strip_touched = NULL;
+
+// Strip setup (for built-in programs using accessor functions)
+static const StripDef *g_strip_setup = NULL;
+static int g_num_strips = 0;
+
+static double monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Runtime accessors (implementation for built-in programs)
+int get_num_strips(void) { return g_num_strips; }
+
+int get_strip_num_leds(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
+    return 0;
+  int num_leds = g_strip_setup[strip].num_leds;
+  return num_leds > 0 ? num_leds : 0;
+}
+
+float get_strip_position(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
+    return 0.0f;
+  return g_strip_setup[strip].position;
+}
+
+float get_strip_length_cm(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
+    return 0.0f;
+  return g_strip_setup[strip].length_cm;
+}
+
+int get_matrix_width(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
+    return 0;
+  return g_strip_setup[strip].matrix_width;
+}
+
+int get_matrix_height(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
+    return 0;
+  return g_strip_setup[strip].matrix_height;
+}
+
+bool is_matrix(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
+    return false;
+  return g_strip_setup[strip].matrix_width > 0 &&
+         g_strip_setup[strip].matrix_height > 0;
+}
+
+// Matrix XY tables per strip, NULL for plain strips (in the core's arena,
+// rebuilt in core_configure_strips)
+static const uint32_t **g_matrix_xy = NULL;
+
+// Linear LED index of (x, y) for a matrix wired in the given layout
+static uint32_t matrix_layout_index(int width, int height, int layout, int x,
+                                    int y) {
+  if (layout & MATRIX_FLIP_X)
+    x = width - 1 - x;
+  if (layout & MATRIX_FLIP_Y)
+    y = height - 1 - y;
+
+  switch (layout & 0x0F) {
+  case MATRIX_ROW_SERPENTINE:
+    return (uint32_t)(y * width + ((y & 1) ? width - 1 - x : x));
+  case MATRIX_COLUMN_PROGRESSIVE:
+    return (uint32_t)(x * height + y);
+  case MATRIX_ROW_PROGRESSIVE:
+    return (uint32_t)(y * width + x);
+  case MATRIX_COLUMN_SERPENTINE:
+  default:
+    // Even columns go up, odd columns come back down
+    return (uint32_t)(x * height + ((x & 1) ? height - 1 - y : y));
+  }
+}
+
+// Cells of all matrices in the strip setup
+static size_t matrix_cells(void) {
+  size_t total = 0;
+  for (int s = 0; s < g_num_strips; s++) {
+    if (is_matrix(s))
+      total += (size_t)g_strip_setup[s].matrix_width *
+               g_strip_setup[s].matrix_height;
+  }
+  return total;
+}
+
+static void build_matrix_tables(Arena *arena) {
+  g_matrix_xy = arena_alloc(arena, g_num_strips * sizeof(*g_matrix_xy));
+  uint32_t *table = arena_alloc(arena, matrix_cells() * sizeof(*table));
+  for (int s = 0; s < g_num_strips; s++) {
+    if (!is_matrix(s))
+      continue;
+    int width = g_strip_setup[s].matrix_width;
+    int height = g_strip_setup[s].matrix_height;
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        table[y * width + x] = matrix_layout_index(
+            width, height, g_strip_setup[s].matrix_layout, x, y);
+      }
+    }
+    g_matrix_xy[s] = table;
+    table += (size_t)width * height;
+  }
+}
+
+// Rotate v by Euler angles in degrees (x, then y, then z; the convention of
+// raymath's MatrixRotateXYZ, so the visualizer draws strips where they are)
+static void rotate_xyz(const float angle[3], const float v[3], float out[3]) {
+  float cx = cosf(-angle[0] * DEG_TO_RAD), sx = sinf(-angle[0] * DEG_TO_RAD);
+  float cy = cosf(-angle[1] * DEG_TO_RAD), sy = sinf(-angle[1] * DEG_TO_RAD);
+  float cz = cosf(-angle[2] * DEG_TO_RAD), sz = sinf(-angle[2] * DEG_TO_RAD);
+  float m0 = cz * cy, m4 = sz * cy, m8 = -sy;
+  float m1 = cz * sy * sx - sz * cx, m5 = sz * sy * sx + cz * cx;
+  float m9 = cy * sx;
+  float m2 = cz * sy * cx + sz * sx, m6 = sz * sy * cx - cz * sx;
+  float m10 = cy * cx;
+  out[0] = m0 * v[0] + m4 * v[1] + m8 * v[2];
+  out[1] = m1 * v[0] + m5 * v[1] + m9 * v[2];
+  out[2] = m2 * v[0] + m6 * v[1] + m10 * v[2];
+}
+
+// LEDs of a strip in a line along its rotated x axis
+static void layout_strip(CoreState *core, int s) {
+  const StripLayout *layout = &core->layout[s];
+  for (int i = 0; i < layout->num_leds; i++) {
+    float local[3] = {(float)i * layout->spacing, 0.0f, 0.0f};
+    float *pos = core->led_position[s * core->stride + i];
+    rotate_xyz(layout->rotation, local, pos);
+    for (int k = 0; k < 3; k++) {
+      pos[k] = layout->origin[k] + pos[k];
+    }
+  }
+}
+
+// LEDs of a matrix in a 2D grid matching the wiring layout. x = column (left
+// to right), y = row (bottom to top), centered on the origin.
+static void layout_matrix(CoreState *core, int s, int width, int height,
+                          int wiring) {
+  const StripLayout *layout = &core->layout[s];
+  for (int x = 0; x < width; x++) {
+    for (int y = 0; y < height; y++) {
+      uint32_t idx = matrix_layout_index(width, height, wiring, x, y);
+      if (idx >= (uint32_t)layout->num_leds)
+        continue;
+
+      float *pos = core->led_position[s * core->stride + idx];
+      pos[0] = layout->origin[0] + (x - (width - 1) / 2.0f) * layout->spacing;
+      pos[1] = layout->origin[1] + (y - (height - 1) / 2.0f) * layout->spacing;
+      pos[2] = layout->origin[2];
+    }
+  }
+}
+
+// Place every strip in the room from its StripDef
+// (layout and led_position start out zeroed)
+static void layout_strips(CoreState *core, const StripDef *strip_setup) {
+  for (int i = 0; i < core->num_strips; i++) {
+    StripLayout *layout = &core->layout[i];
+    int num_leds = strip_setup[i].num_leds > 0 ? strip_setup[i].num_leds : 0;
+
+    // Map position (-1.0 to 1.0) to x coordinate (-0.75 to +0.75)
+    float x = strip_setup[i].position * 0.75f;
+    layout->origin[0] = x;
+    layout->origin[1] = 1.0f;
+    layout->origin[2] = -2.95f;
+
+    int matrix_w = strip_setup[i].matrix_width;
+    int matrix_h = strip_setup[i].matrix_height;
+
+    if (matrix_w > 0 && matrix_h > 0) {
+      // Create as 2D matrix
+      // Convert length_cm to pixel spacing (length_cm is width of matrix)
+      float width_m = strip_setup[i].length_cm > 0
+                          ? strip_setup[i].length_cm / 100.0f
+                          : (float)matrix_w * 0.01f;
+      layout->spacing = matrix_w > 1 ? width_m / (float)(matrix_w - 1)
+                                     : 0.01f;
+      num_leds = matrix_w * matrix_h;
+      layout->num_leds = num_leds;
+      layout_matrix(core, i, matrix_w, matrix_h,
+                    strip_setup[i].matrix_layout);
+    } else {
+      // Create as 1D strip, hanging vertically
+      float length_m = strip_setup[i].length_cm > 0
+                           ? strip_setup[i].length_cm / 100.0f
+                           : 1.0f;
+      layout->spacing =
+          num_leds > 1 ? length_m / (float)(num_leds - 1) : 0.0f;
+      layout->rotation[2] = 90.0f;
+      layout->num_leds = num_leds;
+      layout_strip(core, i);
+    }
+  }
+}
+
+// Normalized LED coordinates, laid out like the framebuffer (strip s starts
+// at s * stride), in the core's arena and rebuilt in configure_strips
+static float *g_led_x = NULL;
+static float *g_led_y = NULL;
+static float *g_led_z = NULL;
+static bool g_led_coords_valid = false;
+
+// Derive coordinates from the LED positions: center the bounding box on the
+// origin and scale its longest side to [-1, 1]
+static void build_led_coords(CoreState *core) {
+  size_t count = (size_t)core_num_pixels(core);
+  g_led_x = arena_alloc(&core->arena, count * sizeof(float));
+  g_led_y = arena_alloc(&core->arena, count * sizeof(float));
+  g_led_z = arena_alloc(&core->arena, count * sizeof(float));
+
+  float lo[3] = {0}, hi[3] = {0};
+  bool any = false;
+  for (int s = 0; s < core->num_strips; s++) {
+    for (int i = 0; i < core->layout[s].num_leds; i++) {
+      const float *p = core->led_position[s * core->stride + i];
+      for (int k = 0; k < 3; k++) {
+        lo[k] = any ? fminf(lo[k], p[k]) : p[k];
+        hi[k] = any ? fmaxf(hi[k], p[k]) : p[k];
+      }
+      any = true;
+    }
+  }
+
+  g_led_coords_valid = any;
+  if (!any)
+    return;
+
+  float extent[3], center[3];
+  for (int k = 0; k < 3; k++) {
+    extent[k] = hi[k] - lo[k];
+    center[k] = (lo[k] + hi[k]) * 0.5f;
+  }
+  float longest = fmaxf(extent[0], fmaxf(extent[1], extent[2]));
+  float scale = longest > 0.0f ? 2.0f / longest : 0.0f;
+
+  for (int s = 0; s < core->num_strips; s++) {
+    for (int i = 0; i < core->layout[s].num_leds; i++) {
+      int idx = s * core->stride + i;
+      const float *p = core->led_position[idx];
+      g_led_x[idx] = (p[0] - center[0]) * scale;
+      g_led_y[idx] = (p[1] - center[1]) * scale;
+      g_led_z[idx] = (p[2] - center[2]) * scale;
+    }
+  }
+}
+
+LedCoords get_strip_coords(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_led_coords_valid)
+    return (LedCoords){NULL, NULL, NULL};
+  int off = strip * g_stride;
+  return (LedCoords){&g_led_x[off], &g_led_y[off], &g_led_z[off]};
+}
+
+int get_matrix_index(int strip, int x, int y) {
+  const uint32_t *table = get_matrix_xy_table(strip);
+  if (!table)
+    return 0;
+
+  int width = g_strip_setup[strip].matrix_width;
+  int height = g_strip_setup[strip].matrix_height;
+
+  // Clamp coordinates
+  if (x < 0) x = 0;
+  if (x >= width) x = width - 1;
+  if (y < 0) y = 0;
+  if (y >= height) y = height - 1;
+
+  return (int)table[y * width + x];
+}
+
+const uint32_t *get_matrix_xy_table(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_matrix_xy)
+    return NULL;
+  return g_matrix_xy[strip];
+}
+
+const uint32_t *get_matrix_row(int strip, int y) {
+  const uint32_t *table = get_matrix_xy_table(strip);
+  if (!table || y < 0 || y >= g_strip_setup[strip].matrix_height)
+    return NULL;
+  return table + (size_t)y * g_strip_setup[strip].matrix_width;
+}
+
+RGB *get_strip_leds(int strip) {
+  if (strip < 0 || strip >= g_num_strips || !g_framebuffer)
+    return NULL;
+  if (g_strip_touched)
+    g_strip_touched[strip] = 1;
+  return g_framebuffer + strip * g_stride;
+}
+
+StripFramebuffer get_framebuffer(void) {
+  if (g_strip_touched)
+    memset(g_strip_touched, 1, (size_t)g_num_strips);
+  return (StripFramebuffer){g_framebuffer, g_stride};
+}
+
+void set_matrix_row(int strip, int y, const RGB *colors) {
+  const uint32_t *row = get_matrix_row(strip, y);
+  RGB *leds = get_strip_leds(strip);
+  if (!row || !leds)
+    return;
+
+  int width = g_strip_setup[strip].matrix_width;
+  int num_leds = get_strip_num_leds(strip);
+  if (row[0] + (uint32_t)width - 1 == row[width - 1] &&
+      row[width - 1] < (uint32_t)num_leds) {
+    // Row wired left to right in one run (progressive or even serpentine row)
+    memcpy(leds + row[0], colors, (size_t)width * sizeof(RGB));
+    return;
+  }
+  for (int x = 0; x < width; x++) {
+    if (row[x] < (uint32_t)num_leds)
+      leds[row[x]] = colors[x];
+  }
+}
+
+void set_matrix_column(int strip, int x, const RGB *colors) {
+  const uint32_t *table = get_matrix_xy_table(strip);
+  RGB *leds = get_strip_leds(strip);
+  if (!table || !leds || x < 0 || x >= g_strip_setup[strip].matrix_width)
+    return;
+
+  int width = g_strip_setup[strip].matrix_width;
+  int height = g_strip_setup[strip].matrix_height;
+  int num_leds = get_strip_num_leds(strip);
+  for (int y = 0; y < height; y++) {
+    uint32_t idx = table[y * width + x];
+    if (idx < (uint32_t)num_leds)
+      leds[idx] = colors[y];
+  }
+}
+
+const RGB *get_palette256(void) {
+  return g_palette256 ? *g_palette256 : NULL;
+}
+
+// Pixel access function for programs - reads/writes the framebuffer
+static void core_pixel(int strip, int led, uint8_t *r, uint8_t *g,
+                       uint8_t *b) {
+  RGB *px = &g_framebuffer[strip * g_stride + led];
+  if (r && g && b && (px->r != *r || px->g != *g || px->b != *b)) {
+    // Set pixel
+    px->r = *r;
+    px->g = *g;
+    px->b = *b;
+
+    // Each strip is written by one thread at a time, so plain stores are safe
+    g_strip_touched[strip] = 1;
+  }
+  // Always return current values
+  *r = px->r;
+  *g = px->g;
+  *b = px->b;
+}
+
+// Per-frame arguments shared by all update_strip tasks
+typedef struct {
+  const Program *program;
+  double time_ms;
+  const RGB *palette;
+} StripUpdateTask;
+
+static void run_strip_update(void *ctx, int strip) {
+  const StripUpdateTask *task = ctx;
+  task->program->update_strip(strip, task->time_ms, core_pixel,
+                              task->palette);
+}
+
+// Run a program into target, a buffer laid out like core->framebuffer.
+// PixelFunc writes and get_strip_leds() spans (ours and the loaded library's)
+// point at target for the duration of the call.
+static void render_program(CoreState *core, const Program *program,
+                           RGB *target) {
+  if (!program)
+    return;
+
+  bool redirect = target != core->framebuffer;
+  if (redirect) {
+    g_framebuffer = target;
+    if (core->set_program_framebuffer)
+      core->set_program_framebuffer(target, core->stride);
+  }
+
+  // Per-strip programs fan out over the worker pool; run() returns only
+  // after every strip is done.
+  if (program->update_strip) {
+    StripUpdateTask task = {program, core->time_ms, *core->current_palette};
+    worker_pool_run(core->workers, run_strip_update, &task,
+                    core->num_strips);
+  } else if (program->update) {
+    program->update(core->time_ms, core_pixel, *core->current_palette);
+  }
+
+  if (redirect) {
+    g_framebuffer = core->framebuffer;
+    if (core->set_program_framebuffer)
+      core->set_program_framebuffer(core->framebuffer, core->stride);
+  }
+}
+
+// Flag every strip for the consumer of the framebuffer
+static void touch_all_strips(CoreState *core) {
+  if (core->strip_touched)
+    memset(core->strip_touched, 1, (size_t)core->num_strips);
+}
+
+// End a running transition: the incoming program owns the framebuffer from
+// here on, the outgoing one is cleaned up
+static void finish_transition(CoreState *core) {
+  Transition *t = &core->transition;
+  if (!transition_active(t))
+    return;
+  if (t->from->cleanup)
+    t->from->cleanup();
+  transition_end(t);
+}
+
+// Run both programs of a transition into their buffers and mix them
+static void run_transition(CoreState *core) {
+  Transition *t = &core->transition;
+  uint8_t progress = transition_progress(t, core->time_ms);
+
+  double start = monotonic_ms();
+  render_program(core, t->from, t->from_pixels);
+  double from_done = monotonic_ms();
+  render_program(core, core->current_program, t->to_pixels);
+  double to_done = monotonic_ms();
+  transition_record_cost(t, from_done - start, to_done - from_done);
+
+  transition_mix(t, core->framebuffer, core->num_strips, core->stride,
+                 progress);
+  touch_all_strips(core);
+  if (progress == 255) {
+    // The last mix equals the incoming frame, so it continues seamlessly
+    finish_transition(core);
+  }
+}
+
+// Show the recorded frame at core->time_ms, wrapped to loop the recording
+static void play_recording(CoreState *core) {
+  LedVizRecording *rec = core->playback;
+  double time_ms = core->playback_duration_ms > 0.0
+                       ? fmod(core->time_ms, core->playback_duration_ms)
+                       : 0.0;
+  int frame = led_viz_recording_find(rec, time_ms);
+  if (frame == rec->frame)
+    return;
+  if (!led_viz_recording_decode(rec, frame, core->playback_pixels, NULL)) {
+    log_error("Recording is corrupt at frame %d, stopping playback", frame);
+    core_play_recording(core, NULL);
+    return;
+  }
+
+  const uint8_t *pixels = core->playback_pixels;
+  for (int s = 0; s < core->num_strips; s++) {
+    size_t bytes = (size_t)core->layout[s].num_leds * sizeof(RGB);
+    memcpy(&core->framebuffer[s * core->stride], pixels, bytes);
+    pixels += bytes;
+  }
+  touch_all_strips(core);
+}
+
+// Forget the strips and everything sized for them (the arena is kept)
+static void drop_strips(CoreState *core) {
+  core->num_strips = 0;
+  core->stride = 0;
+  core->layout = NULL;
+  core->led_position = NULL;
+  core->framebuffer = NULL;
+  core->strip_touched = NULL;
+  g_num_strips = 0;
+  g_matrix_xy = NULL;
+  g_led_x = g_led_y = g_led_z = NULL;
+  g_led_coords_valid = false;
+}
+
+void core_init(CoreState *core, double frame_budget_ms) {
+  // No strips until core_configure_strips
+  drop_strips(core);
+  g_framebuffer = NULL;
+  g_strip_touched = NULL;
+  g_stride = 0;
+  core->time_ms = 0;
+  core->active_program = 0;
+  core->current_program = NULL; // Set by main after loading
+  core_select_palette(core, 0);
+  g_palette256 = &core->current_palette256;
+
+  if (!core->workers) {
+    core->workers = worker_pool_create(worker_pool_default_size());
+  }
+
+  // Transition buffers are sized with the strips
+  core->transition.duration_ms = DEFAULT_TRANSITION_MS;
+  core->transition.budget_ms = frame_budget_ms;
+  core->active_transition = 1; // Crossfade
+  core->transition.func = transition_registry[1].func;
+}
+
+int core_strip_stride(const StripDef *strip_setup, int num_strips) {
+  int stride = 1;
+  for (int s = 0; s < num_strips; s++) {
+    int num_leds = strip_setup[s].num_leds;
+    if (strip_setup[s].matrix_width > 0 && strip_setup[s].matrix_height > 0 &&
+        strip_setup[s].matrix_width * strip_setup[s].matrix_height > num_leds)
+      num_leds = strip_setup[s].matrix_width * strip_setup[s].matrix_height;
+    if (num_leds > stride)
+      stride = num_leds;
+  }
+  return stride;
+}
+
+// Carve the per-strip storage out of the arena, sized for the setup. False
+// without memory.
+static bool allocate_strips(CoreState *core) {
+  size_t count = (size_t)core_num_pixels(core);
+  size_t n = (size_t)core->num_strips;
+  size_t size = arena_size(n * sizeof(*core->layout)) +
+                arena_size(count * sizeof(*core->led_position)) +
+                arena_size(count * sizeof(*core->framebuffer)) +
+                arena_size(n * sizeof(*core->strip_touched)) +
+                arena_size(n * sizeof(*g_matrix_xy)) +
+                arena_size(matrix_cells() * sizeof(uint32_t)) +
+                3 * arena_size(count * sizeof(float));
+  if (!arena_reset(&core->arena, size))
+    return false;
+
+  core->layout = arena_alloc(&core->arena, n * sizeof(*core->layout));
+  core->led_position =
+      arena_alloc(&core->arena, count * sizeof(*core->led_position));
+  core->framebuffer =
+      arena_alloc(&core->arena, count * sizeof(*core->framebuffer));
+  core->strip_touched =
+      arena_alloc(&core->arena, n * sizeof(*core->strip_touched));
+  build_matrix_tables(&core->arena);
+  return true;
+}
+
+void core_configure_strips(CoreState *core, const StripDef *strip_setup,
+                           int num_strips) {
+  // Store for accessor functions
+  g_strip_setup = strip_setup;
+  g_num_strips = num_strips > 0 ? num_strips : 0;
+  core->num_strips = g_num_strips;
+  core->stride = core_strip_stride(strip_setup, g_num_strips);
+
+  if (!allocate_strips(core)) {
+    log_error("No memory for %d strips of up to %d LEDs", num_strips,
+              core->stride);
+    drop_strips(core);
+  }
+  touch_all_strips(core);
+  layout_strips(core, strip_setup);
+  build_led_coords(core);
+
+  // Point the pixel accessors and the loaded library at the new framebuffer
+  g_framebuffer = core->framebuffer;
+  g_strip_touched = core->strip_touched;
+  g_stride = core->stride;
+  if (core->set_program_framebuffer)
+    core->set_program_framebuffer(core->framebuffer, core->stride);
+  if (core->set_program_touched_flags)
+    core->set_program_touched_flags(core->strip_touched);
+
+  // A transition mixes whole framebuffers
+  Transition *t = &core->transition;
+  int num_pixels = core_num_pixels(core);
+  if (num_pixels != t->num_pixels) {
+    finish_transition(core);
+    transition_release(t);
+    if (num_pixels > 0 &&
+        !transition_init(t, num_pixels, t->duration_ms, t->budget_ms)) {
+      log_warning("No memory for transitions, switching hard");
+    }
+  }
+
+  log_info("Configured %d strips", core->num_strips);
+}
+
+void core_configure_layers(CoreState *core, const LayerDef *layers,
+                           int num_layers, const Program *programs,
+                           int num_programs) {
+  Compositor *comp = &core->compositor;
+  compositor_configure(comp, layers, num_layers, programs, num_programs,
+                       core_num_pixels(core));
+  // Layers start on with the first stack; reloads keep the L toggle
+  if (comp->num_layers > 0 && !comp->seen_layers) {
+    comp->enabled = true;
+    comp->seen_layers = true;
+  }
+}
+
+void core_release_programs(CoreState *core) {
+  core_configure_layers(core, NULL, 0, NULL, 0);
+  finish_transition(core);
+  core->set_program_framebuffer = NULL;
+  core->set_program_touched_flags = NULL;
+}
+
+void core_switch_program(CoreState *core, int index) {
+  // A switch during a transition lands the previous one first
+  finish_transition(core);
+
+  const Program *outgoing = core->current_program;
+  core->active_program = index;
+  core->current_program = &core->programs[index];
+
+  // Keep the outgoing program running while it fades out; layers replace
+  // the program output, so there is nothing to fade while they are on.
+  // An isolated worker runs init and cleanup itself.
+  bool fade = !core->isolated && outgoing &&
+              outgoing != core->current_program && core->transition.func &&
+              core->transition.from_pixels &&
+              core->transition.duration_ms > 0.0 &&
+              !compositor_active(&core->compositor);
+  if (fade) {
+    transition_start(&core->transition, outgoing, core->framebuffer,
+                     core->time_ms, core->program_cost_ms);
+  } else if (!core->isolated && outgoing && outgoing->cleanup) {
+    // Cleanup old program if it has a cleanup function
+    outgoing->cleanup();
+  }
+  // Initialize new program if it has an init function
+  if (!core->isolated && core->current_program->init) {
+    core->current_program->init();
+  }
+}
+
+bool core_play_recording(CoreState *core, LedVizRecording *rec) {
+  free(core->playback_pixels);
+  core->playback_pixels = NULL;
+  core->playback = NULL;
+  if (!rec)
+    return true;
+
+  bool matches = (int)rec->header.num_strips == core->num_strips;
+  for (int s = 0; matches && s < core->num_strips; s++) {
+    matches = rec->strips[s].num_leds == core->layout[s].num_leds;
+  }
+  if (!matches) {
+    log_error("The recording's strips don't fit the configured ones");
+    return false;
+  }
+  if (rec->num_frames == 0) {
+    log_error("The recording has no frames");
+    return false;
+  }
+  core->playback_pixels = malloc(rec->header.frame_size + 1);
+  if (!core->playback_pixels)
+    return false;
+  rec->frame = -1; // the pixels don't hold a decoded frame yet
+  core->playback = rec;
+  core->playback_duration_ms = led_viz_recording_duration(rec);
+  log_info("Playing %d recorded frame(s) (%.1f s)", rec->num_frames,
+           core->playback_duration_ms / 1000.0);
+  return true;
+}
+
+void core_select_palette(CoreState *core, int index) {
+  core->active_palette = index;
+  core->current_palette = palette_registry[index].palette;
+  palette_expand(core->current_palette256, *core->current_palette, true);
+}
+
+void core_render(CoreState *core) {
+  // Update LED colors via the isolated worker, the layer stack, a running
+  // transition, or the current program alone
+  Compositor *comp = &core->compositor;
+  if (core->playback) {
+    play_recording(core);
+  } else if (core->isolated) {
+    if (program_worker_sync(core->isolated, core->framebuffer, core->time_ms,
+                            core->active_program, core->current_palette)) {
+      touch_all_strips(core);
+    }
+  } else if (compositor_active(comp)) {
+    for (int i = 0; i < comp->num_layers; i++) {
+      render_program(core, comp->layers[i].program, comp->layers[i].pixels);
+    }
+    compositor_flatten(comp, core->framebuffer);
+    touch_all_strips(core);
+  } else if (transition_active(&core->transition)) {
+    run_transition(core);
+  } else {
+    double start = monotonic_ms();
+    render_program(core, core->current_program, core->framebuffer);
+    double cost_ms = monotonic_ms() - start;
+    core->program_cost_ms = 0.9 * core->program_cost_ms + 0.1 * cost_ms;
+  }
+}
+
+void core_shutdown(CoreState *core) {
+  core_play_recording(core, NULL);
+  worker_pool_destroy(core->workers);
+  core->workers = NULL;
+  compositor_release(&core->compositor);
+  transition_release(&core->transition);
+  drop_strips(core);
+  arena_release(&core->arena);
+  g_framebuffer = NULL;
+  g_strip_touched = NULL;
+}
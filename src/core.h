@@ -0,0 +1,121 @@
+#pragma once
+
+// Simulation core: strip configuration, the runtime accessors programs call,
+// the LED framebuffer and running programs, layers and transitions into it.
+// Has no window or GPU dependencies; the visualizer draws what it produces
+// and the headless runner dumps it.
+
+#include "arena.h"
+#include "compositor.h"
+#include "led_viz_recording.h"
+#include "palette.h"
+#include "program_worker.h"
+#include "programs.h"
+#include "transition.h"
+#include "worker_pool.h"
+#include <stdbool.h>
+
+#define DEFAULT_TRANSITION_MS 1000.0
+
+// Where a strip hangs in the simulated room, in meters. A strip runs along
+// its rotated x axis; a matrix is a grid in the xy plane around its origin.
+typedef struct {
+  int num_leds;
+  float origin[3];
+  float rotation[3]; // degrees about x, y and z
+  float spacing;     // between neighboring LEDs
+} StripLayout;
+
+typedef struct CoreState {
+  int num_strips;
+  int stride; // LEDs per strip in the buffers below: the longest strip
+  // Everything below up to time_ms lives in arena, sized from the strip
+  // setup and rebuilt by core_configure_strips (NULL without strips)
+  Arena arena;
+  StripLayout *layout; // num_strips
+  // LED positions in meters, laid out like the framebuffer
+  float (*led_position)[3];
+  // LED colors written by programs: strip s starts at s * stride
+  RGB *framebuffer;
+  // Strips whose pixels may have changed since the last look (PixelFunc
+  // writes, direct spans, layers, transitions); cleared by whoever consumes
+  // the framebuffer
+  uint8_t *strip_touched;
+  double time_ms; // program time, advanced by the caller
+  // Programs (loaded dynamically)
+  const Program *programs;
+  int num_programs;
+  int active_program;
+  const Program *current_program;
+  int active_palette;
+  const Palette16 *current_palette;
+  Palette256 current_palette256; // expanded when the palette is selected
+  // Runs Program.update_strip for all strips in parallel
+  WorkerPool *workers;
+  // Layer stack (from the program file's optional layer_setup)
+  Compositor compositor;
+  // Redirects the loaded library's framebuffer while a layer renders
+  void (*set_program_framebuffer)(RGB *pixels, int stride);
+  // Points the loaded library's span access at strip_touched
+  void (*set_program_touched_flags)(uint8_t *flags);
+  // Program switch transitions (selected from transition_registry)
+  Transition transition;
+  int active_transition;
+  double program_cost_ms; // smoothed render time of the current program
+  // Runs the programs in a child process when set (no layers or transitions)
+  ProgramWorker *isolated;
+  // Replays a recording instead of running programs when set (looping)
+  LedVizRecording *playback;
+  uint8_t *playback_pixels; // last frame decoded
+  double playback_duration_ms;
+} CoreState;
+
+// Initialize state. frame_budget_ms is what one frame may cost (used to warn
+// about transitions that won't fit).
+void core_init(CoreState *core, double frame_budget_ms);
+
+// LEDs per strip in the buffers of a strip setup: its longest strip (a
+// matrix counts its cells)
+int core_strip_stride(const StripDef *strip_setup, int num_strips);
+
+// LEDs in the framebuffer, padding included
+static inline int core_num_pixels(const CoreState *core) {
+  return core->num_strips * core->stride;
+}
+
+// Configure strips from StripDef array (call after init, and on hot-reload).
+// Sizes the framebuffer and everything else per strip to the setup and hands
+// the new framebuffer to the loaded library.
+void core_configure_strips(CoreState *core, const StripDef *strip_setup,
+                           int num_strips);
+
+// Configure the layer stack from LayerDef entries naming loaded programs
+// (pass 0 layers to clear it; call again after every hot-reload). The first
+// stack turns layers on; after that, whether they are on carries over.
+void core_configure_layers(CoreState *core, const LayerDef *layers,
+                           int num_layers, const Program *programs,
+                           int num_programs);
+
+// Drop everything that points into the loaded programs (layers, a running
+// transition, the framebuffer hooks); call before unloading them
+void core_release_programs(CoreState *core);
+
+// Make programs[index] the current program, fading over from the previous
+// one when a transition is selected
+void core_switch_program(CoreState *core, int index);
+
+// Show rec instead of the programs from now on (NULL to stop). Its strips
+// must be the ones configured. Returns false if they aren't, or when out of
+// memory.
+bool core_play_recording(CoreState *core, LedVizRecording *rec);
+
+// Select a palette from palette_registry
+void core_select_palette(CoreState *core, int index);
+
+// Run the current program (or the layers, or a transition, or show the
+// recording being played) at core->time_ms
+void core_render(CoreState *core);
+
+// Release resources that outlive a frame (worker threads, strip storage,
+// layer and transition buffers)
+void core_shutdown(CoreState *core);
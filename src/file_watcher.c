@@ -0,0 +1,323 @@
+#include "file_watcher.h"
+
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#ifdef __APPLE__
+#define STAT_MTIME_NS(st)                                                      \
+  ((int64_t)(st).st_mtimespec.tv_sec * 1000000000 + (st).st_mtimespec.tv_nsec)
+#else
+#define STAT_MTIME_NS(st)                                                      \
+  ((int64_t)(st).st_mtim.tv_sec * 1000000000 + (st).st_mtim.tv_nsec)
+#endif
+
+// Interval of the stat() fallback
+#define POLL_INTERVAL_MS 250
+
+// What the stat() fallback compares: a rename save changes the inode even
+// when size and (coarse) mtime happen to match
+typedef struct {
+  int64_t mtime_ns;
+  off_t size;
+  ino_t inode;
+} FileStamp;
+
+typedef struct {
+  char *path;
+  int wd; // inotify watch descriptor (-1 when polling)
+} WatchedDir;
+
+typedef struct {
+  char *path;
+  const char *name; // file name within path
+  int dir;          // index into dirs
+  FileStamp stamp;  // last seen state (stat() fallback only)
+} WatchedFile;
+
+struct FileWatcher {
+  pthread_t thread;
+  int debounce_ms;
+
+  atomic_bool changed; // set by the watcher thread, cleared by poll
+  int wake_pipe[2];    // written on destroy to stop the thread
+  int inotify_fd;      // -1 when using the stat() fallback
+
+  // Watched set (under lock, replaced by file_watcher_set_paths)
+  pthread_mutex_t lock;
+  WatchedFile *files;
+  int num_files;
+  WatchedDir *dirs;
+  int num_dirs;
+};
+
+static double monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static FileStamp read_stamp(const char *path) {
+  FileStamp stamp = {0};
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    stamp.mtime_ns = STAT_MTIME_NS(st);
+    stamp.size = st.st_size;
+    stamp.inode = st.st_ino;
+  }
+  return stamp;
+}
+
+// Read all queued inotify events; true if any of them concerns a watched
+// file
+static bool drain_inotify(FileWatcher *watcher) {
+#ifdef __linux__
+  char buf[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool relevant = false;
+
+  for (;;) {
+    ssize_t len = read(watcher->inotify_fd, buf, sizeof(buf));
+    if (len <= 0)
+      break;
+    pthread_mutex_lock(&watcher->lock);
+    for (char *p = buf; p < buf + len;) {
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      for (int i = 0; event->len > 0 && i < watcher->num_files; i++) {
+        const WatchedFile *file = &watcher->files[i];
+        if (watcher->dirs[file->dir].wd == event->wd &&
+            strcmp(event->name, file->name) == 0) {
+          relevant = true;
+        }
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+    pthread_mutex_unlock(&watcher->lock);
+  }
+  return relevant;
+#else
+  (void)watcher;
+  return false;
+#endif
+}
+
+// Block for up to timeout_ms (-1 = no limit). Returns 1 if the file changed,
+// 0 on timeout or unrelated activity, -1 when asked to stop.
+static int wait_for_change(FileWatcher *watcher, int timeout_ms) {
+  bool polling = watcher->inotify_fd < 0;
+  if (polling && (timeout_ms < 0 || timeout_ms > POLL_INTERVAL_MS)) {
+    timeout_ms = POLL_INTERVAL_MS;
+  }
+
+  struct pollfd fds[2] = {
+      {.fd = watcher->wake_pipe[0], .events = POLLIN},
+      {.fd = watcher->inotify_fd, .events = POLLIN},
+  };
+  int ready = poll(fds, polling ? 1 : 2, timeout_ms);
+  if (ready > 0 && (fds[0].revents & POLLIN))
+    return -1;
+
+  if (polling) {
+    int changed = 0;
+    pthread_mutex_lock(&watcher->lock);
+    for (int i = 0; i < watcher->num_files; i++) {
+      WatchedFile *file = &watcher->files[i];
+      FileStamp stamp = read_stamp(file->path);
+      if (stamp.mtime_ns != file->stamp.mtime_ns ||
+          stamp.size != file->stamp.size || stamp.inode != file->stamp.inode) {
+        file->stamp = stamp;
+        changed = 1;
+      }
+    }
+    pthread_mutex_unlock(&watcher->lock);
+    return changed;
+  }
+
+  if (ready > 0 && (fds[1].revents & POLLIN))
+    return drain_inotify(watcher) ? 1 : 0;
+  return 0;
+}
+
+static void *watcher_main(void *arg) {
+  FileWatcher *watcher = arg;
+  bool pending = false;
+  double deadline = 0.0;
+
+  for (;;) {
+    int timeout_ms = -1;
+    if (pending) {
+      double remaining = deadline - monotonic_ms();
+      timeout_ms = remaining > 0.0 ? (int)remaining + 1 : 0;
+    }
+
+    int result = wait_for_change(watcher, timeout_ms);
+    if (result < 0)
+      return NULL;
+
+    if (result > 0) {
+      // Editors often write in several steps; restart the quiet period
+      pending = true;
+      deadline = monotonic_ms() + watcher->debounce_ms;
+    } else if (pending && monotonic_ms() >= deadline) {
+      pending = false;
+      atomic_store_explicit(&watcher->changed, true, memory_order_release);
+    }
+  }
+}
+
+FileWatcher *file_watcher_create(int debounce_ms) {
+  FileWatcher *watcher = calloc(1, sizeof(*watcher));
+  if (!watcher)
+    return NULL;
+
+  watcher->debounce_ms = debounce_ms > 0 ? debounce_ms : 0;
+  atomic_init(&watcher->changed, false);
+  watcher->inotify_fd = -1;
+
+  if (pipe(watcher->wake_pipe) != 0) {
+    free(watcher);
+    return NULL;
+  }
+
+#ifdef __linux__
+  watcher->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+  pthread_mutex_init(&watcher->lock, NULL);
+
+  if (pthread_create(&watcher->thread, NULL, watcher_main, watcher) != 0) {
+    if (watcher->inotify_fd >= 0)
+      close(watcher->inotify_fd);
+    close(watcher->wake_pipe[0]);
+    close(watcher->wake_pipe[1]);
+    pthread_mutex_destroy(&watcher->lock);
+    free(watcher);
+    return NULL;
+  }
+
+  return watcher;
+}
+
+static void free_watched(WatchedFile *files, int num_files, WatchedDir *dirs,
+                         int num_dirs) {
+  for (int i = 0; i < num_files; i++) {
+    free(files[i].path);
+  }
+  for (int i = 0; i < num_dirs; i++) {
+    free(dirs[i].path);
+  }
+  free(files);
+  free(dirs);
+}
+
+void file_watcher_set_paths(FileWatcher *watcher, const char *const *paths,
+                            int count) {
+  if (!watcher)
+    return;
+
+  WatchedFile *files = calloc(count > 0 ? count : 1, sizeof(*files));
+  WatchedDir *dirs = calloc(count > 0 ? count : 1, sizeof(*dirs));
+  if (!files || !dirs) {
+    free(files);
+    free(dirs);
+    return;
+  }
+
+  int num_files = 0, num_dirs = 0;
+  for (int i = 0; i < count; i++) {
+    // dirname/basename may modify their argument
+    char tmp[4096];
+    strncpy(tmp, paths[i], sizeof(tmp) - 1);
+    tmp[sizeof(tmp) - 1] = '\0';
+    const char *dir = dirname(tmp);
+
+    int d = 0;
+    while (d < num_dirs && strcmp(dirs[d].path, dir) != 0) {
+      d++;
+    }
+    if (d == num_dirs) {
+      dirs[num_dirs].path = strdup(dir);
+      dirs[num_dirs].wd = -1;
+      num_dirs++;
+    }
+
+    WatchedFile *file = &files[num_files++];
+    file->path = strdup(paths[i]);
+    const char *slash = strrchr(file->path, '/');
+    file->name = slash ? slash + 1 : file->path;
+    file->dir = d;
+    file->stamp = read_stamp(file->path);
+  }
+
+  pthread_mutex_lock(&watcher->lock);
+
+#ifdef __linux__
+  // Watch directories rather than files: a rename save replaces the inode,
+  // which would silently end a watch on the file itself. Watches on
+  // directories that stay in the set are kept.
+  for (int d = 0; watcher->inotify_fd >= 0 && d < num_dirs; d++) {
+    dirs[d].wd = inotify_add_watch(watcher->inotify_fd, dirs[d].path,
+                                   IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+  }
+  for (int o = 0; watcher->inotify_fd >= 0 && o < watcher->num_dirs; o++) {
+    bool kept = false;
+    for (int d = 0; d < num_dirs; d++) {
+      kept |= dirs[d].wd == watcher->dirs[o].wd;
+    }
+    if (!kept && watcher->dirs[o].wd >= 0) {
+      inotify_rm_watch(watcher->inotify_fd, watcher->dirs[o].wd);
+    }
+  }
+#endif
+
+  WatchedFile *old_files = watcher->files;
+  WatchedDir *old_dirs = watcher->dirs;
+  int old_num_files = watcher->num_files, old_num_dirs = watcher->num_dirs;
+  watcher->files = files;
+  watcher->num_files = num_files;
+  watcher->dirs = dirs;
+  watcher->num_dirs = num_dirs;
+  pthread_mutex_unlock(&watcher->lock);
+
+  free_watched(old_files, old_num_files, old_dirs, old_num_dirs);
+}
+
+bool file_watcher_poll(FileWatcher *watcher) {
+  if (!watcher)
+    return false;
+  // Cheap load first so the common no-change frame never writes the line
+  if (!atomic_load_explicit(&watcher->changed, memory_order_relaxed))
+    return false;
+  return atomic_exchange_explicit(&watcher->changed, false,
+                                  memory_order_acquire);
+}
+
+void file_watcher_destroy(FileWatcher *watcher) {
+  if (!watcher)
+    return;
+
+  char byte = 0;
+  if (write(watcher->wake_pipe[1], &byte, 1) != 1) {
+    pthread_cancel(watcher->thread);
+  }
+  pthread_join(watcher->thread, NULL);
+
+  if (watcher->inotify_fd >= 0)
+    close(watcher->inotify_fd);
+  close(watcher->wake_pipe[0]);
+  close(watcher->wake_pipe[1]);
+  free_watched(watcher->files, watcher->num_files, watcher->dirs,
+               watcher->num_dirs);
+  pthread_mutex_destroy(&watcher->lock);
+  free(watcher);
+}
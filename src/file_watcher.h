@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Background watcher for a set of source files. A helper thread waits for
+// any of them to be written (including editors that save by renaming a temp
+// file over it), waits until events have been quiet for debounce_ms and then
+// raises a flag the render thread can check without blocking.
+//
+// Uses inotify on Linux and falls back to polling stat() elsewhere.
+
+typedef struct FileWatcher FileWatcher;
+
+// Start the watcher thread (watching nothing yet). Returns NULL on failure.
+FileWatcher *file_watcher_create(int debounce_ms);
+
+// Replace the set of watched files (absolute paths). Safe to call from any
+// thread, e.g. after a build has listed the headers it read.
+void file_watcher_set_paths(FileWatcher *watcher, const char *const *paths,
+                            int count);
+
+// True once per settled burst of changes since the last call (lock-free)
+bool file_watcher_poll(FileWatcher *watcher);
+
+// Stop and join the watcher thread
+void file_watcher_destroy(FileWatcher *watcher);
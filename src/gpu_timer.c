@@ -0,0 +1,63 @@
+#include "gpu_timer.h"
+#include "rlgl.h"
+
+#include <string.h>
+
+// raylib loads the GL entry points through its bundled glad
+#include "external/glad.h"
+
+void gpu_timer_init(GpuTimer *timer) {
+  memset(timer, 0, sizeof(*timer));
+  glGenQueries(GPU_TIMER_FRAMES * GPU_TIMER_MAX_STAGES, &timer->queries[0][0]);
+  timer->ready = true;
+}
+
+void gpu_timer_release(GpuTimer *timer) {
+  if (!timer->ready)
+    return;
+  glDeleteQueries(GPU_TIMER_FRAMES * GPU_TIMER_MAX_STAGES,
+                  &timer->queries[0][0]);
+  timer->ready = false;
+}
+
+void gpu_timer_begin(GpuTimer *timer, TraceStage stage, uint64_t start_ns) {
+  int i = timer->count[timer->frame];
+  if (!start_ns || !timer->ready || timer->running ||
+      i >= GPU_TIMER_MAX_STAGES)
+    return;
+  rlDrawRenderBatchActive();
+  glBeginQuery(GL_TIME_ELAPSED, timer->queries[timer->frame][i]);
+  timer->start_ns[timer->frame][i] = start_ns;
+  timer->stages[timer->frame][i] = stage;
+  timer->running = true;
+}
+
+void gpu_timer_end(GpuTimer *timer) {
+  if (!timer->running)
+    return;
+  rlDrawRenderBatchActive();
+  glEndQuery(GL_TIME_ELAPSED);
+  timer->count[timer->frame]++;
+  timer->running = false;
+}
+
+void gpu_timer_next_frame(GpuTimer *timer) {
+  if (!timer->ready)
+    return;
+  // The slot after the current one was recorded GPU_TIMER_FRAMES - 1 frames
+  // ago
+  timer->frame = (timer->frame + 1) % GPU_TIMER_FRAMES;
+  int f = timer->frame;
+  for (int i = 0; i < timer->count[f]; i++) {
+    GLint available = 0;
+    glGetQueryObjectiv(timer->queries[f][i], GL_QUERY_RESULT_AVAILABLE,
+                       &available);
+    if (!available)
+      continue;
+    GLuint64 elapsed_ns = 0;
+    glGetQueryObjectui64v(timer->queries[f][i], GL_QUERY_RESULT, &elapsed_ns);
+    trace_record(timer->stages[f][i], TRACE_GPU_THREAD, timer->start_ns[f][i],
+                 elapsed_ns);
+  }
+  timer->count[f] = 0;
+}
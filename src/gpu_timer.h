@@ -0,0 +1,37 @@
+#pragma once
+
+#include "trace.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// GPU time of the GL stages of a frame, as GL_TIME_ELAPSED queries. Results
+// are read a few frames later, when the GPU is done with them, so the render
+// loop never waits; they go into the trace on its GPU track, placed at the
+// CPU time the stage was submitted. Only runs while the trace timers are on.
+
+#define GPU_TIMER_FRAMES 4 // frames in flight before results are read
+#define GPU_TIMER_MAX_STAGES 8
+
+typedef struct {
+  unsigned int queries[GPU_TIMER_FRAMES][GPU_TIMER_MAX_STAGES];
+  uint64_t start_ns[GPU_TIMER_FRAMES][GPU_TIMER_MAX_STAGES];
+  TraceStage stages[GPU_TIMER_FRAMES][GPU_TIMER_MAX_STAGES];
+  int count[GPU_TIMER_FRAMES];
+  int frame;    // slot being recorded
+  bool running; // a query is open
+  bool ready;   // queries created
+} GpuTimer;
+
+// Create the queries (needs the GL context)
+void gpu_timer_init(GpuTimer *timer);
+void gpu_timer_release(GpuTimer *timer);
+
+// Time the GL work of a stage begun at start_ns (from trace_begin(); 0 does
+// nothing). Stages can't nest. Flushes raylib's draw batch at both ends, so
+// the stage's own draws are what gets measured.
+void gpu_timer_begin(GpuTimer *timer, TraceStage stage, uint64_t start_ns);
+void gpu_timer_end(GpuTimer *timer);
+
+// Call once per frame after presenting: traces the results of the oldest
+// frame in flight (dropping any not ready yet) and reuses its queries
+void gpu_timer_next_frame(GpuTimer *timer);
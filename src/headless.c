@@ -0,0 +1,365 @@
+#include "clock.h"
+#include "core.h"
+#include "log.h"
+#include "program_build.h"
+#include "program_library.h"
+#include "programs.h"
+#include "recording.h"
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Runs the programs without a window or GPU: the sources are built and
+// loaded like in led_viz, then the active program is stepped at a fixed
+// timestep and every frame is written out, one row per strip. Meant for CI,
+// servers and benchmarks. With --play the frames come from a recording
+// instead, and --format rec writes one.
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_FPS 60.0
+
+typedef enum {
+  FORMAT_PPM, // binary PPM (P6) per frame, concatenated
+  FORMAT_RAW, // bare rgb24 pixels, width x strips per frame
+  FORMAT_REC, // a recording (see led_viz_recording.h)
+} FrameFormat;
+
+static double monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Frames are as wide as the longest strip; shorter ones are padded black
+static int frame_width(const CoreState *core) {
+  int width = 1;
+  for (int s = 0; s < core->num_strips; s++) {
+    if (core->layout[s].num_leds > width)
+      width = core->layout[s].num_leds;
+  }
+  return width;
+}
+
+static bool write_frame(FILE *out, const CoreState *core, FrameFormat format,
+                        RGB *row, int width) {
+  if (format == FORMAT_PPM &&
+      fprintf(out, "P6\n%d %d\n255\n", width, core->num_strips) < 0)
+    return false;
+  for (int s = 0; s < core->num_strips; s++) {
+    int count = core->layout[s].num_leds;
+    memcpy(row, &core->framebuffer[s * core->stride],
+           count * sizeof(RGB));
+    memset(row + count, 0, (width - count) * sizeof(RGB));
+    if (fwrite(row, sizeof(RGB), width, out) != (size_t)width)
+      return false;
+  }
+  return true;
+}
+
+// Step the current program (or recording) at a fixed timestep and write
+// every frame. strip_setup is what the strips were configured from. False if
+// the output failed.
+static bool render_frames(CoreState *core, const StripDef *strip_setup,
+                          FILE *out, FrameFormat format, int frames,
+                          double fps) {
+  int width = frame_width(core);
+  RGB *row = malloc(width * sizeof(RGB));
+  RecordingWriter *writer =
+      format == FORMAT_REC
+          ? recording_writer_create(out, core, strip_setup,
+                                    LED_VIZ_RECORDING_CODEC_PREDICT)
+          : NULL;
+  if (!row || (format == FORMAT_REC && !writer)) {
+    free(row);
+    if (writer)
+      recording_writer_finish(writer);
+    return false;
+  }
+  const char *source = core->playback ? "the recording"
+                       : compositor_active(&core->compositor)
+                           ? "the layers"
+                           : core->current_program->name;
+  log_info("Rendering %d frame(s) of %s at %.0f fps, %dx%d pixels", frames,
+           source, fps, width, core->num_strips);
+
+  Clock clock;
+  clock_init(&clock, CLOCK_FIXED, fps, 0.0);
+  bool ok = true;
+  double start_ms = monotonic_ms();
+  for (int frame = 0; ok && frame < frames; frame++) {
+    core->time_ms = clock_next(&clock, 0.0);
+    core_render(core);
+    ok = writer ? recording_writer_add(writer, core, core->time_ms)
+                : write_frame(out, core, format, row, width);
+  }
+  if (writer && !recording_writer_finish(writer))
+    ok = false;
+  double elapsed_ms = monotonic_ms() - start_ms;
+  if (ok) {
+    log_info("Rendered %d frame(s) in %.1f ms (%.3f ms per frame)", frames,
+             elapsed_ms, frames > 0 ? elapsed_ms / frames : 0.0);
+  }
+  free(row);
+  return ok;
+}
+
+static int find_palette(const char *name) {
+  for (int i = 0; i < NUM_PALETTES; i++) {
+    if (strcmp(palette_registry[i].name, name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Open the output (- is stdout). A closed pipe fails the write instead of
+// killing the process, so everything still gets cleaned up.
+static FILE *open_output(const char *output) {
+  FILE *out = strcmp(output, "-") == 0 ? stdout : fopen(output, "wb");
+  if (!out) {
+    perror(output);
+    return NULL;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  return out;
+}
+
+// Flush and close the output; returns ok, false if that failed
+static bool close_output(FILE *out, const char *output, bool ok) {
+  if (out == stdout ? fflush(out) != 0 : fclose(out) != 0) {
+    ok = false;
+  }
+  if (!ok) {
+    perror(output);
+  }
+  return ok;
+}
+
+// Write the frames of a recording (all of them if frames < 0); no program
+// is built. Returns the exit code.
+static int play_recording(const char *path, const char *output,
+                          FrameFormat format, int frames, double fps) {
+  LedVizRecording rec;
+  if (!recording_map(&rec, path))
+    return 1;
+  int num_strips;
+  StripDef *strip_setup = recording_strip_setup(&rec, &num_strips);
+  CoreState *core = calloc(1, sizeof(*core));
+  if (!strip_setup || !core) {
+    fprintf(stderr, "Error: Out of memory\n");
+    free(strip_setup);
+    free(core);
+    recording_unmap(&rec);
+    return 1;
+  }
+  core_init(core, 1000.0 / fps);
+  core_configure_strips(core, strip_setup, num_strips);
+
+  bool ok = false;
+  FILE *out = NULL;
+  if (core_play_recording(core, &rec) && (out = open_output(output))) {
+    ok = render_frames(core, strip_setup, out, format,
+                       frames >= 0 ? frames : rec.num_frames, fps);
+    ok = close_output(out, output, ok);
+  }
+
+  core_shutdown(core);
+  free(core);
+  free(strip_setup);
+  recording_unmap(&rec);
+  return ok ? 0 : 1;
+}
+
+static void print_usage(const char *prog) {
+  fprintf(stderr, "LED Visualizer - headless runner\n\n");
+  fprintf(stderr, "Usage: %s [options] <programs.c> [more sources...]\n",
+          prog);
+  fprintf(stderr, "       %s [options] --play <recording>\n\n", prog);
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  --frames <n>          Frames to render (default %d, or "
+                  "all recorded)\n",
+          DEFAULT_FRAMES);
+  fprintf(stderr, "  --fps <n>             Fixed timestep in frames per "
+                  "second (default %.0f)\n",
+          DEFAULT_FPS);
+  fprintf(stderr, "  --program <name>      Program to run alone (default: "
+                  "the layer stack if\n"
+                  "                        the source has one, else the "
+                  "first program)\n");
+  fprintf(stderr, "  --layers              Render the layer stack (an "
+                  "error without one)\n");
+  fprintf(stderr, "  --palette <name>      Palette to pass it (default: "
+                  "%s)\n",
+          palette_registry[0].name);
+  fprintf(stderr, "  --format <ppm|raw|rec>\n"
+                  "                        Frame format (default ppm)\n");
+  fprintf(stderr, "  --play <file>         Play a recording instead of "
+                  "running programs\n");
+  fprintf(stderr, "  -o <file>             Output file, - for stdout "
+                  "(default)\n");
+  fprintf(stderr, "  -q, --quiet           Only print warnings and errors\n\n");
+  fprintf(stderr, "Each frame has one row per strip, as wide as the longest "
+                  "strip. Raw frames\n"
+                  "are rgb24, e.g. for ffmpeg -f rawvideo -pix_fmt rgb24. "
+                  "rec writes a\n"
+                  "recording that led_viz --play can show.\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *source_args[MAX_SOURCE_UNITS];
+  int num_sources = 0;
+  int frames = -1; // DEFAULT_FRAMES, or the whole recording
+  double fps = DEFAULT_FPS;
+  const char *program_name = NULL;
+  bool use_layers = false;
+  const char *palette_name = NULL;
+  FrameFormat format = FORMAT_PPM;
+  const char *output = "-";
+  const char *play_path = NULL;
+
+  // Parse arguments
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      print_usage(argv[0]);
+      return 0;
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+      if (frames < 0) {
+        fprintf(stderr, "Error: --frames must be >= 0\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+      fps = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--program") == 0 && i + 1 < argc) {
+      program_name = argv[++i];
+    } else if (strcmp(argv[i], "--layers") == 0) {
+      use_layers = true;
+    } else if (strcmp(argv[i], "--palette") == 0 && i + 1 < argc) {
+      palette_name = argv[++i];
+    } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      const char *name = argv[++i];
+      if (strcmp(name, "ppm") == 0) {
+        format = FORMAT_PPM;
+      } else if (strcmp(name, "raw") == 0) {
+        format = FORMAT_RAW;
+      } else if (strcmp(name, "rec") == 0) {
+        format = FORMAT_REC;
+      } else {
+        fprintf(stderr, "Error: Unknown format: %s\n", name);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+      play_path = argv[++i];
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-q") == 0 ||
+               strcmp(argv[i], "--quiet") == 0) {
+      log_set_quiet(true);
+    } else if (argv[i][0] != '-') {
+      if (num_sources == MAX_SOURCE_UNITS) {
+        fprintf(stderr, "Error: At most %d source files are supported\n",
+                MAX_SOURCE_UNITS);
+        return 1;
+      }
+      source_args[num_sources++] = argv[i];
+    }
+  }
+
+  if (num_sources == 0 && !play_path) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  if (fps <= 0.0) {
+    fprintf(stderr, "Error: --fps must be > 0\n");
+    return 1;
+  }
+  if (use_layers && program_name) {
+    fprintf(stderr, "Error: --layers and --program exclude each other\n");
+    return 1;
+  }
+  int palette = palette_name ? find_palette(palette_name) : 0;
+  if (palette < 0) {
+    fprintf(stderr, "Error: Unknown palette: %s\n", palette_name);
+    return 1;
+  }
+
+  if (play_path) {
+    return play_recording(play_path, output, format, frames, fps);
+  }
+  if (frames < 0)
+    frames = DEFAULT_FRAMES;
+
+  // Find the SDK, prebuild it and compile the program
+  if (!program_library_setup(source_args, num_sources)) {
+    return 1;
+  }
+  char lib_path[4096];
+  BuildStats stats;
+  program_library_next_path(lib_path, sizeof(lib_path));
+  if (!program_build_run(NULL, lib_path, &stats)) {
+    fprintf(stderr, "Compilation failed.\n");
+    program_build_shutdown();
+    return 1;
+  }
+  LoadedPrograms loaded;
+  if (!program_library_open(&loaded, lib_path)) {
+    program_build_shutdown();
+    return 1;
+  }
+
+  CoreState *core = calloc(1, sizeof(*core));
+  if (!core) {
+    fprintf(stderr, "Error: Out of memory\n");
+    program_library_close(&loaded);
+    program_build_shutdown();
+    return 1;
+  }
+  core_init(core, 1000.0 / fps);
+  core_select_palette(core, palette);
+  program_library_attach(core, &loaded);
+  core_configure_strips(core, loaded.strip_setup, *loaded.num_strips);
+  core->programs = loaded.programs;
+  core->num_programs = *loaded.num_programs;
+  // Layers, if the file stacks any, render in place of the program unless
+  // one is picked with --program
+  bool has_layers = loaded.layer_setup && loaded.num_layers &&
+                    *loaded.num_layers > 0;
+  if (has_layers && !program_name) {
+    core_configure_layers(core, loaded.layer_setup, *loaded.num_layers,
+                          loaded.programs, *loaded.num_programs);
+  }
+
+  const Program *program =
+      program_name ? program_library_find(&loaded, program_name)
+                   : (core->num_programs > 0 ? &core->programs[0] : NULL);
+  FILE *out = NULL;
+  if (use_layers && !has_layers) {
+    fprintf(stderr, "Error: --layers: the source defines no layer_setup\n");
+  } else if (!program) {
+    fprintf(stderr, "Error: No program named %s\n",
+            program_name ? program_name : "(none defined)");
+  } else {
+    out = open_output(output);
+  }
+
+  bool ok = false;
+  if (out) {
+    // Runs the program's init; there is nothing to fade from
+    core_switch_program(core, (int)(program - core->programs));
+    ok = render_frames(core, loaded.strip_setup, out, format, frames, fps);
+    if (program->cleanup) {
+      program->cleanup();
+    }
+    ok = close_output(out, output, ok);
+  }
+
+  core_release_programs(core);
+  core_shutdown(core);
+  free(core);
+  program_library_close(&loaded);
+  program_build_shutdown();
+  return ok ? 0 : 1;
+}
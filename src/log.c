@@ -0,0 +1,43 @@
+#include "log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static bool quiet = false;
+
+static void log_message(const char *prefix, const char *format, va_list args) {
+  char line[4096];
+  int len = snprintf(line, sizeof(line), "%s: ", prefix);
+  vsnprintf(line + len, sizeof(line) - len - 1, format, args);
+
+  // One write per message, so lines from worker threads don't interleave
+  size_t end = strlen(line);
+  line[end] = '\n';
+  fwrite(line, 1, end + 1, stderr);
+}
+
+void log_info(const char *format, ...) {
+  if (quiet)
+    return;
+  va_list args;
+  va_start(args, format);
+  log_message("INFO", format, args);
+  va_end(args);
+}
+
+void log_warning(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  log_message("WARNING", format, args);
+  va_end(args);
+}
+
+void log_error(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  log_message("ERROR", format, args);
+  va_end(args);
+}
+
+void log_set_quiet(bool value) { quiet = value; }
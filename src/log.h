@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Console logging for the modules shared with the headless runner, which
+// doesn't link raylib. Messages go to stderr (a headless run may write frames
+// to stdout), prefixed like raylib's TraceLog.
+
+#define LOG_FORMAT __attribute__((format(printf, 1, 2)))
+
+void log_info(const char *format, ...) LOG_FORMAT;
+void log_warning(const char *format, ...) LOG_FORMAT;
+void log_error(const char *format, ...) LOG_FORMAT;
+
+// Hide info messages (warnings and errors are always shown)
+void log_set_quiet(bool quiet);
@@ -1,309 +1,579 @@
+#include "build_job.h"
+#include "clock.h"
+#include "file_watcher.h"
+#include "program_build.h"
+#include "program_library.h"
+#include "program_worker.h"
 #include "programs.h"
 #include "raylib.h"
+#include "recording.h"
+#include "trace.h"
 #include "visualizer.h"
 
-#include <dlfcn.h>
 #include <fcntl.h>
-#include <libgen.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
-#ifdef __APPLE__
-#include <mach-o/dyld.h>
-#define LIB_EXT ".dylib"
-#else
-#define LIB_EXT ".so"
-#endif
+// Quiet period after the last write before recompiling
+#define WATCH_DEBOUNCE_MS 100
 
-// Paths resolved at startup
-static char exe_dir[4096];
-static char sdk_header_path[4096];
-static char sdk_source_path[4096];
-static char compiled_lib_path[4096];
-static char source_file_path[4096];
+// Default time an isolated program may take for one frame
+#define DEFAULT_WATCHDOG_MS 250.0
 
-typedef struct {
-  void *handle;
-  const Program *programs;
-  const int *num_programs;
-  const StripDef *strip_setup;
-  const int *num_strips;
-} LoadedPrograms;
-
-static void resolve_exe_dir(void) {
-  char exe[4096];
-  bool found = false;
-
-#ifdef __APPLE__
-  uint32_t size = sizeof(exe);
-  if (_NSGetExecutablePath(exe, &size) == 0) {
-    char *resolved = realpath(exe, NULL);
-    if (resolved) {
-      strncpy(exe, resolved, sizeof(exe) - 1);
-      free(resolved);
-    }
-    found = true;
-  }
-#else
-  ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
-  if (len > 0) {
-    exe[len] = '\0';
-    found = true;
-  }
-#endif
+// Default frame rate of HH:MM:SS:FF timecodes
+#define DEFAULT_TIMECODE_FPS 30.0
 
-  if (found) {
-    char *dir = dirname(exe);
-    strncpy(exe_dir, dir, sizeof(exe_dir) - 1);
-  } else {
-    strncpy(exe_dir, ".", sizeof(exe_dir) - 1);
-  }
-
-  // SDK files are in sdk/ subdirectory next to executable
-  snprintf(sdk_header_path, sizeof(sdk_header_path), "%s/sdk", exe_dir);
-  snprintf(sdk_source_path, sizeof(sdk_source_path), "%s/sdk/led_viz_sdk.c",
-           exe_dir);
+// Where F9 saves a trace without --trace
+#define DEFAULT_TRACE_PATH "led_viz_trace.json"
 
-  // Compiled library goes in temp
-  snprintf(compiled_lib_path, sizeof(compiled_lib_path), "/tmp/led_viz_user%s",
-           LIB_EXT);
+static double monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
 }
 
-static time_t get_mtime(const char *path) {
-  struct stat st;
-  if (stat(path, &st) != 0)
-    return 0;
-  return st.st_mtime;
+// Watch every file the last build read
+static void watch_inputs(FileWatcher *watcher) {
+  const char *paths[MAX_BUILD_INPUTS];
+  int count = program_build_inputs(paths, MAX_BUILD_INPUTS);
+  file_watcher_set_paths(watcher, paths, count);
 }
 
-static bool compile_source(const char *source_path) {
-  char cmd[8192];
-
-  // Detect compiler
-  const char *cc = getenv("CC");
-  if (!cc)
-    cc = "cc";
+// Build and open the program into a new library (BuildFunc for the
+// background job, ctx is the FileWatcher)
+static void *build_programs(BuildJob *job, void *ctx) {
+  double start_ms = monotonic_ms();
+  char lib_path[4096];
+  program_library_next_path(lib_path, sizeof(lib_path));
 
-  // Compile user source + SDK source into shared library
-  snprintf(cmd, sizeof(cmd),
-           "%s -shared -fPIC -O2 -o '%s' '%s' '%s' -I'%s' -lm 2>&1", cc,
-           compiled_lib_path, source_path, sdk_source_path, sdk_header_path);
+  BuildStats stats;
+  bool built = program_build_run(job, lib_path, &stats);
 
-  TraceLog(LOG_INFO, "Compiling: %s", cmd);
+  // Follow header changes even when this build failed
+  watch_inputs(ctx);
 
-  FILE *fp = popen(cmd, "r");
-  if (!fp) {
-    TraceLog(LOG_ERROR, "Failed to run compiler");
-    return false;
+  if (!built) {
+    unlink(lib_path);
+    return NULL;
   }
 
-  char output[4096] = {0};
-  size_t total = 0;
-  char buf[256];
-  while (fgets(buf, sizeof(buf), fp) && total < sizeof(output) - 1) {
-    size_t len = strlen(buf);
-    memcpy(output + total, buf, len);
-    total += len;
+  LoadedPrograms *loaded = malloc(sizeof(*loaded));
+  if (!loaded || !program_library_open(loaded, lib_path)) {
+    free(loaded);
+    return NULL;
   }
-  output[total] = '\0';
 
-  int status = pclose(fp);
-  if (status != 0) {
-    TraceLog(LOG_ERROR, "Compilation failed:\n%s", output);
-    return false;
-  }
+  TraceLog(LOG_INFO, "Reload ready in %.0f ms (%d of %d file(s) compiled, %s)",
+           monotonic_ms() - start_ms, stats.compiled, stats.total,
+           stats.linked ? "linked" : "cached library");
+  return loaded;
+}
 
-  if (total > 0) {
-    TraceLog(LOG_WARNING, "Compiler output:\n%s", output);
-  }
+// Drop a build that was superseded before the render thread took it
+static void discard_programs(void *result, void *ctx) {
+  (void)ctx;
+  LoadedPrograms *loaded = result;
+  program_library_close(loaded);
+  free(loaded);
+}
 
-  TraceLog(LOG_INFO, "Compilation successful");
-  return true;
+// Set up layers from the library's optional layer_setup (clears them if the
+// file defines none; layers toggled off stay off across reloads)
+static void configure_layers(VisualizerState *state,
+                             const LoadedPrograms *loaded) {
+  bool has_layers = loaded->layer_setup && loaded->num_layers;
+  core_configure_layers(&state->core,
+                        has_layers ? loaded->layer_setup : NULL,
+                        has_layers ? *loaded->num_layers : 0,
+                        loaded->programs, *loaded->num_programs);
 }
 
-static LoadedPrograms load_programs(void) {
-  LoadedPrograms loaded = {0};
+// Make an opened library the active one: hooks, strips and layers
+static void adopt_programs(VisualizerState *state,
+                           const LoadedPrograms *loaded) {
+  program_library_attach(&state->core, loaded);
 
-  loaded.handle = dlopen(compiled_lib_path, RTLD_NOW);
-  if (!loaded.handle) {
-    TraceLog(LOG_ERROR, "dlopen failed: %s", dlerror());
-    return loaded;
+  // Configure strips from loaded strip_setup
+  visualizer_configure_strips(state, loaded->strip_setup,
+                              *loaded->num_strips);
+  configure_layers(state, loaded);
+
+  // Reset to first program if current is out of range
+  if (state->core.active_program >= *loaded->num_programs) {
+    state->core.active_program = 0;
   }
+}
 
-  loaded.programs = dlsym(loaded.handle, "programs");
-  loaded.num_programs = dlsym(loaded.handle, "NUM_PROGRAMS");
-  loaded.strip_setup = dlsym(loaded.handle, "strip_setup");
-  loaded.num_strips = dlsym(loaded.handle, "NUM_STRIPS");
-
-  if (!loaded.programs || !loaded.num_programs) {
-    TraceLog(LOG_ERROR, "Missing symbols. Make sure your file defines:\n"
-                        "  const Program programs[] = { ... };\n"
-                        "  const int NUM_PROGRAMS = ...;");
-    dlclose(loaded.handle);
-    loaded.handle = NULL;
-    return loaded;
+static void unload_programs(VisualizerState *state, LoadedPrograms *loaded) {
+  if (loaded->handle) {
+    // Layers, transitions and the framebuffer hook point into the library
+    core_release_programs(&state->core);
+    program_library_close(loaded);
   }
+}
 
-  if (!loaded.strip_setup || !loaded.num_strips) {
-    TraceLog(LOG_ERROR, "Missing strip setup. Make sure your file defines:\n"
-                        "  const StripDef strip_setup[] = { ... };\n"
-                        "  const int NUM_STRIPS = ...;");
-    dlclose(loaded.handle);
-    loaded.handle = NULL;
-    return loaded;
+// State a program saved for its counterpart in the next build
+typedef struct {
+  const char *name; // points into the old build, which is still loaded
+  void *data;
+  size_t size;
+} SavedState;
+
+// Snapshot every program of the old build that exports save_state. Returns
+// the number of snapshots (the array is malloc'ed).
+static int save_states(const LoadedPrograms *from, SavedState **saved) {
+  *saved = NULL;
+  if (!from->handle)
+    return 0;
+  int count = 0;
+  *saved = malloc(*from->num_programs * sizeof(**saved));
+  for (int i = 0; *saved && i < *from->num_programs; i++) {
+    const Program *program = &from->programs[i];
+    if (!program->save_state)
+      continue;
+    SavedState *entry = &(*saved)[count];
+    entry->name = program->name;
+    entry->size = 0;
+    entry->data = program->save_state(&entry->size);
+    if (entry->data) {
+      count++;
+    }
   }
+  return count;
+}
 
-  // Set strip setup for accessor functions in loaded library
-  void (*set_strip_setup)(const StripDef *, int) =
-      dlsym(loaded.handle, "_led_viz_set_strip_setup");
-  if (set_strip_setup) {
-    set_strip_setup(loaded.strip_setup, *loaded.num_strips);
+// Hand the snapshots to the same-named programs of the new build
+static void restore_states(const LoadedPrograms *to, SavedState *saved,
+                           int count) {
+  for (int i = 0; i < count; i++) {
+    const Program *program = program_library_find(to, saved[i].name);
+    if (program && program->restore_state) {
+      program->restore_state(saved[i].data, saved[i].size);
+    }
+    free(saved[i].data);
   }
+  free(saved);
+}
 
-  TraceLog(LOG_INFO, "Loaded %d program(s) with %d strip(s)",
-           *loaded.num_programs, *loaded.num_strips);
-  return loaded;
+// Replace the running library with a new build. The old one stays loaded
+// (in retired) until the new one has rendered a frame; the active program
+// is kept by name, and state saved by the old build is restored into it.
+static void reload_programs(VisualizerState *state, LoadedPrograms *loaded,
+                            LoadedPrograms *retired, LoadedPrograms *built) {
+  const Program *outgoing = state->core.current_program;
+  const char *active_name = outgoing ? outgoing->name : NULL;
+
+  // Keep the lit pixels when the strips are laid out as before, so state
+  // carried over picks up where the old build left off
+  bool same_layout =
+      loaded->handle && *loaded->num_strips == *built->num_strips &&
+      memcmp(loaded->strip_setup, built->strip_setup,
+             *built->num_strips * sizeof(StripDef)) == 0;
+  size_t pixels_size =
+      (size_t)core_num_pixels(&state->core) * sizeof(RGB);
+  RGB *pixels = same_layout && pixels_size ? malloc(pixels_size) : NULL;
+  if (pixels) {
+    memcpy(pixels, state->core.framebuffer, pixels_size);
+  }
+
+  // An isolated worker starts over on the new build instead
+  bool isolated = state->core.isolated != NULL;
+  SavedState *saved = NULL;
+  int num_saved = isolated ? 0 : save_states(loaded, &saved);
+
+  core_release_programs(&state->core);
+  if (!isolated && outgoing && outgoing->cleanup) {
+    outgoing->cleanup();
+  }
+  program_library_close(retired);
+  *retired = *loaded;
+  *loaded = *built;
+  adopt_programs(state, loaded);
+
+  // A build without programs has nothing to start
+  const Program *incoming = program_library_find(loaded, active_name);
+  if (incoming) {
+    state->core.active_program = (int)(incoming - loaded->programs);
+  } else if (*loaded->num_programs > 0) {
+    incoming = &loaded->programs[state->core.active_program];
+  }
+  if (incoming && isolated) {
+    program_worker_start(state->core.isolated, loaded->path,
+                         state->core.active_program, state->core.num_strips,
+                         state->core.stride);
+  } else if (incoming && incoming->init) {
+    incoming->init();
+  }
+  restore_states(loaded, saved, num_saved);
+
+  if (pixels) {
+    memcpy(state->core.framebuffer, pixels, pixels_size);
+    state->lights_stale = true;
+    free(pixels);
+  }
 }
 
-static void unload_programs(LoadedPrograms *loaded) {
-  if (loaded->handle) {
-    dlclose(loaded->handle);
-    loaded->handle = NULL;
-    loaded->programs = NULL;
-    loaded->num_programs = NULL;
-    loaded->strip_setup = NULL;
-    loaded->num_strips = NULL;
+// Finish the recording and close its file
+static void stop_recording(RecordingWriter *recorder, FILE *file,
+                           const char *path) {
+  int frames = recorder ? recording_writer_frames(recorder) : 0;
+  bool ok = !recorder || recording_writer_finish(recorder);
+  if (fclose(file) != 0 || !ok) {
+    TraceLog(LOG_ERROR, "Failed to write the recording %s", path);
+  } else {
+    TraceLog(LOG_INFO, "Recorded %d frame(s) to %s", frames, path);
   }
 }
 
 static void print_usage(const char *prog) {
   fprintf(stderr, "LED Visualizer - Hot-reloading LED program simulator\n\n");
-  fprintf(stderr, "Usage: %s <programs.c>\n\n", prog);
+  fprintf(stderr, "Usage: %s [options] <programs.c> [more sources...]\n",
+          prog);
+  fprintf(stderr, "       %s [options] --play <recording>\n\n", prog);
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  --transition-ms <ms>  Program switch transition length "
+                  "(default %.0f, 0 = hard cut)\n",
+          DEFAULT_TRANSITION_MS);
+  fprintf(stderr, "  --isolate             Run programs in a separate process "
+                  "that is restarted\n"
+                  "                        when it crashes or hangs\n");
+  fprintf(stderr, "  --watchdog-ms <ms>    Frame deadline of an isolated "
+                  "program (default %.0f)\n",
+          DEFAULT_WATCHDOG_MS);
+  fprintf(stderr, "  --clock <mode>        Program time: wall (default), "
+                  "fixed or timecode\n");
+  fprintf(stderr, "  --fps <n>             Frames per second of the fixed "
+                  "clock (default %d)\n",
+          TARGET_FPS);
+  fprintf(stderr, "  --offline             Fixed clock, stepped as fast as "
+                  "possible\n");
+  fprintf(stderr, "  --frames <n>          Quit after n frames\n");
+  fprintf(stderr, "  --timecode <path>     Follow timecode lines from a FIFO "
+                  "or file (- for stdin):\n"
+                  "                        milliseconds, HH:MM:SS.mmm or "
+                  "HH:MM:SS:FF\n");
+  fprintf(stderr, "  --timecode-fps <n>    Frame rate of HH:MM:SS:FF "
+                  "(default %.0f)\n",
+          DEFAULT_TIMECODE_FPS);
+  fprintf(stderr, "  --record <file>       Record every frame shown, until "
+                  "the strips change\n");
+  fprintf(stderr, "  --play <file>         Play a recording (from --record "
+                  "or led_viz_headless)\n"
+                  "                        instead of running programs\n");
+  fprintf(stderr, "  --trace <file>        Trace frame stages from the start "
+                  "and save them as\n"
+                  "                        Chrome trace JSON on exit (F9 "
+                  "toggles tracing,\n"
+                  "                        saving to %s by default)\n\n",
+          DEFAULT_TRACE_PATH);
   fprintf(stderr, "Example:\n");
-  fprintf(stderr, "  %s ./programs.c\n\n", prog);
-  fprintf(stderr, "The source file should include <led_viz.h> and define:\n");
+  fprintf(stderr, "  %s ./programs.c\n", prog);
+  fprintf(stderr, "  %s ./show.c ./effects/*.c\n\n", prog);
+  fprintf(stderr, "The sources should include <led_viz.h> and between them "
+                  "define:\n");
   fprintf(stderr, "  const StripDef strip_setup[] = { ... };\n");
   fprintf(stderr, "  const int NUM_STRIPS = ...;\n");
   fprintf(stderr, "  const Program programs[] = { ... };\n");
   fprintf(stderr, "  const int NUM_PROGRAMS = ...;\n");
+  fprintf(stderr, "Optionally, to stack programs as layers:\n");
+  fprintf(stderr, "  const LayerDef layer_setup[] = { ... };\n");
+  fprintf(stderr, "  const int NUM_LAYERS = ...;\n");
 }
 
 int main(int argc, char *argv[]) {
-  const char *source_arg = NULL;
+  // Started again by --isolate to run the programs
+  if (argc > 1 && strcmp(argv[1], "--worker") == 0) {
+    return program_worker_main(argc, argv);
+  }
+
+  const char *source_args[MAX_SOURCE_UNITS];
+  int num_sources = 0;
+  double transition_ms = DEFAULT_TRANSITION_MS;
+  bool isolate = false;
+  double watchdog_ms = DEFAULT_WATCHDOG_MS;
+  const char *record_path = NULL;
+  const char *play_path = NULL;
+  ClockMode clock_mode = CLOCK_WALL;
+  double fps = TARGET_FPS;
+  bool offline = false;
+  long max_frames = -1;
+  const char *timecode_path = NULL;
+  double timecode_fps = DEFAULT_TIMECODE_FPS;
+  const char *trace_path = NULL;
 
   // Parse arguments
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
       print_usage(argv[0]);
       return 0;
+    } else if (strcmp(argv[i], "--transition-ms") == 0 && i + 1 < argc) {
+      transition_ms = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--isolate") == 0) {
+      isolate = true;
+    } else if (strcmp(argv[i], "--watchdog-ms") == 0 && i + 1 < argc) {
+      watchdog_ms = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+      play_path = argv[++i];
+    } else if (strcmp(argv[i], "--clock") == 0 && i + 1 < argc) {
+      if (!clock_parse_mode(argv[++i], &clock_mode)) {
+        fprintf(stderr, "Error: Unknown clock: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+      fps = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--offline") == 0) {
+      offline = true;
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      max_frames = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--timecode") == 0 && i + 1 < argc) {
+      timecode_path = argv[++i];
+      clock_mode = CLOCK_TIMECODE;
+    } else if (strcmp(argv[i], "--timecode-fps") == 0 && i + 1 < argc) {
+      timecode_fps = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_path = argv[++i];
     } else if (argv[i][0] != '-') {
-      source_arg = argv[i];
+      if (num_sources == MAX_SOURCE_UNITS) {
+        fprintf(stderr, "Error: At most %d source files are supported\n",
+                MAX_SOURCE_UNITS);
+        return 1;
+      }
+      source_args[num_sources++] = argv[i];
     }
   }
 
-  if (!source_arg) {
+  if (num_sources == 0 && !play_path) {
     print_usage(argv[0]);
     return 1;
   }
+  if (fps <= 0.0 || timecode_fps <= 0.0) {
+    fprintf(stderr, "Error: --fps and --timecode-fps must be > 0\n");
+    return 1;
+  }
+  if (offline && clock_mode == CLOCK_TIMECODE) {
+    fprintf(stderr, "Error: --offline runs its own fixed clock\n");
+    return 1;
+  }
+  if (offline) {
+    clock_mode = CLOCK_FIXED;
+  }
 
-  // Resolve paths
-  resolve_exe_dir();
+  // A recording plays in place of the programs: nothing to build or watch
+  LedVizRecording playback = {0};
+  StripDef *recorded_setup = NULL;
+  int num_recorded_strips = 0;
+  char lib_path[4096];
+  if (play_path) {
+    if (!recording_map(&playback, play_path)) {
+      return 1;
+    }
+    recorded_setup = recording_strip_setup(&playback, &num_recorded_strips);
+    if (!recorded_setup) {
+      fprintf(stderr, "Error: Out of memory\n");
+      recording_unmap(&playback);
+      return 1;
+    }
+  } else {
+    // Find the SDK, prebuild it and compile the program
+    if (!program_library_setup(source_args, num_sources)) {
+      return 1;
+    }
 
-  // Get absolute path to source file
-  char *resolved = realpath(source_arg, NULL);
-  if (!resolved) {
-    fprintf(stderr, "Error: Cannot find source file: %s\n", source_arg);
-    return 1;
+    BuildStats stats;
+    program_library_next_path(lib_path, sizeof(lib_path));
+    if (!program_build_run(NULL, lib_path, &stats)) {
+      fprintf(stderr, "Initial compilation failed. Fix errors and "
+                      "restart.\n");
+      program_build_shutdown();
+      return 1;
+    }
   }
-  strncpy(source_file_path, resolved, sizeof(source_file_path) - 1);
-  free(resolved);
 
-  // Check SDK files exist
-  if (access(sdk_source_path, R_OK) != 0) {
-    fprintf(stderr, "Error: SDK not found at %s\n", sdk_header_path);
-    fprintf(stderr, "Make sure the 'sdk' folder is next to the executable.\n");
+  // The recording starts with the first frame that has strips
+  FILE *record_file = record_path ? fopen(record_path, "wb") : NULL;
+  RecordingWriter *recorder = NULL;
+  if (record_path && !record_file) {
+    perror(record_path);
+    recording_unmap(&playback);
+    free(recorded_setup);
+    program_build_shutdown();
     return 1;
   }
 
-  // Initial compilation
-  if (!compile_source(source_file_path)) {
-    fprintf(stderr, "Initial compilation failed. Fix errors and restart.\n");
+  // Timecode comes in from the start (the window takes the clock over)
+  Clock clock;
+  clock_init(&clock, clock_mode, fps, 0.0);
+  if (clock_mode == CLOCK_TIMECODE &&
+      !clock_open_timecode(&clock, timecode_path ? timecode_path : "-",
+                           timecode_fps)) {
+    if (record_file) {
+      fclose(record_file);
+    }
+    recording_unmap(&playback);
+    free(recorded_setup);
+    program_build_shutdown();
     return 1;
   }
 
-  // Initialize window
+  // Initialize window. Offline frames come as fast as they render.
   SetConfigFlags(FLAG_MSAA_4X_HINT);
   InitWindow(1280, 720, "LED Visualizer");
-  SetTargetFPS(60);
+  SetTargetFPS(offline ? 0 : clock_mode == CLOCK_FIXED ? (int)fps
+                                                        : TARGET_FPS);
 
   // Load visualizer state
   VisualizerState state = {0};
   visualizer_init(&state);
+  clock.last_s = GetTime();
+  state.clock = clock;
+  if (clock_mode != CLOCK_WALL) {
+    TraceLog(LOG_INFO, "Clock: %s%s", clock_mode_name(clock_mode),
+             offline ? ", offline (as fast as possible)" : "");
+  }
+  state.core.transition.duration_ms = transition_ms;
+  if (isolate && !play_path) {
+    state.core.isolated =
+        program_worker_create(program_library_exe_path(), watchdog_ms);
+    if (state.core.isolated) {
+      TraceLog(LOG_INFO, "Running programs isolated (layers and transitions "
+                         "are off)");
+    }
+  }
 
-  // Load user programs and configure strips
-  LoadedPrograms loaded = load_programs();
-  time_t last_mtime = get_mtime(source_file_path);
+  // Load user programs and configure strips. A replaced build is kept in
+  // retired until the next one has rendered its first frame.
+  LoadedPrograms loaded = {0}, retired = {0};
+  if (play_path) {
+    visualizer_configure_strips(&state, recorded_setup, num_recorded_strips);
+    core_play_recording(&state.core, &playback);
+  } else if (program_library_open(&loaded, lib_path)) {
+    adopt_programs(&state, &loaded);
+    if (state.core.isolated) {
+      program_worker_start(state.core.isolated, loaded.path,
+                           state.core.active_program, state.core.num_strips,
+                           state.core.stride);
+    }
+  }
 
-  // Configure strips from loaded strip_setup
-  if (loaded.strip_setup && loaded.num_strips) {
-    visualizer_configure_strips(&state, loaded.strip_setup, *loaded.num_strips);
+  // Watch the sources and every header they include, and rebuild on
+  // background threads
+  FileWatcher *watcher =
+      play_path ? NULL : file_watcher_create(WATCH_DEBOUNCE_MS);
+  BuildJob *builder =
+      watcher ? build_job_create(build_programs, discard_programs, watcher)
+              : NULL;
+  if (builder) {
+    watch_inputs(watcher);
+  } else if (!play_path) {
+    TraceLog(LOG_WARNING, "Could not start the file watcher, hot reload "
+                          "disabled");
   }
 
-  while (!WindowShouldClose()) {
-    // Check for source file changes
-    time_t current_mtime = get_mtime(source_file_path);
-    if (current_mtime != last_mtime) {
-      TraceLog(LOG_INFO, "Source file changed, recompiling...");
-
-      // Small delay for editor to finish writing
-      usleep(100000);
-
-      if (compile_source(source_file_path)) {
-        unload_programs(&loaded);
-        loaded = load_programs();
-
-        // Reconfigure strips from new strip_setup
-        if (loaded.strip_setup && loaded.num_strips) {
-          visualizer_configure_strips(&state, loaded.strip_setup,
-                                      *loaded.num_strips);
-        }
-
-        // Reset to first program if current is out of range
-        if (loaded.num_programs &&
-            state.active_program >= *loaded.num_programs) {
-          state.active_program = 0;
-        }
+  trace_name_thread("main");
+  if (trace_path) {
+    trace_set_enabled(true);
+  }
+
+  for (long frame = 0; !WindowShouldClose() &&
+                      (max_frames < 0 || frame < max_frames);
+       frame++) {
+    uint64_t frame_start = trace_begin();
+
+    // F9 starts a trace, and saves it on the next press
+    if (IsKeyPressed(KEY_F9)) {
+      if (trace_enabled()) {
+        trace_set_enabled(false);
+        trace_save(trace_path ? trace_path : DEFAULT_TRACE_PATH);
+      } else {
+        trace_set_enabled(true);
+        TraceLog(LOG_INFO, "Tracing frame stages, F9 to save");
       }
+    }
 
-      last_mtime = get_mtime(source_file_path);
+    // Check for source file changes (set once the writes have settled).
+    // The build runs in the background and restarts on every new save.
+    if (file_watcher_poll(watcher) && builder) {
+      TraceLog(LOG_INFO, "Source changed, recompiling...");
+      build_job_request(builder);
+    }
+
+    // Swap in a finished build between frames
+    LoadedPrograms *built = build_job_take(builder);
+    if (built) {
+      uint64_t reload_start = trace_begin();
+      reload_programs(&state, &loaded, &retired, built);
+      free(built);
+      trace_end(TRACE_RELOAD, reload_start);
     }
 
     // Update programs in state from loaded programs
     if (loaded.programs && loaded.num_programs && *loaded.num_programs > 0) {
-      state.programs = loaded.programs;
-      state.num_programs = *loaded.num_programs;
+      state.core.programs = loaded.programs;
+      state.core.num_programs = *loaded.num_programs;
 
       // Clamp program index
-      if (state.active_program >= state.num_programs) {
-        state.active_program = 0;
+      if (state.core.active_program >= state.core.num_programs) {
+        state.core.active_program = 0;
       }
-      state.current_program = &state.programs[state.active_program];
+      state.core.current_program =
+          &state.core.programs[state.core.active_program];
     } else {
-      state.programs = NULL;
-      state.num_programs = 0;
-      state.current_program = NULL;
+      state.core.programs = NULL;
+      state.core.num_programs = 0;
+      state.core.current_program = NULL;
     }
 
     visualizer_update(&state);
+
+    // Record the frame; strips laid out differently end the recording
+    if (recorder && !recording_writer_fits(recorder, &state.core)) {
+      TraceLog(LOG_WARNING, "The strips changed, stopped recording");
+      stop_recording(recorder, record_file, record_path);
+      recorder = NULL;
+      record_file = NULL;
+    } else if (record_file && !recorder && state.core.num_strips > 0) {
+      recorder = recording_writer_create(
+          record_file, &state.core,
+          play_path ? recorded_setup : loaded.strip_setup,
+          LED_VIZ_RECORDING_CODEC_PREDICT);
+    }
+    if (recorder &&
+        !recording_writer_add(recorder, &state.core, state.core.time_ms)) {
+      stop_recording(recorder, record_file, record_path);
+      recorder = NULL;
+      record_file = NULL;
+    }
+
     visualizer_draw(&state);
+
+    // The new build has rendered: nothing runs the previous one any more
+    program_library_close(&retired);
+    trace_end(TRACE_FRAME, frame_start);
   }
 
-  unload_programs(&loaded);
+  if (trace_enabled()) {
+    trace_set_enabled(false);
+    trace_save(trace_path ? trace_path : DEFAULT_TRACE_PATH);
+  }
+  if (record_file) {
+    stop_recording(recorder, record_file, record_path);
+  }
+  file_watcher_destroy(watcher);
+  build_job_destroy(builder);
+  program_worker_destroy(state.core.isolated);
+  state.core.isolated = NULL;
+  visualizer_shutdown(&state);
+  unload_programs(&state, &loaded);
+  program_library_close(&retired);
+  recording_unmap(&playback);
+  free(recorded_setup);
   CloseWindow();
+  program_build_shutdown();
   return 0;
 }
@@ -34,6 +34,13 @@ RGB palette_sample(const Palette16 palette, uint8_t index, uint8_t brightness,
   return color;
 }
 
+// ============================================================================
+// Batch color kernels
+// ============================================================================
+
+// Shared with the SDK runtime (include/led_viz_sdk.c)
+#include "led_viz_kernels.h"
+
 // Built-in palettes
 
 const Palette16 PALETTE_RAINBOW = {
@@ -15,6 +15,37 @@ typedef RGB Palette16[16];
 RGB palette_sample(const Palette16 palette, uint8_t index, uint8_t brightness,
                    bool interpolate);
 
+// 256-entry expanded gradient: one precomputed color per palette index
+typedef RGB Palette256[256];
+
+// Expand a palette so that out[i] == palette_sample(palette, i, 255,
+// interpolate)
+void palette_expand(Palette256 out, const Palette16 palette, bool interpolate);
+
+// Batch lookup matching palette_sample() bit-for-bit
+void palette256_sample(const Palette256 palette, const uint8_t *indices,
+                       uint8_t brightness, RGB *out, int count);
+
+// Batch color kernels (vectorized where available, identical results)
+void palette_sample_n(const Palette16 palette, const uint8_t *indices,
+                      uint8_t brightness, bool interpolate, RGB *out,
+                      int count);
+void scale8_n(RGB *leds, int count, uint8_t scale);
+void blend_n(RGB *dst, const RGB *src, int count, uint8_t amount);
+void fade_n(RGB *leds, int count, uint8_t amount);
+
+// Layer blend modes for composite_n() (see led_viz.h)
+typedef enum {
+  LAYER_ALPHA,
+  LAYER_ADD,
+  LAYER_SCREEN,
+  LAYER_MULTIPLY,
+  LAYER_MAX,
+} LayerBlend;
+
+void composite_n(RGB *dst, const RGB *src, int count, LayerBlend mode,
+                 uint8_t opacity);
+
 // Built-in palettes
 extern const Palette16 PALETTE_RAINBOW;
 extern const Palette16 PALETTE_HEAT;
@@ -0,0 +1,96 @@
+#include "perf_stats.h"
+
+#include <math.h>
+#include <string.h>
+
+static const char *part_names[NUM_PERF_PARTS] = {
+    [PERF_PROGRAM] = "program",
+    [PERF_LIGHT_UPLOAD] = "light upload",
+    [PERF_LIGHTING] = "lighting",
+    [PERF_SPHERES] = "spheres",
+    [PERF_RELOAD] = "reload",
+};
+
+void perf_stats_reset(PerfStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+}
+
+void perf_stats_frame(PerfStats *stats) {
+  uint64_t now = trace_now_ns();
+  uint64_t cpu_ns[NUM_TRACE_STAGES], gpu_ns[NUM_TRACE_STAGES];
+  trace_take_totals(cpu_ns, gpu_ns);
+  uint64_t last_ns = stats->last_ns;
+  stats->last_ns = now;
+  if (!last_ns)
+    return;
+
+  // GPU results arrive a few frames late; once there are any, the render
+  // passes are shown as GPU time
+  uint64_t lighting_gpu_ns = gpu_ns[TRACE_GBUFFER] + gpu_ns[TRACE_LIGHTING] +
+                             gpu_ns[TRACE_DEPTH_BLIT];
+  if (lighting_gpu_ns || gpu_ns[TRACE_SPHERES]) {
+    stats->part_gpu[PERF_LIGHTING] = true;
+    stats->part_gpu[PERF_SPHERES] = true;
+  }
+  uint64_t part_ns[NUM_PERF_PARTS] = {
+      [PERF_PROGRAM] = cpu_ns[TRACE_PROGRAM],
+      [PERF_LIGHT_UPLOAD] = cpu_ns[TRACE_LIGHT_UPLOAD],
+      [PERF_LIGHTING] = stats->part_gpu[PERF_LIGHTING]
+                            ? lighting_gpu_ns
+                            : cpu_ns[TRACE_GBUFFER] + cpu_ns[TRACE_LIGHTING] +
+                                  cpu_ns[TRACE_DEPTH_BLIT],
+      [PERF_SPHERES] = stats->part_gpu[PERF_SPHERES]
+                           ? gpu_ns[TRACE_SPHERES]
+                           : cpu_ns[TRACE_SPHERES],
+      [PERF_RELOAD] = cpu_ns[TRACE_RELOAD],
+  };
+
+  int slot = stats->next;
+  stats->frame_ms[slot] = (float)((now - last_ns) / 1e6);
+  for (int p = 0; p < NUM_PERF_PARTS; p++) {
+    stats->part_ms[slot][p] = (float)(part_ns[p] / 1e6);
+  }
+  stats->next = (slot + 1) % PERF_HISTORY;
+  if (stats->count < PERF_HISTORY)
+    stats->count++;
+}
+
+// Nearest-rank percentile of the sorted frame times
+static float rank(const PerfStats *stats, float p) {
+  int i = (int)ceilf(p * stats->count) - 1;
+  return stats->sorted_ms[i < 0 ? 0 : i];
+}
+
+void perf_stats_percentiles(PerfStats *stats, float *p50, float *p95,
+                            float *p99) {
+  if (stats->count == 0) {
+    *p50 = *p95 = *p99 = 0.0f;
+    return;
+  }
+  // Insertion sort: a few hundred mostly similar values, no allocation
+  float *sorted = stats->sorted_ms;
+  for (int i = 0; i < stats->count; i++) {
+    float value = stats->frame_ms[perf_stats_slot(stats, i)];
+    int j = i;
+    while (j > 0 && sorted[j - 1] > value) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = value;
+  }
+  *p50 = rank(stats, 0.50f);
+  *p95 = rank(stats, 0.95f);
+  *p99 = rank(stats, 0.99f);
+}
+
+void perf_stats_means(const PerfStats *stats, float part_ms[NUM_PERF_PARTS]) {
+  for (int p = 0; p < NUM_PERF_PARTS; p++) {
+    float sum = 0.0f;
+    for (int i = 0; i < stats->count; i++) {
+      sum += stats->part_ms[i][p];
+    }
+    part_ms[p] = stats->count ? sum / stats->count : 0.0f;
+  }
+}
+
+const char *perf_part_name(PerfPart part) { return part_names[part]; }
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "trace.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Rolling frame statistics for the perf overlay: frame times and where they
+// went, over the last PERF_HISTORY frames. Everything lives in fixed rings;
+// nothing is allocated per frame. Stage times come from the trace timers
+// (trace_set_stats).
+
+#define PERF_HISTORY 240 // 4 s at 60 fps
+
+// What a frame's time is broken down into
+typedef enum {
+  PERF_PROGRAM,      // program CPU (layers and transitions included)
+  PERF_LIGHT_UPLOAD, // light texture diff and upload
+  PERF_LIGHTING,     // G-buffer, deferred lighting and depth blit
+  PERF_SPHERES,      // forward pass of LED spheres
+  PERF_RELOAD,       // swapping in a hot-reloaded build
+  NUM_PERF_PARTS
+} PerfPart;
+
+typedef struct {
+  float frame_ms[PERF_HISTORY]; // time since the previous frame
+  float part_ms[PERF_HISTORY][NUM_PERF_PARTS];
+  bool part_gpu[NUM_PERF_PARTS]; // timed on the GPU (else CPU submission)
+  int next;                      // slot of the next frame
+  int count;                     // frames in the ring
+  uint64_t last_ns;
+  float sorted_ms[PERF_HISTORY]; // scratch for the percentiles
+} PerfStats;
+
+// Start over (the next frame only sets the start time)
+void perf_stats_reset(PerfStats *stats);
+
+// End a frame: takes the stage times since the last call
+void perf_stats_frame(PerfStats *stats);
+
+// i-th frame in the ring, 0 being the oldest of count
+static inline int perf_stats_slot(const PerfStats *stats, int i) {
+  return (stats->next - stats->count + i + PERF_HISTORY) % PERF_HISTORY;
+}
+
+// Frame time percentiles (nearest rank) over the ring; 0 when empty
+void perf_stats_percentiles(PerfStats *stats, float *p50, float *p95,
+                            float *p99);
+
+// Mean time of each part over the ring
+void perf_stats_means(const PerfStats *stats, float part_ms[NUM_PERF_PARTS]);
+
+const char *perf_part_name(PerfPart part);
@@ -0,0 +1,410 @@
+#include "program_build.h"
+#include "compile_cache.h"
+#include "log.h"
+#include "worker_pool.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#define STAT_MTIME(st) ((st).st_mtimespec)
+#else
+#define STAT_MTIME(st) ((st).st_mtim)
+#endif
+
+// Flags for the SDK object and user code (part of every cache key). No
+// fused multiply-adds, so float math rounds like the ESP32 build does.
+#define COMPILE_FLAGS "-fPIC -O2 -ffp-contract=off " ARCH_FLAGS
+
+// One translation unit of the program
+typedef struct {
+  char path[4096];
+  char **deps; // files its last successful compile read (from the depfile)
+  int num_deps;
+  uint64_t key;      // cache key its object was built for (0 = none)
+  char object[4096]; // that object
+  bool ok;           // current build has an up-to-date object
+  bool compiled;     // current build had to compile it
+} SourceUnit;
+
+static SourceUnit units[MAX_SOURCE_UNITS];
+static int num_units = 0;
+
+static char sdk_header_path[4096];
+static char sdk_source_path[4096];
+static char sdk_object_path[4096]; // prebuilt SDK, or the source as fallback
+static bool sdk_object_temporary;  // session copy (no cache), removed at exit
+static uint64_t sdk_key;           // hash of SDK sources, compiler and flags
+static char temp_prefix[4096];     // per-session prefix for objects
+
+static WorkerPool *compile_pool = NULL;
+
+static const char *compiler(void) {
+  const char *cc = getenv("CC");
+  return cc ? cc : "cc";
+}
+
+// Run a compiler command, logging its output. Returns false on errors or
+// when the build was cancelled.
+static bool run_compiler(BuildJob *job, const char *cmd) {
+  log_info("Compiling: %s", cmd);
+
+  char output[4096];
+  int status = build_job_run_command(job, cmd, output, sizeof(output));
+  if (build_job_cancelled(job)) {
+    log_info("Compilation superseded by a newer save");
+    return false;
+  }
+  if (status < 0) {
+    log_error("Failed to run compiler");
+    return false;
+  }
+  if (status != 0) {
+    log_error("Compilation failed:\n%s", output);
+    return false;
+  }
+
+  if (output[0]) {
+    log_warning("Compiler output:\n%s", output);
+  }
+  return true;
+}
+
+// Compile the SDK once into a PIC object that every reload links against,
+// reusing the cached object when SDK, compiler and flags are unchanged. If
+// that fails, reloads compile the SDK source along with the program.
+static void prepare_sdk_object(void) {
+  const char *cc = compiler();
+  sdk_key = cache_hash_string(CACHE_HASH_INIT, cc);
+  sdk_key = cache_hash_string(sdk_key, COMPILE_FLAGS);
+  cache_hash_file(&sdk_key, sdk_source_path);
+  static const char *const sdk_headers[] = {
+      "led_viz.h",
+      "led_viz_math.h",
+      "led_viz_kernels.h",
+      "led_viz_transitions.h",
+  };
+  for (size_t i = 0; i < sizeof(sdk_headers) / sizeof(sdk_headers[0]); i++) {
+    char header[4096];
+    snprintf(header, sizeof(header), "%s/%s", sdk_header_path, sdk_headers[i]);
+    cache_hash_file(&sdk_key, header);
+  }
+
+  strncpy(sdk_object_path, sdk_source_path, sizeof(sdk_object_path) - 1);
+
+  char cached[4096];
+  compile_cache_path(cached, sizeof(cached), "sdk", sdk_key, ".o");
+  if (access(cached, R_OK) == 0) {
+    strncpy(sdk_object_path, cached, sizeof(sdk_object_path) - 1);
+    log_info("Using cached SDK object %s", cached);
+    return;
+  }
+
+  char object[4096], cmd[8192];
+  snprintf(object, sizeof(object), "%s.sdk.o", temp_prefix);
+  snprintf(cmd, sizeof(cmd), "%s -c " COMPILE_FLAGS " -o '%s' '%s' -I'%s' 2>&1",
+           cc, object, sdk_source_path, sdk_header_path);
+  if (!run_compiler(NULL, cmd)) {
+    log_warning("Could not prebuild the SDK, compiling it with every "
+                "reload");
+    return;
+  }
+
+  if (compile_cache_store("sdk", sdk_key, ".o", object)) {
+    strncpy(sdk_object_path, cached, sizeof(sdk_object_path) - 1);
+    unlink(object);
+  } else {
+    // No cache: keep the session's own copy
+    strncpy(sdk_object_path, object, sizeof(sdk_object_path) - 1);
+    sdk_object_temporary = true;
+  }
+}
+
+// Key shared by everything built this session
+static uint64_t base_key(void) {
+  uint64_t key = cache_hash_string(CACHE_HASH_INIT, compiler());
+  key = cache_hash_string(key, COMPILE_FLAGS);
+  return cache_hash_bytes(key, &sdk_key, sizeof(sdk_key));
+}
+
+// Key of a unit's object: the contents of every file its last compile read
+static uint64_t unit_key(const SourceUnit *unit) {
+  uint64_t key = cache_hash_string(base_key(), unit->path);
+  for (int i = 0; i < unit->num_deps; i++) {
+    key = cache_hash_string(key, unit->deps[i]);
+    if (!cache_hash_file(&key, unit->deps[i])) {
+      key = cache_hash_string(key, "(missing)");
+    }
+  }
+  return key ? key : 1; // 0 means "no object"
+}
+
+static void clear_deps(SourceUnit *unit) {
+  for (int i = 0; i < unit->num_deps; i++) {
+    free(unit->deps[i]);
+  }
+  free(unit->deps);
+  unit->deps = NULL;
+  unit->num_deps = 0;
+}
+
+static void add_dep(SourceUnit *unit, const char *path, int *capacity) {
+  char *resolved = realpath(path, NULL);
+  if (!resolved)
+    return;
+  for (int i = 0; i < unit->num_deps; i++) {
+    if (strcmp(unit->deps[i], resolved) == 0) {
+      free(resolved);
+      return;
+    }
+  }
+
+  if (unit->num_deps == *capacity) {
+    int grown = *capacity ? *capacity * 2 : 16;
+    char **deps = realloc(unit->deps, grown * sizeof(*deps));
+    if (!deps) {
+      free(resolved);
+      return;
+    }
+    unit->deps = deps;
+    *capacity = grown;
+  }
+  unit->deps[unit->num_deps++] = resolved;
+}
+
+// Replace the unit's dependencies with the prerequisites of a Make-style
+// depfile ("obj.o: a.c b.h \<newline> c.h", spaces escaped as "\ ")
+static void read_depfile(SourceUnit *unit, const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return;
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *text = size >= 0 ? malloc(size + 1) : NULL;
+  if (!text) {
+    free(text);
+    fclose(fp);
+    return;
+  }
+  size_t len = fread(text, 1, size, fp);
+  text[len] = '\0';
+  fclose(fp);
+
+  clear_deps(unit);
+  int capacity = 0;
+  char token[4096];
+  size_t token_len = 0;
+  char *p = strchr(text, ':');
+  for (p = p ? p + 1 : text + len;; p++) {
+    char c = *p;
+    bool escaped = false;
+    if (c == '\\' && p[1] == '\n') {
+      p++;
+      c = ' ';
+    } else if (c == '\\' && p[1] == '\r' && p[2] == '\n') {
+      p += 2;
+      c = ' ';
+    } else if ((c == '\\' && (p[1] == ' ' || p[1] == '#')) ||
+               (c == '$' && p[1] == '$')) {
+      c = *++p;
+      escaped = true;
+    }
+
+    if (!escaped && (c == '\0' || isspace((unsigned char)c))) {
+      if (token_len > 0) {
+        token[token_len] = '\0';
+        add_dep(unit, token, &capacity);
+        token_len = 0;
+      }
+      if (c == '\0')
+        break;
+    } else if (token_len < sizeof(token) - 1) {
+      token[token_len++] = c;
+    }
+  }
+  free(text);
+}
+
+static bool modified_since(const char *path, struct timespec since) {
+  struct stat st;
+  if (stat(path, &st) != 0)
+    return true;
+  struct timespec mtime = STAT_MTIME(st);
+  return mtime.tv_sec > since.tv_sec ||
+         (mtime.tv_sec == since.tv_sec && mtime.tv_nsec >= since.tv_nsec);
+}
+
+// Bring one unit's object up to date (WorkerTask, ctx is the BuildJob)
+static void build_unit(void *ctx, int index) {
+  BuildJob *job = ctx;
+  SourceUnit *unit = &units[index];
+  unit->ok = false;
+  unit->compiled = false;
+
+  // Dependencies are known once the unit has compiled: reuse its object,
+  // or one cached from identical inputs
+  if (unit->num_deps > 0) {
+    uint64_t key = unit_key(unit);
+    if (key == unit->key && access(unit->object, R_OK) == 0) {
+      unit->ok = true;
+      return;
+    }
+    char cached[4096];
+    compile_cache_path(cached, sizeof(cached), "object", key, ".o");
+    if (access(cached, R_OK) == 0) {
+      unit->key = key;
+      strncpy(unit->object, cached, sizeof(unit->object) - 1);
+      unit->ok = true;
+      return;
+    }
+  }
+
+  char object[4096], depfile[4096], cmd[16384];
+  snprintf(object, sizeof(object), "%s.%d.o", temp_prefix, index);
+  snprintf(depfile, sizeof(depfile), "%s.%d.d", temp_prefix, index);
+  snprintf(cmd, sizeof(cmd),
+           "%s -c " COMPILE_FLAGS " -MD -MF '%s' -o '%s' '%s' -I'%s' 2>&1",
+           compiler(), depfile, object, unit->path, sdk_header_path);
+
+  struct timespec start;
+  clock_gettime(CLOCK_REALTIME, &start);
+  unit->compiled = true;
+  if (!run_compiler(job, cmd)) {
+    // Keep the previous dependencies so fixing any of them rebuilds
+    unlink(depfile);
+    return;
+  }
+  read_depfile(unit, depfile);
+  unlink(depfile);
+
+  // Only cache the object if no input changed while it compiled; otherwise
+  // the key (from current contents) would not describe what was compiled
+  bool settled = true;
+  for (int i = 0; i < unit->num_deps; i++) {
+    settled = settled && !modified_since(unit->deps[i], start);
+  }
+  unit->key = settled ? unit_key(unit) : 0;
+  strncpy(unit->object, object, sizeof(unit->object) - 1);
+  if (settled && compile_cache_store("object", unit->key, ".o", object)) {
+    compile_cache_path(unit->object, sizeof(unit->object), "object",
+                       unit->key, ".o");
+  }
+  unit->ok = true;
+}
+
+void program_build_init(const char *header_path, const char *source_path) {
+  strncpy(sdk_header_path, header_path, sizeof(sdk_header_path) - 1);
+  strncpy(sdk_source_path, source_path, sizeof(sdk_source_path) - 1);
+  snprintf(temp_prefix, sizeof(temp_prefix), "/tmp/led_viz_obj.%d",
+           (int)getpid());
+
+  compile_cache_init();
+  prepare_sdk_object();
+  compile_pool = worker_pool_create(worker_pool_default_size());
+}
+
+bool program_build_add_source(const char *path) {
+  if (num_units >= MAX_SOURCE_UNITS)
+    return false;
+  SourceUnit *unit = &units[num_units++];
+  memset(unit, 0, sizeof(*unit));
+  strncpy(unit->path, path, sizeof(unit->path) - 1);
+  return true;
+}
+
+bool program_build_run(BuildJob *job, const char *lib_path,
+                       BuildStats *stats) {
+  *stats = (BuildStats){.total = num_units};
+
+  worker_pool_run(compile_pool, build_unit, job, num_units);
+
+  bool ok = num_units > 0;
+  uint64_t key = base_key();
+  for (int i = 0; i < num_units; i++) {
+    ok = ok && units[i].ok;
+    stats->compiled += units[i].compiled;
+    key = cache_hash_bytes(key, &units[i].key, sizeof(units[i].key));
+  }
+  if (!ok || build_job_cancelled(job))
+    return false;
+
+  // Same objects as an earlier build: reuse its library
+  bool keyed = true;
+  for (int i = 0; i < num_units; i++) {
+    keyed = keyed && units[i].key != 0;
+  }
+  if (keyed && compile_cache_fetch("programs", key, LIB_EXT, lib_path)) {
+    return true;
+  }
+
+  // Link the objects with the SDK into a shared library
+  size_t size = 4096 + strlen(sdk_object_path) + strlen(lib_path);
+  for (int i = 0; i < num_units; i++) {
+    size += strlen(units[i].object) + 3;
+  }
+  char *cmd = malloc(size);
+  if (!cmd)
+    return false;
+  int len = snprintf(cmd, size, "%s -shared " COMPILE_FLAGS " -o '%s'",
+                     compiler(), lib_path);
+  for (int i = 0; i < num_units; i++) {
+    len += snprintf(cmd + len, size - len, " '%s'", units[i].object);
+  }
+  snprintf(cmd + len, size - len, " '%s' -I'%s' -lm 2>&1", sdk_object_path,
+           sdk_header_path);
+
+  bool linked = run_compiler(job, cmd);
+  free(cmd);
+  if (!linked)
+    return false;
+
+  stats->linked = true;
+  if (keyed) {
+    compile_cache_store("programs", key, LIB_EXT, lib_path);
+  }
+  log_info("Compilation successful");
+  return true;
+}
+
+int program_build_inputs(const char **paths, int max) {
+  int count = 0;
+  for (int i = 0; i < num_units; i++) {
+    const SourceUnit *unit = &units[i];
+    // The source itself may not have compiled yet
+    for (int d = -1; d < unit->num_deps && count < max; d++) {
+      const char *path = d < 0 ? unit->path : unit->deps[d];
+      bool seen = false;
+      for (int j = 0; j < count && !seen; j++) {
+        seen = strcmp(paths[j], path) == 0;
+      }
+      if (!seen) {
+        paths[count++] = path;
+      }
+    }
+  }
+  return count;
+}
+
+void program_build_shutdown(void) {
+  worker_pool_destroy(compile_pool);
+  compile_pool = NULL;
+
+  char object[4096];
+  for (int i = 0; i < num_units; i++) {
+    snprintf(object, sizeof(object), "%s.%d.o", temp_prefix, i);
+    unlink(object);
+    clear_deps(&units[i]);
+  }
+  num_units = 0;
+
+  if (sdk_object_temporary) {
+    unlink(sdk_object_path);
+  }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "build_job.h"
+
+#include <stdbool.h>
+
+#ifdef __APPLE__
+#define LIB_EXT ".dylib"
+#define ARCH_FLAGS ""
+#else
+#define LIB_EXT ".so"
+// Let the SDK batch kernels use the widest SIMD the host supports
+#define ARCH_FLAGS "-march=native"
+#endif
+
+// Builds the user's program (one or more .c files) into a shared library.
+// Each source is compiled to its own object with a depfile, so a rebuild
+// only recompiles units whose source or included headers changed, runs those
+// compiles in parallel and then links them with the prebuilt SDK object.
+// Objects and libraries are kept in the compile cache.
+
+#define MAX_SOURCE_UNITS 64
+#define MAX_BUILD_INPUTS 1024
+
+typedef struct {
+  int compiled; // units compiled by this build
+  int total;    // units in the program
+  bool linked;  // false if the library came from the cache
+} BuildStats;
+
+// Set up the cache and prebuild the SDK object. Call once before building.
+void program_build_init(const char *sdk_header_path,
+                        const char *sdk_source_path);
+
+// Add a source file (absolute path) to the program. False when full.
+bool program_build_add_source(const char *path);
+
+// Build lib_path from the current sources. job may be NULL to build
+// synchronously; returns false on errors or when cancelled.
+bool program_build_run(BuildJob *job, const char *lib_path, BuildStats *stats);
+
+// Every file the last build read: the sources plus the headers listed in
+// their depfiles. Pointers stay valid until the next build; call from the
+// thread that runs builds.
+int program_build_inputs(const char **paths, int max);
+
+// Remove temporary files and stop the compile workers
+void program_build_shutdown(void);
@@ -0,0 +1,205 @@
+#include "program_library.h"
+#include "log.h"
+#include "program_build.h"
+
+#include <dlfcn.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+// Paths resolved at startup
+static char exe_path[4096];
+static char exe_dir[4096];
+static char sdk_header_path[4096];
+static char sdk_source_path[4096];
+static char compiled_lib_prefix[4096];
+
+static void resolve_exe_dir(void) {
+  char exe[4096];
+  bool found = false;
+
+#ifdef __APPLE__
+  uint32_t size = sizeof(exe);
+  if (_NSGetExecutablePath(exe, &size) == 0) {
+    char *resolved = realpath(exe, NULL);
+    if (resolved) {
+      strncpy(exe, resolved, sizeof(exe) - 1);
+      free(resolved);
+    }
+    found = true;
+  }
+#else
+  ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if (len > 0) {
+    exe[len] = '\0';
+    found = true;
+  }
+#endif
+
+  if (found) {
+    strncpy(exe_path, exe, sizeof(exe_path) - 1);
+    char *dir = dirname(exe);
+    strncpy(exe_dir, dir, sizeof(exe_dir) - 1);
+  } else {
+    strncpy(exe_dir, ".", sizeof(exe_dir) - 1);
+  }
+
+  // SDK files are in sdk/ subdirectory next to executable
+  snprintf(sdk_header_path, sizeof(sdk_header_path), "%s/sdk", exe_dir);
+  snprintf(sdk_source_path, sizeof(sdk_source_path), "%s/sdk/led_viz_sdk.c",
+           exe_dir);
+
+  // Compiled libraries go in temp, one file per build (see
+  // program_library_next_path)
+  snprintf(compiled_lib_prefix, sizeof(compiled_lib_prefix),
+           "/tmp/led_viz_user.%d", (int)getpid());
+}
+
+bool program_library_setup(const char *const *sources, int num_sources) {
+  resolve_exe_dir();
+
+  // Check SDK files exist
+  if (access(sdk_source_path, R_OK) != 0) {
+    fprintf(stderr, "Error: SDK not found at %s\n", sdk_header_path);
+    fprintf(stderr, "Make sure the 'sdk' folder is next to the executable.\n");
+    return false;
+  }
+
+  // Prebuild the SDK, then add the program from absolute source paths
+  program_build_init(sdk_header_path, sdk_source_path);
+  for (int i = 0; i < num_sources; i++) {
+    char *resolved = realpath(sources[i], NULL);
+    if (!resolved) {
+      fprintf(stderr, "Error: Cannot find source file: %s\n", sources[i]);
+      return false;
+    }
+    program_build_add_source(resolved);
+    free(resolved);
+  }
+  return true;
+}
+
+const char *program_library_exe_path(void) { return exe_path; }
+
+// A fresh path for every build: dlopen returns the cached handle for a path
+// that is already loaded, and the next library is opened while the current
+// one is still in use.
+void program_library_next_path(char *path, size_t size) {
+  static unsigned build_count = 0;
+  snprintf(path, size, "%s.%u%s", compiled_lib_prefix, build_count++,
+           LIB_EXT);
+}
+
+static void *program_symbol(const LoadedPrograms *loaded, const char *name) {
+  return dlsym(loaded->handle, name);
+}
+
+// Unload a build and remove its library file
+static void release_handle(LoadedPrograms *loaded) {
+  dlclose(loaded->handle);
+  unlink(loaded->path);
+  loaded->handle = NULL;
+}
+
+// Look up and check the exports of a freshly built program. Touches no
+// core state, so it runs on the build thread before the build goes live.
+static bool resolve_programs(LoadedPrograms *loaded) {
+  loaded->programs = program_symbol(loaded, "programs");
+  loaded->num_programs = program_symbol(loaded, "NUM_PROGRAMS");
+  loaded->strip_setup = program_symbol(loaded, "strip_setup");
+  loaded->num_strips = program_symbol(loaded, "NUM_STRIPS");
+  loaded->layer_setup = program_symbol(loaded, "layer_setup");
+  loaded->num_layers = program_symbol(loaded, "NUM_LAYERS");
+
+  if (!loaded->programs || !loaded->num_programs) {
+    log_error("Missing symbols. Make sure your file defines:\n"
+              "  const Program programs[] = { ... };\n"
+              "  const int NUM_PROGRAMS = ...;");
+    release_handle(loaded);
+    return false;
+  }
+
+  if (!loaded->strip_setup || !loaded->num_strips) {
+    log_error("Missing strip setup. Make sure your file defines:\n"
+              "  const StripDef strip_setup[] = { ... };\n"
+              "  const int NUM_STRIPS = ...;");
+    release_handle(loaded);
+    return false;
+  }
+
+  // Set strip setup for accessor functions in loaded library (builds its
+  // matrix and coordinate tables ahead of the swap)
+  loaded->set_strip_setup = program_symbol(loaded, "_led_viz_set_strip_setup");
+  if (loaded->set_strip_setup) {
+    loaded->set_strip_setup(loaded->strip_setup, *loaded->num_strips);
+  }
+
+  loaded->set_framebuffer = program_symbol(loaded, "_led_viz_set_framebuffer");
+  loaded->set_touched_flags =
+      program_symbol(loaded, "_led_viz_set_touched_flags");
+  loaded->set_palette256 = program_symbol(loaded, "_led_viz_set_palette256");
+  return true;
+}
+
+bool program_library_open(LoadedPrograms *loaded, const char *lib_path) {
+  *loaded = (LoadedPrograms){0};
+  strncpy(loaded->path, lib_path, sizeof(loaded->path) - 1);
+
+  loaded->handle = dlopen(lib_path, RTLD_NOW);
+  if (!loaded->handle) {
+    log_error("dlopen failed: %s", dlerror());
+    unlink(lib_path);
+    return false;
+  }
+  return resolve_programs(loaded);
+}
+
+void program_library_attach(CoreState *core, const LoadedPrograms *loaded) {
+  // Point the library's direct framebuffer access at the core's pixels
+  // (core_configure_strips hands it the new ones when the strips change)
+  if (loaded->set_framebuffer) {
+    loaded->set_framebuffer(core->framebuffer, core->stride);
+  }
+  core->set_program_framebuffer = loaded->set_framebuffer;
+
+  // Let direct span access flag strips for the light texture's change check
+  if (loaded->set_touched_flags) {
+    loaded->set_touched_flags(core->strip_touched);
+  }
+  core->set_program_touched_flags = loaded->set_touched_flags;
+
+  // Share the expanded palette (rebuilt in place when the palette changes)
+  if (loaded->set_palette256) {
+    loaded->set_palette256(&core->current_palette256);
+  }
+
+  log_info("Loaded %d program(s) with %d strip(s)", *loaded->num_programs,
+           *loaded->num_strips);
+}
+
+void program_library_close(LoadedPrograms *loaded) {
+  if (loaded->handle) {
+    release_handle(loaded);
+    loaded->programs = NULL;
+    loaded->num_programs = NULL;
+    loaded->strip_setup = NULL;
+    loaded->num_strips = NULL;
+    loaded->layer_setup = NULL;
+    loaded->num_layers = NULL;
+  }
+}
+
+const Program *program_library_find(const LoadedPrograms *loaded,
+                                    const char *name) {
+  for (int i = 0; name && i < *loaded->num_programs; i++) {
+    if (strcmp(loaded->programs[i].name, name) == 0)
+      return &loaded->programs[i];
+  }
+  return NULL;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "core.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Finding the SDK next to the executable, and opening a compiled program
+// library: its exports are looked up and checked, then attached to the core.
+// Shared by the visualizer and the headless runner.
+
+typedef struct {
+  void *handle;
+  char path[4096]; // compiled library, removed on unload
+  const Program *programs;
+  const int *num_programs;
+  const StripDef *strip_setup;
+  const int *num_strips;
+  const LayerDef *layer_setup; // optional
+  const int *num_layers;
+  // SDK hooks, looked up ahead of the swap
+  void (*set_strip_setup)(const StripDef *, int);
+  void (*set_framebuffer)(RGB *, int);
+  void (*set_touched_flags)(uint8_t *);
+  void (*set_palette256)(const Palette256 *);
+} LoadedPrograms;
+
+// Locate this executable and its sdk/ folder, prebuild the SDK and add the
+// sources (made absolute) to the program build. Prints an error and returns
+// false if the SDK or a source is missing.
+bool program_library_setup(const char *const *sources, int num_sources);
+
+// This executable (empty if it could not be found)
+const char *program_library_exe_path(void);
+
+// A fresh path for a compiled library. Only call from one thread at a time.
+void program_library_next_path(char *path, size_t size);
+
+// Open a compiled library and check its exports (the file is removed if it
+// doesn't load). Touches no core state, so it may run on a build thread.
+bool program_library_open(LoadedPrograms *loaded, const char *lib_path);
+
+// Point the library's SDK hooks (framebuffer, touched flags, palette) at the
+// core (render thread only)
+void program_library_attach(CoreState *core, const LoadedPrograms *loaded);
+
+// Close a library nothing references any more (no-op if not open)
+void program_library_close(LoadedPrograms *loaded);
+
+// The program named name, or NULL
+const Program *program_library_find(const LoadedPrograms *loaded,
+                                    const char *name);
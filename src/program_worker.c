@@ -0,0 +1,445 @@
+#include "program_worker.h"
+#include "core.h"
+#include "log.h"
+#include "programs.h"
+#include "worker_pool.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+extern char **environ;
+
+// Frames in the ring: the one being shown, the one being rendered and one
+// spare, so the worker never writes a frame the render thread may read
+#define FRAME_SLOTS 3
+
+// A worker that keeps dying is restarted at most this often
+#define WORKER_RESTART_MS 1000.0
+
+// Where the worker finds the shared memory and the request pipe
+#define WORKER_SHM_FD 3
+#define WORKER_REQUEST_FD 4
+
+// Lives at the start of the shared memory, followed by FRAME_SLOTS frames
+typedef struct {
+  // Request, written by the render thread while the worker is idle
+  double time_ms;
+  int program;
+  Palette16 palette;
+  _Atomic uint64_t requested; // number of the frame to render
+  _Atomic uint64_t done;      // last finished frame
+  _Atomic uint32_t seq[FRAME_SLOTS]; // per slot, odd while it is written
+} WorkerShared;
+
+struct ProgramWorker {
+  char exe_path[4096];
+  char lib_path[4096]; // library the worker runs (empty before start)
+  int num_pixels;
+  int stride; // LEDs per strip in a frame
+  double deadline_ms;
+
+  int shm_fd;
+  WorkerShared *shared;
+  size_t shared_size;
+
+  pid_t pid;          // 0 while no worker runs
+  int request_fd;     // write end of the request pipe
+  int program;        // program the next worker starts with
+  uint64_t requested; // frames requested from this worker
+  uint64_t copied;    // last frame copied out
+  double request_ms;  // when the pending request went out
+  double start_ms;    // when this worker was started
+  double restart_ms;  // earliest restart after the worker stopped
+};
+
+static double monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static size_t shared_size(int num_pixels) {
+  return sizeof(WorkerShared) + (size_t)FRAME_SLOTS * num_pixels * sizeof(RGB);
+}
+
+static RGB *frame_slot(WorkerShared *shared, int num_pixels, uint64_t frame) {
+  return (RGB *)(shared + 1) + (frame % FRAME_SLOTS) * num_pixels;
+}
+
+// Move fd out of the way of the fixed worker descriptors (close-on-exec)
+static int high_fd(int fd) {
+  if (fd < 0)
+    return fd;
+  int moved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+  close(fd);
+  return moved;
+}
+
+// Size the shared memory for frames of num_pixels LEDs (no worker may have
+// it mapped). False if it can't be.
+static bool map_shared(ProgramWorker *worker, int num_pixels) {
+  if (worker->shared) {
+    munmap(worker->shared, worker->shared_size);
+    worker->shared = NULL;
+  }
+  worker->num_pixels = 0;
+  worker->shared_size = shared_size(num_pixels);
+  if (ftruncate(worker->shm_fd, (off_t)worker->shared_size) != 0) {
+    log_error("Program worker: no shared memory");
+    return false;
+  }
+  worker->shared = mmap(NULL, worker->shared_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, worker->shm_fd, 0);
+  if (worker->shared == MAP_FAILED) {
+    worker->shared = NULL;
+    log_error("Program worker: cannot map shared memory");
+    return false;
+  }
+  worker->num_pixels = num_pixels;
+  return true;
+}
+
+ProgramWorker *program_worker_create(const char *exe_path,
+                                     double deadline_ms) {
+  ProgramWorker *worker = calloc(1, sizeof(*worker));
+  if (!worker)
+    return NULL;
+  strncpy(worker->exe_path, exe_path, sizeof(worker->exe_path) - 1);
+  worker->deadline_ms = deadline_ms;
+  worker->request_fd = -1;
+
+  // Anonymous shared memory: unlinked right away, handed to workers by fd
+  char name[64];
+  snprintf(name, sizeof(name), "/led_viz.%d", (int)getpid());
+  worker->shm_fd = high_fd(shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600));
+  shm_unlink(name);
+  if (worker->shm_fd < 0) {
+    log_error("Program worker: no shared memory");
+    program_worker_destroy(worker);
+    return NULL;
+  }
+  // Frames are sized when the worker starts on a strip setup
+  if (!map_shared(worker, 0)) {
+    program_worker_destroy(worker);
+    return NULL;
+  }
+
+  // A dead worker must not take the visualizer down with its pipe
+  signal(SIGPIPE, SIG_IGN);
+  return worker;
+}
+
+// Kill the running worker, if any
+static void stop_worker(ProgramWorker *worker) {
+  if (worker->request_fd >= 0) {
+    close(worker->request_fd);
+    worker->request_fd = -1;
+  }
+  if (worker->pid > 0) {
+    kill(worker->pid, SIGKILL);
+    waitpid(worker->pid, NULL, 0);
+    worker->pid = 0;
+  }
+  // Don't hammer a program that fails right away
+  worker->restart_ms = worker->start_ms + WORKER_RESTART_MS;
+}
+
+static void spawn_worker(ProgramWorker *worker) {
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0)
+    return;
+  int request_read = high_fd(pipe_fds[0]);
+  worker->request_fd = high_fd(pipe_fds[1]);
+
+  // Fresh frame counters and seqlocks (a killed worker may have left a slot
+  // half written)
+  WorkerShared *shared = worker->shared;
+  atomic_store(&shared->requested, 0);
+  atomic_store(&shared->done, 0);
+  for (int i = 0; i < FRAME_SLOTS; i++) {
+    atomic_store(&shared->seq[i], 0);
+  }
+  worker->requested = 0;
+  worker->copied = 0;
+
+  char pixels_arg[16], stride_arg[16];
+  snprintf(pixels_arg, sizeof(pixels_arg), "%d", worker->num_pixels);
+  snprintf(stride_arg, sizeof(stride_arg), "%d", worker->stride);
+  char *argv[] = {worker->exe_path, "--worker", worker->lib_path, pixels_arg,
+                  stride_arg, NULL};
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, worker->shm_fd, WORKER_SHM_FD);
+  posix_spawn_file_actions_adddup2(&actions, request_read, WORKER_REQUEST_FD);
+  int err = posix_spawn(&worker->pid, worker->exe_path, &actions, NULL, argv,
+                        environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(request_read);
+
+  worker->start_ms = monotonic_ms();
+  if (err != 0) {
+    log_error("Program worker: cannot start %s", worker->exe_path);
+    worker->pid = 0;
+    close(worker->request_fd);
+    worker->request_fd = -1;
+  }
+}
+
+void program_worker_start(ProgramWorker *worker, const char *lib_path,
+                          int program, int num_strips, int stride) {
+  stop_worker(worker);
+  worker->lib_path[0] = '\0';
+  if (num_strips * stride != worker->num_pixels &&
+      !map_shared(worker, num_strips * stride))
+    return; // stays stopped
+  strncpy(worker->lib_path, lib_path, sizeof(worker->lib_path) - 1);
+  worker->program = program;
+  worker->stride = stride;
+  spawn_worker(worker);
+}
+
+// Hand the next frame to the (idle) worker
+static void send_request(ProgramWorker *worker, double time_ms, int program,
+                         const Palette16 *palette) {
+  WorkerShared *shared = worker->shared;
+  shared->time_ms = time_ms;
+  shared->program = program;
+  memcpy(shared->palette, *palette, sizeof(Palette16));
+  atomic_store_explicit(&shared->requested, ++worker->requested,
+                        memory_order_release);
+
+  char wake = 1;
+  if (write(worker->request_fd, &wake, 1) == 1) {
+    worker->request_ms = monotonic_ms();
+  }
+}
+
+// Copy a finished frame out of the ring. False if the worker touched the
+// slot meanwhile (the copy may then be torn; the next frame replaces it).
+static bool read_frame(ProgramWorker *worker, uint64_t frame, RGB *out) {
+  _Atomic uint32_t *seq = &worker->shared->seq[frame % FRAME_SLOTS];
+  uint32_t before = atomic_load_explicit(seq, memory_order_acquire);
+  if (before & 1)
+    return false;
+  memcpy(out, frame_slot(worker->shared, worker->num_pixels, frame),
+         worker->num_pixels * sizeof(RGB));
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(seq, memory_order_relaxed) == before;
+}
+
+bool program_worker_sync(ProgramWorker *worker, RGB *framebuffer,
+                         double time_ms, int program,
+                         const Palette16 *palette) {
+  double now = monotonic_ms();
+  worker->program = program;
+
+  if (worker->pid > 0) {
+    int status;
+    if (waitpid(worker->pid, &status, WNOHANG) == worker->pid) {
+      if (WIFSIGNALED(status)) {
+        log_error("Program worker crashed (%s), restarting",
+                  strsignal(WTERMSIG(status)));
+      } else {
+        log_error("Program worker exited (status %d), restarting",
+                  WEXITSTATUS(status));
+      }
+      worker->pid = 0;
+      stop_worker(worker);
+    }
+  }
+
+  if (worker->pid <= 0) {
+    if (worker->lib_path[0] && now >= worker->restart_ms) {
+      spawn_worker(worker);
+    }
+    if (worker->pid <= 0)
+      return false;
+  }
+
+  uint64_t done = atomic_load_explicit(&worker->shared->done,
+                                       memory_order_acquire);
+  if (done != worker->requested) {
+    if (now - worker->request_ms > worker->deadline_ms) {
+      log_error("Program worker missed its %.0f ms deadline, restarting",
+                worker->deadline_ms);
+      stop_worker(worker);
+    }
+    return false;
+  }
+
+  // The worker is idle: start the next frame, then copy out the finished
+  // one while it renders
+  send_request(worker, time_ms, program, palette);
+  if (done <= worker->copied || !read_frame(worker, done, framebuffer))
+    return false;
+  worker->copied = done;
+  return true;
+}
+
+void program_worker_destroy(ProgramWorker *worker) {
+  if (!worker)
+    return;
+  stop_worker(worker);
+  if (worker->shared) {
+    munmap(worker->shared, worker->shared_size);
+  }
+  if (worker->shm_fd >= 0) {
+    close(worker->shm_fd);
+  }
+  free(worker);
+}
+
+// Worker process
+
+static RGB *worker_pixels = NULL;
+static int worker_stride = 0;
+
+static void worker_pixel(int strip, int led, uint8_t *r, uint8_t *g,
+                         uint8_t *b) {
+  RGB *px = &worker_pixels[strip * worker_stride + led];
+  if (r && g && b) {
+    px->r = *r;
+    px->g = *g;
+    px->b = *b;
+  }
+  *r = px->r;
+  *g = px->g;
+  *b = px->b;
+}
+
+typedef struct {
+  const Program *program;
+  double time_ms;
+  const RGB *palette;
+} WorkerStripTask;
+
+static void run_worker_strip(void *ctx, int strip) {
+  const WorkerStripTask *task = ctx;
+  task->program->update_strip(strip, task->time_ms, worker_pixel,
+                              task->palette);
+}
+
+// Publish a frame under its slot's seqlock
+static void write_frame(WorkerShared *shared, int num_pixels, uint64_t frame,
+                        const RGB *pixels) {
+  _Atomic uint32_t *seq = &shared->seq[frame % FRAME_SLOTS];
+  uint32_t start = atomic_load_explicit(seq, memory_order_relaxed);
+  atomic_store_explicit(seq, start + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  memcpy(frame_slot(shared, num_pixels, frame), pixels,
+         num_pixels * sizeof(RGB));
+  atomic_store_explicit(seq, start + 2, memory_order_release);
+}
+
+int program_worker_main(int argc, char *argv[]) {
+  if (argc < 5)
+    return 1;
+  const char *lib_path = argv[2];
+  int num_pixels = atoi(argv[3]);
+  worker_stride = atoi(argv[4]);
+
+#ifdef __linux__
+  // Don't outlive the visualizer, even stuck in a loop
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+
+  WorkerShared *shared = mmap(NULL, shared_size(num_pixels),
+                              PROT_READ | PROT_WRITE, MAP_SHARED,
+                              WORKER_SHM_FD, 0);
+  if (shared == MAP_FAILED)
+    return 1;
+
+  void *handle = dlopen(lib_path, RTLD_NOW);
+  if (!handle) {
+    log_error("Program worker: dlopen failed: %s", dlerror());
+    return 1;
+  }
+  const Program *programs = dlsym(handle, "programs");
+  const int *num_programs = dlsym(handle, "NUM_PROGRAMS");
+  const StripDef *strip_setup = dlsym(handle, "strip_setup");
+  const int *num_strips = dlsym(handle, "NUM_STRIPS");
+  if (!programs || !num_programs || *num_programs <= 0 || !strip_setup ||
+      !num_strips || *num_strips * worker_stride != num_pixels)
+    return 1;
+
+  // (+ 1: a setup without strips still gets buffers)
+  worker_pixels = calloc(num_pixels + 1, sizeof(RGB));
+  uint8_t *touched = calloc(*num_strips + 1, 1);
+  static Palette16 palette;
+  static Palette256 palette256;
+  if (!worker_pixels || !touched)
+    return 1;
+
+  // Same hookup as in the visualizer, against the worker's own buffers
+  void (*set_strip_setup)(const StripDef *, int) =
+      dlsym(handle, "_led_viz_set_strip_setup");
+  void (*set_framebuffer)(RGB *, int) =
+      dlsym(handle, "_led_viz_set_framebuffer");
+  void (*set_touched_flags)(uint8_t *) =
+      dlsym(handle, "_led_viz_set_touched_flags");
+  void (*set_palette256)(const Palette256 *) =
+      dlsym(handle, "_led_viz_set_palette256");
+  if (set_strip_setup)
+    set_strip_setup(strip_setup, *num_strips);
+  if (set_framebuffer)
+    set_framebuffer(worker_pixels, worker_stride);
+  if (set_touched_flags)
+    set_touched_flags(touched);
+  if (set_palette256)
+    set_palette256(&palette256);
+
+  WorkerPool *pool = worker_pool_create(worker_pool_default_size());
+  const Program *current = NULL;
+  char wake;
+  while (read(WORKER_REQUEST_FD, &wake, 1) == 1) {
+    uint64_t frame =
+        atomic_load_explicit(&shared->requested, memory_order_acquire);
+    int index = shared->program;
+    const Program *program =
+        &programs[index >= 0 && index < *num_programs ? index : 0];
+    if (program != current) {
+      if (current && current->cleanup)
+        current->cleanup();
+      if (program->init)
+        program->init();
+      current = program;
+    }
+    if (memcmp(palette, shared->palette, sizeof(palette)) != 0) {
+      memcpy(palette, shared->palette, sizeof(palette));
+      palette_expand(palette256, palette, true);
+    }
+
+    if (program->update_strip) {
+      WorkerStripTask task = {program, shared->time_ms, palette};
+      worker_pool_run(pool, run_worker_strip, &task, *num_strips);
+    } else if (program->update) {
+      program->update(shared->time_ms, worker_pixel, palette);
+    }
+
+    write_frame(shared, num_pixels, frame, worker_pixels);
+    atomic_store_explicit(&shared->done, frame, memory_order_release);
+  }
+
+  // The visualizer closed the pipe
+  if (current && current->cleanup)
+    current->cleanup();
+  worker_pool_destroy(pool);
+  return 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "palette.h"
+
+#include <stdbool.h>
+
+// Runs the loaded programs in a child process, so a crash or an endless loop
+// in user code costs a restart instead of the visualizer. The worker renders
+// into a ring of frames in shared memory (each guarded by a seqlock) and is
+// paced by the render thread: one request per finished frame, sent over a
+// pipe. A worker that dies is restarted; one that misses the per-frame
+// deadline is killed and restarted.
+
+typedef struct ProgramWorker ProgramWorker;
+
+// Set up the shared memory. exe_path is this executable, started again with
+// --worker. Returns NULL on failure.
+ProgramWorker *program_worker_create(const char *exe_path,
+                                     double deadline_ms);
+
+// (Re)start the worker on a compiled library, running program first, with
+// frames laid out like the core's framebuffer (num_strips rows of stride
+// LEDs). The file must stay in place while the worker runs.
+void program_worker_start(ProgramWorker *worker, const char *lib_path,
+                          int program, int num_strips, int stride);
+
+// Once per rendered frame: copy the latest finished frame into framebuffer
+// (returns true if there was a new one) and ask for the next at time_ms.
+// Also restarts a worker that crashed or overran its deadline.
+bool program_worker_sync(ProgramWorker *worker, RGB *framebuffer,
+                         double time_ms, int program,
+                         const Palette16 *palette);
+
+// Stop the worker and release the shared memory
+void program_worker_destroy(ProgramWorker *worker);
+
+// Entry point of the worker process (argv as passed to main)
+int program_worker_main(int argc, char *argv[]);
@@ -1,6 +1,6 @@
 #include "programs.h"
-#include <math.h>
 #include <stddef.h>
+#include <string.h>
 
 // Strip setup - 4 strips evenly spaced
 const StripDef strip_setup[] = {
@@ -11,104 +11,121 @@ const StripDef strip_setup[] = {
 };
 const int NUM_STRIPS = sizeof(strip_setup) / sizeof(strip_setup[0]);
 
+// Smooth bump in beat phase units: 255 at center, 0 at +-width
+static uint8_t beat_pulse(uint16_t phase, uint16_t center, uint16_t width) {
+  uint16_t dist = phase > center ? phase - center : center - phase;
+  if (dist >= width)
+    return 0;
+  return cubicwave8((uint8_t)(128 - (uint32_t)dist * 128 / width));
+}
+
 static void heartbeat_update(double time_ms, PixelFunc pixel,
                              const Palette16 palette) {
-  double t = time_ms / 1000.0;
+  (void)pixel;
+  uint32_t ms = (uint32_t)time_ms;
 
-  double beat_period = 60.0 / 72.0; // ~72 bpm
-  double beat_phase = fmod(t, beat_period) / beat_period;
-  double lub = exp(-pow((beat_phase - 0.15) * 12.0, 2.0));
-  double dub = exp(-pow((beat_phase - 0.35) * 12.0, 2.0));
-  float heartbeat = 0.6f + 0.4f * fmax(lub, dub);
+  uint16_t beat_phase = beat16(72, ms);               // ~72 bpm
+  uint8_t lub = beat_pulse(beat_phase, 9830, 13107);  // at 15% of the beat
+  uint8_t dub = beat_pulse(beat_phase, 22938, 13107); // at 35% of the beat
+  uint8_t pulse = lub > dub ? lub : dub;
+  uint8_t brightness = 153 + scale8(102, pulse); // 60% + 40% pulse
 
   int num_strips = get_num_strips();
   for (int s = 0; s < num_strips; s++) {
     int num_leds = get_strip_num_leds(s);
-    for (int i = 0; i < num_leds; i++) {
-      uint8_t index = (uint8_t)((float)i / (float)num_leds * 255.0f +
-                                t * 50.0f); // scroll over time
-      uint8_t brightness = (uint8_t)(255.0f * heartbeat);
-      RGB color = palette_sample(palette, index, brightness, true);
-
-      pixel(s, i, &color.r, &color.g, &color.b);
+    RGB *leds = get_strip_leds(s);
+    uint8_t index[64];
+    for (int start = 0; start < num_leds; start += 64) {
+      int n = num_leds - start < 64 ? num_leds - start : 64;
+      for (int i = 0; i < n; i++) {
+        index[i] = (uint8_t)((start + i) * 255 / num_leds +
+                             ms / 20); // scroll over time
+      }
+      palette_sample_n(palette, index, brightness, true, leds + start, n);
     }
   }
 }
 
-static void rainbow_update(double time_ms, PixelFunc pixel,
-                           const Palette16 palette) {
+// Strips are independent, so Rainbow renders one strip per call and the
+// desktop runtime spreads strips across cores
+static void rainbow_update_strip(int strip, double time_ms, PixelFunc pixel,
+                                 const Palette16 palette) {
+  (void)pixel;
   float t = (float)(time_ms / 1000.0);
 
-  int num_strips = get_num_strips();
-  for (int s = 0; s < num_strips; s++) {
-    int num_leds = get_strip_num_leds(s);
-    for (int i = 0; i < num_leds; i++) {
-      uint8_t index =
-          (uint8_t)((float)i / (float)num_leds * 255.0f + t * 60.0f);
-      RGB color = palette_sample(palette, index, 255, true);
-      pixel(s, i, &color.r, &color.g, &color.b);
+  int num_leds = get_strip_num_leds(strip);
+  RGB *leds = get_strip_leds(strip);
+  uint8_t index[64];
+  for (int start = 0; start < num_leds; start += 64) {
+    int n = num_leds - start < 64 ? num_leds - start : 64;
+    for (int i = 0; i < n; i++) {
+      index[i] = (uint8_t)((float)(start + i) / (float)num_leds * 255.0f +
+                           t * 60.0f);
     }
+    palette_sample_n(palette, index, 255, true, leds + start, n);
   }
 }
 
 static void solid_white_update(double time_ms, PixelFunc pixel,
                                const Palette16 palette) {
   (void)time_ms;
+  (void)pixel;
   (void)palette;
 
+  // Whole strips at once through the framebuffer instead of pixel()
   int num_strips = get_num_strips();
   for (int s = 0; s < num_strips; s++) {
-    int num_leds = get_strip_num_leds(s);
-    for (int i = 0; i < num_leds; i++) {
-      uint8_t r = 255, g = 255, b = 255;
-      pixel(s, i, &r, &g, &b);
-    }
+    memset(get_strip_leds(s), 255, (size_t)get_strip_num_leds(s) * sizeof(RGB));
   }
 }
 
 static void comet_update(double time_ms, PixelFunc pixel,
                          const Palette16 palette) {
-  float t = (float)(time_ms / 1000.0);
-  float tail_length = 25.0f;
+  (void)pixel;
+  uint32_t ms = (uint32_t)time_ms;
+  const int32_t tail_length = 25 << 8; // 8.8 fixed-point LEDs
 
   int num_strips = get_num_strips();
   for (int s = 0; s < num_strips; s++) {
     int num_leds = get_strip_num_leds(s);
+    RGB *leds = get_strip_leds(s);
 
     // Pseudo-random per-strip values based on strip index
     unsigned int seed = (unsigned int)(s * 2654435761u);
-    float speed = 0.3f + (float)(seed % 100) / 200.0f;   // 0.3 - 0.8
-    float phase_offset = (float)(seed % 1000) / 1000.0f; // 0.0 - 1.0
+    // 0.3 - 0.8 cycles per second, as beats per minute in Q8.8
+    uint16_t bpm88 = (uint16_t)((60 + seed % 100) * 60 * 256 / 200);
+    uint16_t phase_offset = (uint16_t)((seed % 1000) * 65536 / 1000);
 
     // Position of comet head moving top to bottom (high index to low)
-    float cycle_pos = fmodf(t * speed + phase_offset, 1.0f);
-    float head_pos = (1.0f - cycle_pos) * (float)num_leds;
+    uint16_t cycle_pos = beat88(bpm88, ms) + phase_offset;
+    int32_t head_pos =
+        (int32_t)(((uint32_t)(65536 - cycle_pos) * num_leds) >> 8);
 
     for (int i = 0; i < num_leds; i++) {
       // Distance behind the head (head moves downward, tail trails upward)
-      float dist = (float)i - head_pos;
+      int32_t dist = (i << 8) - head_pos;
       if (dist < 0)
-        dist += num_leds;
+        dist += num_leds << 8;
 
-      // Brightness falls off behind the head
-      float brightness = 0.0f;
-      if (dist < tail_length) {
-        brightness = 1.0f - (dist / tail_length);
-        brightness = brightness * brightness; // smooth falloff
+      if (dist >= tail_length) {
+        leds[i] = (RGB){0, 0, 0};
+        continue;
       }
 
+      // Brightness falls off behind the head (squared for a smooth falloff)
+      uint8_t falloff = (uint8_t)(255 - dist * 255 / tail_length);
+      uint8_t brightness = scale8(falloff, falloff);
+
       // Use palette - head gets bright end (index 255), tail fades toward 0
-      uint8_t index = (uint8_t)(255.0f - dist / tail_length * 128.0f);
-      RGB color =
-          palette_sample(palette, index, (uint8_t)(brightness * 255), true);
-      pixel(s, i, &color.r, &color.g, &color.b);
+      uint8_t index = (uint8_t)(255 - dist * 128 / tail_length);
+      leds[i] = palette_sample(palette, index, brightness, true);
     }
   }
 }
 
 const Program programs[] = {
     {"Heartbeat", heartbeat_update, NULL, NULL},
-    {"Rainbow", rainbow_update, NULL, NULL},
+    {"Rainbow", NULL, NULL, NULL, rainbow_update_strip},
     {"Solid White", solid_white_update, NULL, NULL},
     {"Comet", comet_update, NULL, NULL},
 };
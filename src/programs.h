@@ -1,8 +1,21 @@
 #pragma once
 
+#include "led_viz_math.h"
 #include "palette.h"
+#include <stddef.h>
 #include <stdint.h>
 
+// Matrix wiring (StripDef.matrix_layout): one order, optionally OR'ed with
+// flip flags. x runs left to right and y bottom to top before flipping.
+typedef enum {
+  MATRIX_COLUMN_SERPENTINE = 0,  // default: columns alternate up/down
+  MATRIX_ROW_SERPENTINE = 1,     // rows alternate left/right
+  MATRIX_COLUMN_PROGRESSIVE = 2, // every column runs bottom to top
+  MATRIX_ROW_PROGRESSIVE = 3,    // every row runs left to right
+  MATRIX_FLIP_X = 1 << 4,        // first LED on the right
+  MATRIX_FLIP_Y = 1 << 5,        // first LED at the top
+} MatrixLayout;
+
 // Strip definition - defines a single LED strip or matrix
 typedef struct {
   int num_leds;       // Total LEDs (auto-calculated as width*height for matrices)
@@ -10,8 +23,15 @@ typedef struct {
   float length_cm;    // Physical length/width in centimeters
   int matrix_width;   // 0 = strip, >0 = matrix columns
   int matrix_height;  // 0 = strip, >0 = matrix rows
+  int matrix_layout;  // MatrixLayout wiring (0 = column serpentine)
 } StripDef;
 
+// Framebuffer descriptor: strip s starts at pixels + s * stride
+typedef struct {
+  RGB *pixels;
+  int stride;
+} StripFramebuffer;
+
 // Pixel access function: if r/g/b are non-NULL, sets the pixel. Always writes
 // current values back to r/g/b.
 typedef void (*PixelFunc)(int strip, int led, uint8_t *r, uint8_t *g,
@@ -23,8 +43,31 @@ typedef struct Program {
   void (*update)(double time_ms, PixelFunc pixel, const Palette16 palette);
   void (*init)(void);    // optional: called when program becomes active
   void (*cleanup)(void); // optional: called when switching away
+  // optional: renders one strip; may run in parallel across strips
+  void (*update_strip)(int strip, double time_ms, PixelFunc pixel,
+                       const Palette16 palette);
+  // optional: state hand-off across hot reloads (see led_viz.h)
+  void *(*save_state)(size_t *size);
+  void (*restore_state)(const void *data, size_t size);
 } Program;
 
+// Layer definition: program name, blend mode and opacity (see led_viz.h)
+typedef struct {
+  const char *program;
+  LayerBlend blend;
+  uint8_t opacity;
+} LayerDef;
+
+// Transition between two programs, one strip at a time (see led_viz.h)
+typedef void (*TransitionFunc)(int strip, const RGB *from, const RGB *to,
+                               RGB *out, int count, uint8_t progress);
+void transition_crossfade(int strip, const RGB *from, const RGB *to, RGB *out,
+                          int count, uint8_t progress);
+void transition_wipe(int strip, const RGB *from, const RGB *to, RGB *out,
+                     int count, uint8_t progress);
+void transition_radial(int strip, const RGB *from, const RGB *to, RGB *out,
+                       int count, uint8_t progress);
+
 // Runtime accessors (for built-in programs)
 int get_num_strips(void);
 int get_strip_num_leds(int strip);
@@ -36,6 +79,30 @@ int get_matrix_width(int strip);
 int get_matrix_height(int strip);
 bool is_matrix(int strip);
 int get_matrix_index(int strip, int x, int y);
+const uint32_t *get_matrix_xy_table(int strip);
+const uint32_t *get_matrix_row(int strip, int y);
+void set_matrix_row(int strip, int y, const RGB *colors);
+void set_matrix_column(int strip, int x, const RGB *colors);
+
+// Normalized LED positions as separate x/y/z arrays, indexed by LED index.
+// The whole installation is centered on the origin and its longest side spans
+// -1 to 1 (x = left/right, y = up, z = depth). Built once per strip setup, so
+// spatial effects are plain loops over contiguous floats.
+typedef struct {
+  const float *x;
+  const float *y;
+  const float *z;
+} LedCoords;
+
+// Coordinates for one strip (all pointers NULL if unavailable)
+LedCoords get_strip_coords(int strip);
+
+// Direct framebuffer access (contiguous span of get_strip_num_leds() LEDs)
+RGB *get_strip_leds(int strip);
+StripFramebuffer get_framebuffer(void);
+
+// Interpolated expansion of the active palette
+const RGB *get_palette256(void);
 
 // Strip setup registry
 extern const StripDef strip_setup[];
@@ -0,0 +1,537 @@
+#include "recording.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Room for one frame record: a delta or a frame of residuals is never much
+// larger than the frame
+#define MAX_RECORD_SIZE(frame_size) ((frame_size) + (frame_size) / 64 + 32)
+
+#define FRAME_HEADER_SIZE 12 // f64 time_ms, u32 length
+#define PROB_SCALE (1u << LED_VIZ_RECORDING_PROB_BITS)
+
+struct RecordingWriter {
+  FILE *out;
+  uint64_t offset; // bytes written so far
+  int codec;
+  int num_strips;
+  int *num_leds; // per strip
+  uint32_t frame_size;
+  uint8_t *previous; // last frame added
+  uint8_t *current;
+  // Chunk being filled
+  uint8_t *chunk;
+  size_t chunk_size, chunk_capacity;
+  // Codec 1: the chunk's frames as uncoded residuals until its frequency
+  // table is known, and the residuals' histogram
+  uint8_t *pending;
+  size_t pending_size, pending_capacity;
+  uint32_t histogram[256];
+  uint8_t *coded; // room for one frame's rANS stream, filled backwards
+  int chunk_count;
+  double chunk_first_ms;
+  // Index entries of the chunks written
+  uint8_t *index;
+  size_t index_size, index_capacity;
+  int num_frames;
+  double first_ms;
+  bool failed;
+};
+
+static void write_bytes(RecordingWriter *writer, const void *data,
+                        size_t size) {
+  if (fwrite(data, 1, size, writer->out) != size)
+    writer->failed = true;
+  writer->offset += size;
+}
+
+static bool reserve(uint8_t **buffer, size_t *capacity, size_t needed) {
+  if (needed <= *capacity)
+    return true;
+  size_t grown = *capacity ? *capacity * 2 : 4096;
+  while (grown < needed)
+    grown *= 2;
+  uint8_t *resized = realloc(*buffer, grown);
+  if (!resized)
+    return false;
+  *buffer = resized;
+  *capacity = grown;
+  return true;
+}
+
+RecordingWriter *recording_writer_create(FILE *out, const CoreState *core,
+                                         const StripDef *strip_setup,
+                                         int codec) {
+  RecordingWriter *writer = calloc(1, sizeof(*writer));
+  if (!writer)
+    return NULL;
+  writer->out = out;
+  writer->codec = codec;
+  writer->num_strips = core->num_strips;
+  // Per-strip arrays (+ 1: never zero-sized)
+  writer->num_leds = calloc(core->num_strips + 1, sizeof(int));
+  LedVizRecordingStrip *strips =
+      calloc(core->num_strips + 1, sizeof(LedVizRecordingStrip));
+  if (!writer->num_leds || !strips) {
+    free(strips);
+    free(writer->num_leds);
+    free(writer);
+    return NULL;
+  }
+
+  LedVizRecordingHeader header = {
+      .version = LED_VIZ_RECORDING_VERSION,
+      .codec = (uint16_t)codec,
+      .num_strips = (uint32_t)core->num_strips,
+      .chunk_frames = RECORDING_CHUNK_FRAMES,
+  };
+  memcpy(header.magic, LED_VIZ_RECORDING_MAGIC, sizeof(header.magic));
+  for (int s = 0; s < core->num_strips; s++) {
+    writer->num_leds[s] = core->layout[s].num_leds;
+    header.frame_size += (uint32_t)writer->num_leds[s] * sizeof(RGB);
+    strips[s] = (LedVizRecordingStrip){
+        .num_leds = writer->num_leds[s],
+        .position = strip_setup[s].position,
+        .length_cm = strip_setup[s].length_cm,
+        .matrix_width = strip_setup[s].matrix_width,
+        .matrix_height = strip_setup[s].matrix_height,
+        .matrix_layout = strip_setup[s].matrix_layout,
+    };
+  }
+  writer->frame_size = header.frame_size;
+  writer->previous = calloc(1, writer->frame_size + 1);
+  writer->current = malloc(writer->frame_size + 1);
+  if (codec == LED_VIZ_RECORDING_CODEC_PREDICT)
+    writer->coded = malloc(2 * (size_t)writer->frame_size + 8);
+  if (!writer->previous || !writer->current ||
+      (codec == LED_VIZ_RECORDING_CODEC_PREDICT && !writer->coded)) {
+    free(writer->previous);
+    free(writer->current);
+    free(writer->coded);
+    free(writer->num_leds);
+    free(writer);
+    free(strips);
+    return NULL;
+  }
+
+  write_bytes(writer, &header, sizeof(header));
+  write_bytes(writer, strips, core->num_strips * sizeof(strips[0]));
+  free(strips);
+  return writer;
+}
+
+// XOR current against previous into codes (see led_viz_recording.h).
+// Returns the length.
+static size_t encode_delta(const uint8_t *current, const uint8_t *previous,
+                           size_t size, uint8_t *codes) {
+  uint8_t *out = codes;
+  size_t pos = 0;
+  while (pos < size) {
+    size_t run = 0;
+    while (pos + run < size && current[pos + run] == previous[pos + run])
+      run++;
+    if (pos + run == size)
+      break; // unchanged to the end: nothing to store
+    pos += run;
+    for (; run > 0; run -= run < 128 ? run : 128) {
+      *out++ = (uint8_t)((run < 128 ? run : 128) - 1);
+    }
+
+    // Changed bytes, taking in single unchanged ones (a zero byte costs
+    // less than ending the literal and starting another)
+    size_t count = 0;
+    while (pos + count < size && count < 128 &&
+           (current[pos + count] != previous[pos + count] ||
+            (pos + count + 1 < size &&
+             current[pos + count + 1] != previous[pos + count + 1])))
+      count++;
+    *out++ = (uint8_t)(0x7F + count);
+    for (size_t i = 0; i < count; i++) {
+      *out++ = current[pos + i] ^ previous[pos + i];
+    }
+    pos += count;
+  }
+  return (size_t)(out - codes);
+}
+
+// The cheapest prediction for a strip, by the sum of its residuals'
+// magnitudes
+static int pick_prediction(const uint8_t *cur, const uint8_t *prev,
+                           size_t bytes) {
+  uint32_t cost[4] = {0};
+  uint8_t last[3] = {0}, last_change[3] = {0};
+  for (size_t i = 0; i < bytes; i++) {
+    uint8_t change = (uint8_t)(cur[i] - prev[i]);
+    cost[LED_VIZ_PREDICT_TIME] += abs((int8_t)change);
+    cost[LED_VIZ_PREDICT_SPACE] += abs((int8_t)(cur[i] - last[i % 3]));
+    cost[LED_VIZ_PREDICT_TIME_SPACE] +=
+        abs((int8_t)(change - last_change[i % 3]));
+    last[i % 3] = cur[i];
+    last_change[i % 3] = change;
+  }
+  if (cost[LED_VIZ_PREDICT_TIME] == 0 && memcmp(cur, prev, bytes) == 0)
+    return LED_VIZ_PREDICT_UNCHANGED;
+  int best = LED_VIZ_PREDICT_TIME;
+  for (int mode = LED_VIZ_PREDICT_SPACE; mode <= LED_VIZ_PREDICT_TIME_SPACE;
+       mode++) {
+    if (cost[mode] < cost[best])
+      best = mode;
+  }
+  return best;
+}
+
+// Residuals of a strip under a prediction (the decoder's inverse)
+static void predict_strip(const uint8_t *cur, const uint8_t *prev,
+                          size_t bytes, int mode, uint8_t *residuals) {
+  uint8_t last[3] = {0, 0, 0};
+  for (size_t i = 0; i < bytes; i++) {
+    uint8_t value = mode == LED_VIZ_PREDICT_SPACE ? cur[i]
+                                                  : (uint8_t)(cur[i] - prev[i]);
+    residuals[i] = mode == LED_VIZ_PREDICT_TIME
+                       ? value
+                       : (uint8_t)(value - last[i % 3]);
+    last[i % 3] = value;
+  }
+}
+
+// Predict the current frame from the previous one strip by strip, into
+// out: the mode bytes, then the residuals. Returns the length.
+static size_t predict_frame(RecordingWriter *writer, uint8_t *out) {
+  size_t mode_bytes = ((size_t)writer->num_strips + 3) / 4;
+  memset(out, 0, mode_bytes);
+  uint8_t *residuals = out + mode_bytes;
+  size_t offset = 0;
+  for (int s = 0; s < writer->num_strips; s++) {
+    const uint8_t *cur = writer->current + offset;
+    const uint8_t *prev = writer->previous + offset;
+    size_t bytes = (size_t)writer->num_leds[s] * sizeof(RGB);
+    offset += bytes;
+    int mode = pick_prediction(cur, prev, bytes);
+    out[s / 4] |= (uint8_t)(mode << (2 * (s % 4)));
+    if (mode == LED_VIZ_PREDICT_UNCHANGED)
+      continue;
+    predict_strip(cur, prev, bytes, mode, residuals);
+    for (size_t i = 0; i < bytes; i++) {
+      writer->histogram[residuals[i]]++;
+    }
+    residuals += bytes;
+  }
+  return (size_t)(residuals - out);
+}
+
+// Scale the histogram to frequencies adding up to PROB_SCALE, keeping every
+// symbol that occurs
+static void normalize_frequencies(const uint32_t *histogram, uint32_t *freq) {
+  uint64_t total = 0;
+  for (int s = 0; s < 256; s++) {
+    total += histogram[s];
+  }
+  if (total == 0) {
+    memset(freq, 0, 256 * sizeof(*freq));
+    freq[0] = PROB_SCALE; // nothing to code, but the table must be full
+    return;
+  }
+
+  uint32_t sum = 0;
+  int largest = 0;
+  for (int s = 0; s < 256; s++) {
+    freq[s] = (uint32_t)((uint64_t)histogram[s] * PROB_SCALE / total);
+    if (histogram[s] && freq[s] == 0)
+      freq[s] = 1;
+    sum += freq[s];
+    if (freq[s] > freq[largest])
+      largest = s;
+  }
+  // Rounding goes to the most frequent symbol, where it costs the least
+  while (sum > PROB_SCALE) {
+    for (int s = 0; s < 256; s++) {
+      if (freq[s] > freq[largest])
+        largest = s;
+    }
+    freq[largest]--;
+    sum--;
+  }
+  freq[largest] += PROB_SCALE - sum;
+}
+
+// Write the frequency table (format in led_viz_recording.h); returns its
+// size, at most 512 bytes
+static size_t write_table(const uint32_t *freq, uint8_t *out) {
+  uint8_t *start = out;
+  for (int s = 0; s < 256;) {
+    if (freq[s] == 0) {
+      int run = 1;
+      while (s + run < 256 && run < 256 && freq[s + run] == 0)
+        run++;
+      *out++ = 0;
+      *out++ = (uint8_t)(run - 1);
+      s += run;
+    } else if (freq[s] < 0x80) {
+      *out++ = (uint8_t)freq[s++];
+    } else {
+      *out++ = (uint8_t)(0x80 | freq[s] >> 8);
+      *out++ = (uint8_t)freq[s++];
+    }
+  }
+  return (size_t)(out - start);
+}
+
+// rANS-code residuals with the chunk's frequencies backwards from end, so
+// the decoder reads forwards; returns where the stream starts
+static uint8_t *code_residuals(const uint32_t *freq, const uint32_t *cum,
+                               const uint8_t *residuals, size_t count,
+                               uint8_t *end) {
+  uint8_t *out = end;
+  // Even symbols go to the first state, odd ones to the second
+  uint32_t x[2] = {LED_VIZ_RECORDING_RANS_LOW, LED_VIZ_RECORDING_RANS_LOW};
+  for (size_t i = count; i-- > 0;) {
+    uint32_t *state = &x[i & 1];
+    uint32_t f = freq[residuals[i]];
+    uint32_t x_max =
+        ((LED_VIZ_RECORDING_RANS_LOW >> LED_VIZ_RECORDING_PROB_BITS) << 8) * f;
+    while (*state >= x_max) {
+      *--out = (uint8_t)*state;
+      *state >>= 8;
+    }
+    *state = ((*state / f) << LED_VIZ_RECORDING_PROB_BITS) + *state % f +
+             cum[residuals[i]];
+  }
+  out -= 8;
+  memcpy(out, &x[0], 4);
+  memcpy(out + 4, &x[1], 4);
+  return out;
+}
+
+// Code the pending frames into the chunk: the frequency table, then the
+// frame records with their residuals rANS-coded
+static bool code_chunk(RecordingWriter *writer) {
+  uint32_t freq[256], cum[256];
+  normalize_frequencies(writer->histogram, freq);
+  for (int s = 0, total = 0; s < 256; s++) {
+    cum[s] = (uint32_t)total;
+    total += (int)freq[s];
+  }
+  memset(writer->histogram, 0, sizeof(writer->histogram));
+
+  if (!reserve(&writer->chunk, &writer->chunk_capacity, 4 + 512))
+    return false;
+  uint32_t table_size = (uint32_t)write_table(freq, writer->chunk + 4);
+  memcpy(writer->chunk, &table_size, 4);
+  writer->chunk_size = 4 + table_size;
+
+  size_t mode_bytes = ((size_t)writer->num_strips + 3) / 4;
+  uint8_t *coded_end = writer->coded + 2 * (size_t)writer->frame_size + 8;
+  for (size_t pos = 0; pos < writer->pending_size;) {
+    const uint8_t *record = writer->pending + pos;
+    uint32_t length;
+    memcpy(&length, record + 8, 4);
+    pos += FRAME_HEADER_SIZE + length;
+
+    size_t count = length - mode_bytes;
+    const uint8_t *stream =
+        count ? code_residuals(freq, cum,
+                               record + FRAME_HEADER_SIZE + mode_bytes, count,
+                               coded_end)
+              : coded_end;
+    uint32_t coded_length = (uint32_t)(mode_bytes + (coded_end - stream));
+    if (!reserve(&writer->chunk, &writer->chunk_capacity,
+                 writer->chunk_size + FRAME_HEADER_SIZE + coded_length))
+      return false;
+    uint8_t *out = writer->chunk + writer->chunk_size;
+    memcpy(out, record, 8);
+    memcpy(out + 8, &coded_length, 4);
+    memcpy(out + FRAME_HEADER_SIZE, record + FRAME_HEADER_SIZE, mode_bytes);
+    memcpy(out + FRAME_HEADER_SIZE + mode_bytes, stream,
+           (size_t)(coded_end - stream));
+    writer->chunk_size += FRAME_HEADER_SIZE + coded_length;
+  }
+  writer->pending_size = 0;
+  return true;
+}
+
+static void flush_chunk(RecordingWriter *writer) {
+  if (writer->chunk_count == 0)
+    return;
+  if (writer->codec == LED_VIZ_RECORDING_CODEC_PREDICT && !code_chunk(writer)) {
+    writer->failed = true;
+    return;
+  }
+  if (!reserve(&writer->index, &writer->index_capacity,
+               writer->index_size + 16)) {
+    writer->failed = true;
+    return;
+  }
+  uint64_t offset = writer->offset;
+  memcpy(writer->index + writer->index_size, &offset, 8);
+  memcpy(writer->index + writer->index_size + 8, &writer->chunk_first_ms, 8);
+  writer->index_size += 16;
+
+  uint32_t chunk_header[2] = {(uint32_t)writer->chunk_count,
+                              (uint32_t)writer->chunk_size};
+  write_bytes(writer, chunk_header, sizeof(chunk_header));
+  write_bytes(writer, writer->chunk, writer->chunk_size);
+  writer->chunk_size = 0;
+  writer->chunk_count = 0;
+}
+
+// Append writer->current as the next frame
+static bool add_current(RecordingWriter *writer, double time_ms) {
+  if (writer->num_frames == 0)
+    writer->first_ms = time_ms;
+  time_ms -= writer->first_ms;
+
+  // A chunk starts with a keyframe: a delta against black
+  if (writer->chunk_count == RECORDING_CHUNK_FRAMES)
+    flush_chunk(writer);
+  if (writer->chunk_count == 0) {
+    memset(writer->previous, 0, writer->frame_size);
+    writer->chunk_first_ms = time_ms;
+  }
+
+  // Codec 1 frames wait in pending until the chunk is coded
+  bool predict = writer->codec == LED_VIZ_RECORDING_CODEC_PREDICT;
+  uint8_t **buffer = predict ? &writer->pending : &writer->chunk;
+  size_t *size = predict ? &writer->pending_size : &writer->chunk_size;
+  size_t *capacity =
+      predict ? &writer->pending_capacity : &writer->chunk_capacity;
+  if (!reserve(buffer, capacity,
+               *size + MAX_RECORD_SIZE(writer->frame_size) +
+                   writer->num_strips / 4)) {
+    writer->failed = true;
+    return false;
+  }
+  uint8_t *record = *buffer + *size;
+  uint32_t length =
+      predict ? (uint32_t)predict_frame(writer, record + FRAME_HEADER_SIZE)
+              : (uint32_t)encode_delta(writer->current, writer->previous,
+                                       writer->frame_size,
+                                       record + FRAME_HEADER_SIZE);
+  memcpy(record, &time_ms, 8);
+  memcpy(record + 8, &length, 4);
+  *size += FRAME_HEADER_SIZE + length;
+  writer->chunk_count++;
+  writer->num_frames++;
+
+  uint8_t *swap = writer->previous;
+  writer->previous = writer->current;
+  writer->current = swap;
+  return !writer->failed;
+}
+
+bool recording_writer_add(RecordingWriter *writer, const CoreState *core,
+                          double time_ms) {
+  uint8_t *pixels = writer->current;
+  for (int s = 0; s < writer->num_strips; s++) {
+    size_t bytes = (size_t)writer->num_leds[s] * sizeof(RGB);
+    memcpy(pixels, &core->framebuffer[s * core->stride], bytes);
+    pixels += bytes;
+  }
+  return add_current(writer, time_ms);
+}
+
+bool recording_writer_add_frame(RecordingWriter *writer,
+                                const uint8_t *pixels, double time_ms) {
+  memcpy(writer->current, pixels, writer->frame_size);
+  return add_current(writer, time_ms);
+}
+
+bool recording_writer_fits(const RecordingWriter *writer,
+                           const CoreState *core) {
+  if (core->num_strips != writer->num_strips)
+    return false;
+  for (int s = 0; s < writer->num_strips; s++) {
+    if (core->layout[s].num_leds != writer->num_leds[s])
+      return false;
+  }
+  return true;
+}
+
+int recording_writer_frames(const RecordingWriter *writer) {
+  return writer->num_frames;
+}
+
+bool recording_writer_finish(RecordingWriter *writer) {
+  flush_chunk(writer);
+  LedVizRecordingTrailer trailer = {
+      .index_offset = writer->offset,
+      .num_chunks = (uint32_t)(writer->index_size / 16),
+      .num_frames = (uint32_t)writer->num_frames,
+  };
+  memcpy(trailer.magic, LED_VIZ_RECORDING_INDEX_MAGIC, sizeof(trailer.magic));
+  write_bytes(writer, writer->index, writer->index_size);
+  write_bytes(writer, &trailer, sizeof(trailer));
+  if (fflush(writer->out) != 0)
+    writer->failed = true;
+
+  bool ok = !writer->failed;
+  free(writer->previous);
+  free(writer->current);
+  free(writer->chunk);
+  free(writer->pending);
+  free(writer->coded);
+  free(writer->index);
+  free(writer->num_leds);
+  free(writer);
+  return ok;
+}
+
+bool recording_map(LedVizRecording *rec, const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    log_error("Cannot open recording %s", path);
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  void *data = st.st_size > 0 ? mmap(NULL, (size_t)st.st_size, PROT_READ,
+                                     MAP_PRIVATE, fd, 0)
+                              : MAP_FAILED;
+  close(fd); // the mapping keeps the file
+  if (data == MAP_FAILED) {
+    log_error("Cannot map recording %s", path);
+    return false;
+  }
+  if (!led_viz_recording_open(rec, data, (size_t)st.st_size)) {
+    log_error("%s is not a complete recording", path);
+    munmap(data, (size_t)st.st_size);
+    return false;
+  }
+  return true;
+}
+
+void recording_unmap(LedVizRecording *rec) {
+  if (rec->data) {
+    munmap((void *)rec->data, rec->size);
+    rec->data = NULL;
+  }
+}
+
+StripDef *recording_strip_setup(const LedVizRecording *rec,
+                                int *num_strips) {
+  *num_strips = (int)rec->header.num_strips;
+  // (+ 1: never a zero-sized allocation)
+  StripDef *strips = calloc((size_t)*num_strips + 1, sizeof(StripDef));
+  if (!strips)
+    return NULL;
+  for (int s = 0; s < *num_strips; s++) {
+    const LedVizRecordingStrip *strip = &rec->strips[s];
+    // A matrix can't have more cells than LEDs (the file is corrupt)
+    bool matrix = (int64_t)strip->matrix_width * strip->matrix_height <=
+                  strip->num_leds;
+    strips[s] = (StripDef){
+        .num_leds = strip->num_leds,
+        .position = strip->position,
+        .length_cm = strip->length_cm,
+        .matrix_width = matrix ? strip->matrix_width : 0,
+        .matrix_height = matrix ? strip->matrix_height : 0,
+        .matrix_layout = strip->matrix_layout,
+    };
+  }
+  return strips;
+}
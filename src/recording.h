@@ -0,0 +1,51 @@
+#pragma once
+
+#include "core.h"
+#include "led_viz_recording.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Recording the core's LED output to a file and mapping a recording for
+// playback (the format and decoder are in led_viz_recording.h, shared with
+// the ESP32 runtime). Frame times are stored counting from the first frame.
+
+// Frames per chunk: a keyframe every second at 60 fps
+#define RECORDING_CHUNK_FRAMES 60
+
+typedef struct RecordingWriter RecordingWriter;
+
+// Start recording the strips configured in core (strip_setup is what they
+// were configured from) to out, which may be a pipe, with a
+// LED_VIZ_RECORDING_CODEC_*. Returns NULL when out of memory.
+RecordingWriter *recording_writer_create(FILE *out, const CoreState *core,
+                                         const StripDef *strip_setup,
+                                         int codec);
+
+// Append the core's current frame at time_ms
+bool recording_writer_add(RecordingWriter *writer, const CoreState *core,
+                          double time_ms);
+
+// Append a frame given as header.frame_size bytes of rgb, e.g. one decoded
+// from another recording
+bool recording_writer_add_frame(RecordingWriter *writer,
+                                const uint8_t *pixels, double time_ms);
+
+// Whether the core's strips are still the ones being recorded
+bool recording_writer_fits(const RecordingWriter *writer,
+                           const CoreState *core);
+
+// Frames added so far
+int recording_writer_frames(const RecordingWriter *writer);
+
+// Write the last chunk and the index and free the writer (out stays open).
+// False if any write failed.
+bool recording_writer_finish(RecordingWriter *writer);
+
+// Map a recording file read-only and open it; logs why if it can't
+bool recording_map(LedVizRecording *rec, const char *path);
+void recording_unmap(LedVizRecording *rec);
+
+// The recorded strip setup, as num_strips StripDefs (malloc'ed; NULL
+// without memory)
+StripDef *recording_strip_setup(const LedVizRecording *rec, int *num_strips);
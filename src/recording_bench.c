@@ -0,0 +1,319 @@
+#include "core.h"
+#include "log.h"
+#include "recording.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Measures the recording codecs on existing recordings: every recording is
+// re-encoded in memory with each codec, then decoded front to back, to
+// report the compression ratio and encode and decode speed. Make the
+// recordings with led_viz_headless --format rec (or led_viz --record).
+
+#define DEFAULT_MIN_MS 250.0
+
+typedef struct {
+  int codec;
+  const char *name;
+} Codec;
+
+static const Codec codecs[] = {
+    {LED_VIZ_RECORDING_CODEC_XOR, "xor"},
+    {LED_VIZ_RECORDING_CODEC_PREDICT, "predict"},
+};
+#define NUM_CODECS ((int)(sizeof(codecs) / sizeof(codecs[0])))
+
+typedef struct {
+  const char *recording;
+  const char *codec;
+  int frames;
+  int frame_size;
+  size_t coded_size;
+  double ratio;          // raw frame bytes / coded file size
+  double encode_mb_s;    // of raw frame bytes
+  double decode_mb_s;
+  double decode_frames_ms;
+} BenchResult;
+
+// A recording decoded into memory: its strips and every frame
+typedef struct {
+  StripDef *strips; // malloc'ed
+  int num_strips;
+  int num_frames;
+  uint32_t frame_size;
+  uint8_t *pixels; // num_frames x frame_size
+  double *times_ms;
+} Frames;
+
+static int64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool load_frames(const char *path, Frames *frames) {
+  LedVizRecording *rec = malloc(sizeof(*rec));
+  if (!rec || !recording_map(rec, path)) {
+    free(rec);
+    return false;
+  }
+  frames->strips = recording_strip_setup(rec, &frames->num_strips);
+  frames->num_frames = rec->num_frames;
+  frames->frame_size = rec->header.frame_size;
+  frames->pixels = malloc((size_t)rec->num_frames * frames->frame_size + 1);
+  frames->times_ms = malloc((size_t)rec->num_frames * sizeof(double) + 1);
+  bool ok = frames->strips && frames->pixels && frames->times_ms;
+  uint8_t *pixels = frames->pixels;
+  for (int f = 0; ok && f < rec->num_frames; f++) {
+    if (f > 0)
+      memcpy(pixels, pixels - frames->frame_size, frames->frame_size);
+    ok = led_viz_recording_decode(rec, f, pixels, &frames->times_ms[f]);
+    pixels += frames->frame_size;
+  }
+  if (!ok) {
+    fprintf(stderr, "Error: Cannot decode %s\n", path);
+  }
+  recording_unmap(rec);
+  free(rec);
+  return ok;
+}
+
+static void free_frames(Frames *frames) {
+  free(frames->strips);
+  free(frames->pixels);
+  free(frames->times_ms);
+}
+
+// Encode every frame with a codec into a malloc'ed file image
+static uint8_t *encode(const Frames *frames, CoreState *core, int codec,
+                       size_t *size) {
+  char *data = NULL;
+  FILE *out = open_memstream(&data, size);
+  if (!out)
+    return NULL;
+  RecordingWriter *writer =
+      recording_writer_create(out, core, frames->strips, codec);
+  bool ok = writer != NULL;
+  for (int f = 0; ok && f < frames->num_frames; f++) {
+    ok = recording_writer_add_frame(
+        writer, frames->pixels + (size_t)f * frames->frame_size,
+        frames->times_ms[f]);
+  }
+  if (writer && !recording_writer_finish(writer))
+    ok = false;
+  if (fclose(out) != 0 || !ok) {
+    free(data);
+    return NULL;
+  }
+  return (uint8_t *)data;
+}
+
+// Decode every frame in order; false if one fails or differs from frames
+static bool decode_all(LedVizRecording *rec, uint8_t *pixels,
+                       const Frames *check) {
+  rec->frame = -1;
+  for (int f = 0; f < rec->num_frames; f++) {
+    if (!led_viz_recording_decode(rec, f, pixels, NULL))
+      return false;
+    if (check && memcmp(pixels, check->pixels + (size_t)f * check->frame_size,
+                        check->frame_size) != 0)
+      return false;
+  }
+  return true;
+}
+
+static bool bench_codec(const Frames *frames, CoreState *core,
+                        const Codec *codec, double min_ms,
+                        BenchResult *result) {
+  double raw_mb = (double)frames->num_frames * frames->frame_size / 1e6;
+
+  // Encode until min_ms has passed, keeping the last file
+  uint8_t *data = NULL;
+  size_t size = 0;
+  int runs = 0;
+  int64_t start = monotonic_ns(), elapsed;
+  do {
+    free(data);
+    data = encode(frames, core, codec->codec, &size);
+    if (!data) {
+      fprintf(stderr, "Error: Encoding with %s failed\n", codec->name);
+      return false;
+    }
+    runs++;
+    elapsed = monotonic_ns() - start;
+  } while (elapsed < min_ms * 1e6);
+  result->encode_mb_s = raw_mb * runs / (elapsed / 1e9);
+
+  LedVizRecording *rec = malloc(sizeof(*rec));
+  uint8_t *pixels = malloc(frames->frame_size + 1);
+  bool ok = rec && pixels && led_viz_recording_open(rec, data, size) &&
+            decode_all(rec, pixels, frames);
+  if (!ok) {
+    fprintf(stderr, "Error: %s does not decode to the same frames\n",
+            codec->name);
+  } else {
+    runs = 0;
+    start = monotonic_ns();
+    do {
+      decode_all(rec, pixels, NULL);
+      runs++;
+      elapsed = monotonic_ns() - start;
+    } while (elapsed < min_ms * 1e6);
+    result->decode_mb_s = raw_mb * runs / (elapsed / 1e9);
+    result->decode_frames_ms =
+        (double)frames->num_frames * runs / (elapsed / 1e6);
+    result->codec = codec->name;
+    result->frames = frames->num_frames;
+    result->frame_size = (int)frames->frame_size;
+    result->coded_size = size;
+    result->ratio = raw_mb * 1e6 / size;
+  }
+  free(pixels);
+  free(rec);
+  free(data);
+  return ok;
+}
+
+static void print_table(FILE *out, const BenchResult *results, int count) {
+  fprintf(out, "%-24s %-8s %6s %7s %10s %7s %10s %10s %11s\n", "recording",
+          "codec", "frames", "bytes", "coded", "ratio", "enc MB/s",
+          "dec MB/s", "dec frm/ms");
+  for (int i = 0; i < count; i++) {
+    const BenchResult *r = &results[i];
+    fprintf(out, "%-24.24s %-8s %6d %7d %10zu %6.2fx %10.1f %10.1f %11.1f\n",
+            r->recording, r->codec, r->frames, r->frame_size, r->coded_size,
+            r->ratio, r->encode_mb_s, r->decode_mb_s, r->decode_frames_ms);
+  }
+}
+
+static void write_json_string(FILE *out, const char *text) {
+  fputc('"', out);
+  for (const unsigned char *c = (const unsigned char *)text; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(out, "\\%c", *c);
+    } else if (*c < 0x20) {
+      fprintf(out, "\\u%04x", *c);
+    } else {
+      fputc(*c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void write_json(FILE *out, const BenchResult *results, int count) {
+  fprintf(out, "{\n  \"results\": [");
+  for (int i = 0; i < count; i++) {
+    const BenchResult *r = &results[i];
+    fprintf(out, "%s\n    {\"recording\": ", i ? "," : "");
+    write_json_string(out, r->recording);
+    fprintf(out,
+            ", \"codec\": \"%s\", \"frames\": %d, \"frame_bytes\": %d, "
+            "\"coded_bytes\": %zu, \"ratio\": %.3f, \"encode_mb_s\": %.1f, "
+            "\"decode_mb_s\": %.1f, \"decode_frames_per_ms\": %.1f}",
+            r->codec, r->frames, r->frame_size, r->coded_size, r->ratio,
+            r->encode_mb_s, r->decode_mb_s, r->decode_frames_ms);
+  }
+  fprintf(out, "\n  ]\n}\n");
+}
+
+static void print_usage(const char *prog) {
+  fprintf(stderr, "LED Visualizer - recording codec benchmark\n\n");
+  fprintf(stderr, "Usage: %s [options] <recording> [more recordings...]\n\n",
+          prog);
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  --min-ms <ms>         Minimum time spent encoding and "
+                  "decoding each\n"
+                  "                        (default %.0f)\n",
+          DEFAULT_MIN_MS);
+  fprintf(stderr, "  --json <file>         Also write the results as JSON "
+                  "(- for stdout)\n\n");
+  fprintf(stderr, "Example (one recording per program; without --program "
+                  "a source with\n"
+                  "layers records the layer stack):\n");
+  fprintf(stderr, "  led_viz_headless --format rec --program Breathe "
+                  "-o breathe.rec \\\n"
+                  "      examples/demo_programs.c\n");
+  fprintf(stderr, "  %s breathe.rec\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+  const char **paths = malloc(argc * sizeof(*paths));
+  int num_paths = 0;
+  double min_ms = DEFAULT_MIN_MS;
+  const char *json_path = NULL;
+  if (!paths)
+    return 1;
+
+  // Parse arguments
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      print_usage(argv[0]);
+      free(paths);
+      return 0;
+    } else if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) {
+      min_ms = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_path = argv[++i];
+    } else if (argv[i][0] != '-') {
+      paths[num_paths++] = argv[i];
+    }
+  }
+  if (num_paths == 0) {
+    print_usage(argv[0]);
+    free(paths);
+    return 1;
+  }
+  log_set_quiet(true);
+
+  BenchResult *results = malloc(num_paths * NUM_CODECS * sizeof(*results));
+  CoreState *core = calloc(1, sizeof(*core));
+  int count = 0;
+  bool ok = results && core;
+  for (int p = 0; ok && p < num_paths; p++) {
+    Frames frames = {0};
+    ok = load_frames(paths[p], &frames);
+    if (ok) {
+      // The writer takes the strips from a core
+      core_configure_strips(core, frames.strips, frames.num_strips);
+    }
+    for (int c = 0; ok && c < NUM_CODECS; c++) {
+      results[count].recording = paths[p];
+      ok = bench_codec(&frames, core, &codecs[c], min_ms, &results[count]);
+      count += ok;
+    }
+    free_frames(&frames);
+  }
+  if (!results || !core) {
+    fprintf(stderr, "Error: Out of memory\n");
+  }
+
+  if (count > 0) {
+    // Keep stdout parseable when the JSON goes there
+    bool json_stdout = json_path && strcmp(json_path, "-") == 0;
+    print_table(json_stdout ? stderr : stdout, results, count);
+    if (json_path) {
+      FILE *out = json_stdout ? stdout : fopen(json_path, "w");
+      if (out) {
+        write_json(out, results, count);
+        if (out != stdout && fclose(out) != 0) {
+          perror(json_path);
+          ok = false;
+        }
+      } else {
+        perror(json_path);
+        ok = false;
+      }
+    }
+  }
+
+  if (core)
+    core_shutdown(core);
+  free(core);
+  free(results);
+  free(paths);
+  return ok ? 0 : 1;
+}
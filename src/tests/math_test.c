@@ -0,0 +1,136 @@
+#include "led_viz_math.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+// Checks sin16/cos16/sin8/cos8 (include/led_viz_math.h) against libm over
+// every input, and times them against sin(). Exits nonzero when an error
+// bound is exceeded; the timings are only reported.
+//
+// References:
+//   sin16(t) ~ 32767 * sin(2 pi t / 65536), within SIN16_MAX_ERROR
+//   sin8(t) == (round(32767 * sin(2 pi t / 256)) + 32768) >> 8, exactly:
+//     sin8 is sin16 shifted down, so it truncates rather than rounds. It is
+//     up to 1 below (32767 * sin + 32768) / 256 and up to about 1.46 off
+//     128 + 127.5 * sin.
+
+#define SIN16_MAX_ERROR 1.51
+#define TIMING_ROUNDS 200
+
+static const double TWO_PI = 6.283185307179586;
+
+static int failures;
+
+static void check(int ok, const char *what) {
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void check_sin16(void) {
+  double max_sin = 0.0, max_cos = 0.0;
+  for (int t = 0; t < 65536; t++) {
+    double angle = TWO_PI * t / 65536.0;
+    double sin_error = fabs(sin16((uint16_t)t) - 32767.0 * sin(angle));
+    double cos_error = fabs(cos16((uint16_t)t) - 32767.0 * cos(angle));
+    if (sin_error > max_sin)
+      max_sin = sin_error;
+    if (cos_error > max_cos)
+      max_cos = cos_error;
+  }
+  printf("sin16: max error %.3f vs 32767*sin()\n", max_sin);
+  printf("cos16: max error %.3f vs 32767*cos()\n", max_cos);
+  check(max_sin <= SIN16_MAX_ERROR, "sin16 error bound");
+  check(max_cos <= SIN16_MAX_ERROR, "cos16 error bound");
+
+  check(sin16(0) == 0 && sin16(32768) == 0, "sin16 zero crossings");
+  check(sin16(16384) == 32767 && sin16(49152) == -32767, "sin16 peaks");
+}
+
+static void check_sin8(void) {
+  int mismatches = 0;
+  double max_below = 0.0, max_centered = 0.0;
+  for (int t = 0; t < 256; t++) {
+    double s = sin(TWO_PI * t / 256.0);
+    double c = cos(TWO_PI * t / 256.0);
+    if (sin8((uint8_t)t) != (lround(32767.0 * s) + 32768) >> 8)
+      mismatches++;
+    if (cos8((uint8_t)t) != (lround(32767.0 * c) + 32768) >> 8)
+      mismatches++;
+
+    double exact_sin = (32767.0 * s + 32768.0) / 256.0;
+    double below = exact_sin - sin8((uint8_t)t);
+    double centered = fabs(sin8((uint8_t)t) - (128.0 + 127.5 * s));
+    if (below > max_below)
+      max_below = below;
+    if (centered > max_centered)
+      max_centered = centered;
+  }
+  printf("sin8/cos8: %d mismatch(es) vs (round(32767*sin())+32768)>>8\n",
+         mismatches);
+  printf("sin8: up to %.3f below the unrounded value, max error %.3f vs "
+         "128+127.5*sin()\n",
+         max_below, max_centered);
+  check(mismatches == 0, "sin8/cos8 match the truncated reference");
+  check(max_below < 1.0, "sin8 truncation below 1");
+}
+
+static void time_sin(void) {
+  volatile int32_t sink_int = 0;
+  volatile double sink_double = 0.0;
+  long calls = 65536L * TIMING_ROUNDS;
+
+  double start = now_s();
+  for (int r = 0; r < TIMING_ROUNDS; r++) {
+    int32_t sum = 0;
+    for (int t = 0; t < 65536; t++)
+      sum += sin16((uint16_t)(t * 40503)); // odd stride: no sequential reuse
+    sink_int += sum;
+  }
+  double sin16_s = now_s() - start;
+
+  start = now_s();
+  for (int r = 0; r < TIMING_ROUNDS; r++) {
+    int32_t sum = 0;
+    for (int t = 0; t < 65536; t++)
+      sum += sin8((uint8_t)(t * 167));
+    sink_int += sum;
+  }
+  double sin8_s = now_s() - start;
+
+  start = now_s();
+  for (int r = 0; r < TIMING_ROUNDS; r++) {
+    double sum = 0.0;
+    for (int t = 0; t < 65536; t++)
+      sum += sin((uint16_t)(t * 40503) * (TWO_PI / 65536.0));
+    sink_double += sum;
+  }
+  double libm_s = now_s() - start;
+  (void)sink_int;
+  (void)sink_double;
+
+  printf("sin16: %.2f ns/call\n", sin16_s * 1e9 / calls);
+  printf("sin8:  %.2f ns/call\n", sin8_s * 1e9 / calls);
+  printf("sin(): %.2f ns/call (%.1fx sin16)\n", libm_s * 1e9 / calls,
+         libm_s / sin16_s);
+}
+
+int main(void) {
+  check_sin16();
+  check_sin8();
+  time_sin();
+  if (failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
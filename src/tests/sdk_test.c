@@ -0,0 +1,226 @@
+#include "led_viz.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Checks the batch color kernels (include/led_viz_kernels.h: palette_sample_n,
+// scale8_n, blend_n, fade_n, composite_n) bit-for-bit against the per-pixel
+// formulas (palette_sample, scale8, blend8, the blend modes of led_viz.h).
+// Linked against the SDK once per SIMD path it picks at compile time, and
+// against the core's src/palette.c (see src/tests/CMakeLists.txt); covers
+// every palette and span lengths that leave a remainder for the scalar tail.
+
+// Longest span checked, plus room for the offset start
+#define MAX_SPAN 1200
+#define SKIP_RETURN_CODE 77
+
+static const int SPAN_LENGTHS[] = {
+    1,  2,  3,  4,  5,  7,  10, 11, 15, 16,  17,  21,   31,  32,
+    33, 42, 63, 64, 65, 85, 97, 127, 128, 129, 200, 333, 1000, 1001,
+};
+#define NUM_SPAN_LENGTHS (int)(sizeof(SPAN_LENGTHS) / sizeof(SPAN_LENGTHS[0]))
+
+static int failures;
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static void random_bytes(void *dst, size_t n) {
+  uint8_t *p = dst;
+  for (size_t i = 0; i < n; i++)
+    p[i] = (uint8_t)rng();
+}
+
+static const char *simd_path(void) {
+#if defined(__AVX2__)
+  return "AVX2";
+#elif defined(__SSE2__)
+  return "SSE2";
+#elif defined(__ARM_NEON)
+  return "NEON";
+#else
+  return "C";
+#endif
+}
+
+static bool rgb_equal(RGB a, RGB b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+// Report the first mismatch of a span and count it as one failure
+static bool check_span(const char *what, const RGB *got, const RGB *want,
+                       int count, int param) {
+  for (int i = 0; i < count; i++) {
+    if (!rgb_equal(got[i], want[i])) {
+      printf("FAIL: %s (param %d, count %d) at %d: got %d,%d,%d want "
+             "%d,%d,%d\n",
+             what, param, count, i, got[i].r, got[i].g, got[i].b, want[i].r,
+             want[i].g, want[i].b);
+      failures++;
+      return false;
+    }
+  }
+  return true;
+}
+
+static void check_palette_sample_n(const char *name, const RGB *palette) {
+  static const uint8_t brightness[] = {0, 1, 16, 127, 128, 200, 254, 255};
+  uint8_t indices[MAX_SPAN + 1];
+  RGB got[MAX_SPAN + 1], want[MAX_SPAN + 1];
+  char what[64];
+
+  for (int interpolate = 0; interpolate < 2; interpolate++) {
+    snprintf(what, sizeof(what), "palette_sample_n %s%s", name,
+             interpolate ? "" : " (no interpolation)");
+    for (int b = 0; b < (int)sizeof(brightness); b++) {
+      for (int l = 0; l < NUM_SPAN_LENGTHS; l++) {
+        int count = SPAN_LENGTHS[l];
+        int offset = l & 1; // odd starts too
+        random_bytes(indices, sizeof(indices));
+        for (int i = 0; i < count && i < 256; i++)
+          indices[offset + i] = (uint8_t)i; // every index at least once
+        for (int i = 0; i < count; i++)
+          want[i] = palette_sample(palette, indices[offset + i],
+                                   brightness[b], interpolate);
+        palette_sample_n(palette, indices + offset, brightness[b],
+                         interpolate, got + offset, count);
+        check_span(what, got + offset, want, count, brightness[b]);
+      }
+    }
+  }
+}
+
+static void check_scale_blend_fade(void) {
+  RGB src[MAX_SPAN + 1], dst[MAX_SPAN + 1], want[MAX_SPAN + 1];
+
+  for (int amount = 0; amount < 256; amount++) {
+    for (int l = 0; l < NUM_SPAN_LENGTHS; l++) {
+      int count = SPAN_LENGTHS[l];
+      int offset = l & 1;
+      RGB *d = dst + offset;
+
+      random_bytes(dst, sizeof(dst));
+      for (int i = 0; i < count; i++) {
+        want[i].r = scale8(d[i].r, (uint8_t)amount);
+        want[i].g = scale8(d[i].g, (uint8_t)amount);
+        want[i].b = scale8(d[i].b, (uint8_t)amount);
+      }
+      scale8_n(d, count, (uint8_t)amount);
+      check_span("scale8_n", d, want, count, amount);
+
+      random_bytes(dst, sizeof(dst));
+      for (int i = 0; i < count; i++) {
+        uint8_t scale = (uint8_t)(255 - amount);
+        want[i].r = scale8(d[i].r, scale);
+        want[i].g = scale8(d[i].g, scale);
+        want[i].b = scale8(d[i].b, scale);
+      }
+      fade_n(d, count, (uint8_t)amount);
+      check_span("fade_n", d, want, count, amount);
+
+      random_bytes(dst, sizeof(dst));
+      random_bytes(src, sizeof(src));
+      for (int i = 0; i < count; i++) {
+        want[i].r = blend8(d[i].r, src[i].r, (uint8_t)amount);
+        want[i].g = blend8(d[i].g, src[i].g, (uint8_t)amount);
+        want[i].b = blend8(d[i].b, src[i].b, (uint8_t)amount);
+      }
+      blend_n(d, src, count, (uint8_t)amount);
+      check_span("blend_n", d, want, count, amount);
+    }
+  }
+}
+
+// The layer blend modes as led_viz.h documents them, per channel
+static uint8_t layer_blend8(uint8_t a, uint8_t b, LayerBlend mode) {
+  switch (mode) {
+  case LAYER_ADD:
+    return qadd8(a, b);
+  case LAYER_SCREEN:
+    return (uint8_t)(255 - ((255 - a) * (255 - b) + 127) / 255);
+  case LAYER_MULTIPLY:
+    return (uint8_t)((a * b + 127) / 255); // rounded a * b / 255
+  case LAYER_MAX:
+    return a > b ? a : b;
+  default: // LAYER_ALPHA
+    return b;
+  }
+}
+
+static void check_composite_n(void) {
+  static const char *mode_names[] = {"alpha", "add", "screen", "multiply",
+                                     "max"};
+  RGB src[MAX_SPAN + 1], dst[MAX_SPAN + 1], want[MAX_SPAN + 1];
+  char what[64];
+
+  for (int mode = LAYER_ALPHA; mode <= LAYER_MAX; mode++) {
+    snprintf(what, sizeof(what), "composite_n %s", mode_names[mode]);
+    for (int opacity = 0; opacity < 256; opacity++) {
+      for (int l = 0; l < NUM_SPAN_LENGTHS; l++) {
+        int count = SPAN_LENGTHS[l];
+        int offset = l & 1;
+        RGB *d = dst + offset;
+
+        random_bytes(dst, sizeof(dst));
+        random_bytes(src, sizeof(src));
+        for (int i = 0; i < count; i++) {
+          RGB mixed = {
+              layer_blend8(d[i].r, src[i].r, (LayerBlend)mode),
+              layer_blend8(d[i].g, src[i].g, (LayerBlend)mode),
+              layer_blend8(d[i].b, src[i].b, (LayerBlend)mode),
+          };
+          want[i].r = blend8(d[i].r, mixed.r, (uint8_t)opacity);
+          want[i].g = blend8(d[i].g, mixed.g, (uint8_t)opacity);
+          want[i].b = blend8(d[i].b, mixed.b, (uint8_t)opacity);
+        }
+        composite_n(d, src, count, (LayerBlend)mode, (uint8_t)opacity);
+        check_span(what, d, want, count, opacity);
+      }
+    }
+  }
+}
+
+int main(void) {
+#if defined(__AVX2__)
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("avx2")) {
+    printf("This CPU has no AVX2, skipped\n");
+    return SKIP_RETURN_CODE;
+  }
+#endif
+  printf("Kernel path: %s\n", simd_path());
+
+  static const struct {
+    const char *name;
+    const RGB *palette;
+  } palettes[] = {
+      {"Rainbow", PALETTE_RAINBOW}, {"Heat", PALETTE_HEAT},
+      {"Ocean", PALETTE_OCEAN},     {"Forest", PALETTE_FOREST},
+      {"Lava", PALETTE_LAVA},       {"Cloud", PALETTE_CLOUD},
+      {"Party", PALETTE_PARTY},
+  };
+  for (int p = 0; p < (int)(sizeof(palettes) / sizeof(palettes[0])); p++)
+    check_palette_sample_n(palettes[p].name, palettes[p].palette);
+
+  // Random palettes reach channel values the built-in ones don't
+  Palette16 random_palette;
+  for (int p = 0; p < 16; p++) {
+    random_bytes(random_palette, sizeof(random_palette));
+    check_palette_sample_n("random", random_palette);
+  }
+
+  check_scale_blend_fade();
+  check_composite_n();
+
+  if (failures) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
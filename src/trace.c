@@ -0,0 +1,190 @@
+#include "trace.h"
+#include "log.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+// Events kept: the last few thousand frames
+#define TRACE_CAPACITY (1 << 16)
+#define TRACE_MAX_THREADS 32
+
+// A slot is written like a seqlock: seq is 0 while the fields change and the
+// event number + 1 once they are complete, so a dump skips slots being
+// overwritten. The fields are relaxed atomics only to keep that race defined.
+typedef struct {
+  atomic_uint_fast64_t seq;
+  atomic_uint_fast64_t start_ns;
+  atomic_uint_fast64_t duration_ns;
+  atomic_uint thread_stage; // thread << 8 | stage
+} TraceSlot;
+
+atomic_uint g_trace_flags;
+
+static TraceSlot g_ring[TRACE_CAPACITY];
+static atomic_uint_fast64_t g_head;      // next event number
+static atomic_uint_fast64_t g_first;     // first event of this trace
+static atomic_uint_fast64_t g_origin_ns; // when it started
+static atomic_uint g_next_thread = 1;
+static _Atomic(const char *) g_thread_names[TRACE_MAX_THREADS];
+static _Thread_local uint32_t t_thread;
+static atomic_uint_fast64_t g_totals[2][NUM_TRACE_STAGES]; // cpu, gpu
+
+static const char *stage_names[NUM_TRACE_STAGES] = {
+    [TRACE_FRAME] = "frame",
+    [TRACE_PROGRAM] = "program",
+    [TRACE_LIGHT_UPLOAD] = "light upload",
+    [TRACE_GBUFFER] = "gbuffer",
+    [TRACE_LIGHTING] = "lighting",
+    [TRACE_DEPTH_BLIT] = "depth blit",
+    [TRACE_SPHERES] = "spheres",
+    [TRACE_HUD] = "hud",
+    [TRACE_PRESENT] = "present",
+    [TRACE_RELOAD] = "reload",
+    [TRACE_BUILD] = "build",
+};
+
+uint64_t trace_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void trace_record(TraceStage stage, uint32_t thread, uint64_t start_ns,
+                  uint64_t duration_ns) {
+  unsigned flags = atomic_load_explicit(&g_trace_flags, memory_order_relaxed);
+  if (flags & TRACE_STATS) {
+    atomic_fetch_add_explicit(&g_totals[thread == TRACE_GPU_THREAD][stage],
+                              duration_ns, memory_order_relaxed);
+  }
+  if (!(flags & TRACE_RECORD))
+    return;
+
+  uint64_t n = atomic_fetch_add_explicit(&g_head, 1, memory_order_relaxed);
+  TraceSlot *slot = &g_ring[n & (TRACE_CAPACITY - 1)];
+  atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&slot->start_ns, start_ns, memory_order_relaxed);
+  atomic_store_explicit(&slot->duration_ns, duration_ns,
+                        memory_order_relaxed);
+  atomic_store_explicit(&slot->thread_stage, thread << 8 | stage,
+                        memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, n + 1, memory_order_release);
+}
+
+uint32_t trace_thread_id(void) {
+  if (!t_thread)
+    t_thread = atomic_fetch_add(&g_next_thread, 1);
+  return t_thread;
+}
+
+void trace_name_thread(const char *name) {
+  uint32_t thread = trace_thread_id();
+  if (thread < TRACE_MAX_THREADS)
+    atomic_store(&g_thread_names[thread], name);
+}
+
+void trace_set_enabled(bool enabled) {
+  if (enabled && !trace_enabled()) {
+    atomic_store(&g_origin_ns, trace_now_ns());
+    atomic_store(&g_first, atomic_load(&g_head));
+  }
+  if (enabled) {
+    atomic_fetch_or(&g_trace_flags, TRACE_RECORD);
+  } else {
+    atomic_fetch_and(&g_trace_flags, ~TRACE_RECORD);
+  }
+}
+
+void trace_set_stats(bool enabled) {
+  if (enabled) {
+    uint64_t cpu_ns[NUM_TRACE_STAGES], gpu_ns[NUM_TRACE_STAGES];
+    trace_take_totals(cpu_ns, gpu_ns);
+    atomic_fetch_or(&g_trace_flags, TRACE_STATS);
+  } else {
+    atomic_fetch_and(&g_trace_flags, ~TRACE_STATS);
+  }
+}
+
+void trace_take_totals(uint64_t cpu_ns[NUM_TRACE_STAGES],
+                       uint64_t gpu_ns[NUM_TRACE_STAGES]) {
+  for (int i = 0; i < NUM_TRACE_STAGES; i++) {
+    cpu_ns[i] = atomic_exchange_explicit(&g_totals[0][i], 0,
+                                         memory_order_relaxed);
+    gpu_ns[i] = atomic_exchange_explicit(&g_totals[1][i], 0,
+                                         memory_order_relaxed);
+  }
+}
+
+const char *trace_stage_name(TraceStage stage) {
+  return stage < NUM_TRACE_STAGES ? stage_names[stage] : "?";
+}
+
+static void write_thread_name(FILE *out, uint32_t thread, const char *name) {
+  fprintf(out,
+          ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+          "\"args\":{\"name\":\"%s\"}}",
+          thread, name);
+}
+
+int trace_write_json(FILE *out) {
+  uint64_t head = atomic_load(&g_head);
+  uint64_t first = atomic_load(&g_first);
+  if (head - first > TRACE_CAPACITY)
+    first = head - TRACE_CAPACITY;
+  uint64_t origin_ns = atomic_load(&g_origin_ns);
+
+  // Metadata first: the process and its tracks
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+               "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+               "\"args\":{\"name\":\"led_viz\"}}");
+  write_thread_name(out, TRACE_GPU_THREAD, "GPU");
+  uint32_t threads = atomic_load(&g_next_thread);
+  for (uint32_t t = 1; t < threads && t < TRACE_MAX_THREADS; t++) {
+    const char *name = atomic_load(&g_thread_names[t]);
+    if (name)
+      write_thread_name(out, t, name);
+  }
+
+  int count = 0;
+  for (uint64_t n = first; n < head; n++) {
+    TraceSlot *slot = &g_ring[n & (TRACE_CAPACITY - 1)];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != n + 1)
+      continue;
+    uint64_t start_ns =
+        atomic_load_explicit(&slot->start_ns, memory_order_relaxed);
+    uint64_t duration_ns =
+        atomic_load_explicit(&slot->duration_ns, memory_order_relaxed);
+    unsigned thread_stage =
+        atomic_load_explicit(&slot->thread_stage, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != n + 1)
+      continue; // overwritten while read
+
+    double ts_us = ((double)start_ns - (double)origin_ns) / 1000.0;
+    fprintf(out,
+            ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+            "\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+            trace_stage_name((TraceStage)(thread_stage & 0xFF)),
+            thread_stage >> 8 == TRACE_GPU_THREAD ? "gpu" : "cpu", ts_us,
+            duration_ns / 1000.0, thread_stage >> 8);
+    count++;
+  }
+  fprintf(out, "\n]}\n");
+  return ferror(out) ? -1 : count;
+}
+
+bool trace_save(const char *path) {
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    log_error("Cannot write trace %s: %s", path, strerror(errno));
+    return false;
+  }
+  int count = trace_write_json(out);
+  if (fclose(out) != 0 || count < 0) {
+    log_error("Writing trace %s failed", path);
+    return false;
+  }
+  log_info("Wrote %d trace event(s) to %s", count, path);
+  return true;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Frame tracing: scoped timers around the stages of a frame write into a
+// lock-free ring (any thread may write), which is dumped on demand as Chrome
+// trace JSON (chrome://tracing, ui.perfetto.dev), and/or add up per stage for
+// the perf overlay. While both are off a timer costs one relaxed load:
+//
+//   uint64_t t = trace_begin();
+//   ...stage...
+//   trace_end(TRACE_PROGRAM, t);
+
+typedef enum {
+  TRACE_FRAME,        // one whole frame, update to present
+  TRACE_PROGRAM,      // core_render: program, layers or transition
+  TRACE_LIGHT_UPLOAD, // light texture diff and upload
+  TRACE_GBUFFER,      // geometry into the G-buffer
+  TRACE_LIGHTING,     // deferred lighting pass
+  TRACE_DEPTH_BLIT,   // G-buffer depth copied to the screen
+  TRACE_SPHERES,      // forward pass of LED spheres
+  TRACE_HUD,
+  TRACE_PRESENT, // EndDrawing: swap and frame rate wait
+  TRACE_RELOAD,  // swapping in a finished build
+  TRACE_BUILD,   // a background build
+  NUM_TRACE_STAGES
+} TraceStage;
+
+// Thread id of the GPU track (timer query results)
+#define TRACE_GPU_THREAD 0
+
+// What the timers feed (g_trace_flags)
+#define TRACE_RECORD 1u // the ring
+#define TRACE_STATS 2u  // per-stage totals, see trace_take_totals()
+
+extern atomic_uint g_trace_flags;
+
+uint64_t trace_now_ns(void);
+
+// Record an event; thread is trace_thread_id() or TRACE_GPU_THREAD
+void trace_record(TraceStage stage, uint32_t thread, uint64_t start_ns,
+                  uint64_t duration_ns);
+
+// Small id of the calling thread (1 for the first thread that asks)
+uint32_t trace_thread_id(void);
+
+// Name the calling thread in the trace (name must stay valid, e.g. a
+// literal)
+void trace_name_thread(const char *name);
+
+// Start time of a stage, or 0 while the timers are off
+static inline uint64_t trace_begin(void) {
+  if (!atomic_load_explicit(&g_trace_flags, memory_order_relaxed))
+    return 0;
+  return trace_now_ns();
+}
+
+static inline void trace_end(TraceStage stage, uint64_t start_ns) {
+  if (start_ns)
+    trace_record(stage, trace_thread_id(), start_ns,
+                 trace_now_ns() - start_ns);
+}
+
+// Turn tracing on (from an empty trace) or off
+void trace_set_enabled(bool enabled);
+static inline bool trace_enabled(void) {
+  return atomic_load_explicit(&g_trace_flags, memory_order_relaxed) &
+         TRACE_RECORD;
+}
+
+// Turn the per-stage totals on (from zero) or off
+void trace_set_stats(bool enabled);
+
+// Nanoseconds spent per stage since the last call, on the CPU (all threads)
+// and on the GPU track, and start over
+void trace_take_totals(uint64_t cpu_ns[NUM_TRACE_STAGES],
+                       uint64_t gpu_ns[NUM_TRACE_STAGES]);
+
+const char *trace_stage_name(TraceStage stage);
+
+// Write the events still in the ring as Chrome trace JSON. Returns the
+// number written, or -1 if the write failed.
+int trace_write_json(FILE *out);
+
+// trace_write_json to a file, logging where it went
+bool trace_save(const char *path);
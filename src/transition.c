@@ -0,0 +1,109 @@
+#include "transition.h"
+#include "log.h"
+#include <stdlib.h>
+#include <string.h>
+
+const TransitionEntry transition_registry[] = {
+    {"Cut", NULL},
+    {"Crossfade", transition_crossfade},
+    {"Wipe", transition_wipe},
+    {"Radial", transition_radial},
+};
+
+const int NUM_TRANSITIONS =
+    sizeof(transition_registry) / sizeof(transition_registry[0]);
+
+// ============================================================================
+// Built-in transitions
+// ============================================================================
+
+// Shared with the SDK runtime (include/led_viz_sdk.c)
+#include "led_viz_transitions.h"
+
+// ============================================================================
+// Engine
+// ============================================================================
+
+bool transition_init(Transition *t, int num_pixels, double duration_ms,
+                     double budget_ms) {
+  transition_release(t);
+  t->from_pixels = calloc((size_t)num_pixels, sizeof(RGB));
+  t->to_pixels = calloc((size_t)num_pixels, sizeof(RGB));
+  if (!t->from_pixels || !t->to_pixels) {
+    transition_release(t);
+    return false;
+  }
+  t->num_pixels = num_pixels;
+  t->duration_ms = duration_ms;
+  t->budget_ms = budget_ms;
+  return true;
+}
+
+void transition_start(Transition *t, const Program *from, const RGB *current,
+                      double now_ms, double from_cost_ms) {
+  // The outgoing program carries on from what is on the LEDs right now; the
+  // incoming one starts from black
+  memcpy(t->from_pixels, current, (size_t)t->num_pixels * sizeof(RGB));
+  memset(t->to_pixels, 0, (size_t)t->num_pixels * sizeof(RGB));
+  t->from = from;
+  t->start_ms = now_ms;
+  t->overlap_cost_ms = 0.0;
+  t->warned = false;
+
+  // Assume the incoming program costs about as much as the outgoing one
+  if (2.0 * from_cost_ms > t->budget_ms) {
+    log_warning("Transition: '%s' takes %.2f ms per frame, running two "
+                "programs will likely exceed the %.2f ms frame budget",
+                from->name, from_cost_ms, t->budget_ms);
+    t->warned = true;
+  }
+}
+
+bool transition_active(const Transition *t) { return t->from != NULL; }
+
+uint8_t transition_progress(const Transition *t, double now_ms) {
+  if (t->duration_ms <= 0.0)
+    return 255;
+  double p = (now_ms - t->start_ms) / t->duration_ms;
+  if (p <= 0.0)
+    return 0;
+  if (p >= 1.0)
+    return 255;
+  return (uint8_t)(p * 255.0);
+}
+
+void transition_record_cost(Transition *t, double from_ms, double to_ms) {
+  double cost = from_ms + to_ms;
+  t->overlap_cost_ms = t->overlap_cost_ms > 0.0
+                           ? 0.8 * t->overlap_cost_ms + 0.2 * cost
+                           : cost;
+
+  if (!t->warned && t->overlap_cost_ms > t->budget_ms) {
+    log_warning("Transition overlap costs %.2f ms per frame (%.2f + %.2f), "
+                "over the %.2f ms frame budget",
+                t->overlap_cost_ms, from_ms, to_ms, t->budget_ms);
+    t->warned = true;
+  }
+}
+
+void transition_mix(const Transition *t, RGB *out, int num_strips, int stride,
+                    uint8_t progress) {
+  TransitionFunc func = t->func ? t->func : transition_crossfade;
+  for (int s = 0; s < num_strips; s++) {
+    int count = get_strip_num_leds(s);
+    size_t off = (size_t)s * stride;
+    func(s, t->from_pixels + off, t->to_pixels + off, out + off, count,
+         progress);
+  }
+}
+
+void transition_end(Transition *t) { t->from = NULL; }
+
+void transition_release(Transition *t) {
+  free(t->from_pixels);
+  free(t->to_pixels);
+  t->from_pixels = NULL;
+  t->to_pixels = NULL;
+  t->num_pixels = 0;
+  t->from = NULL;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// Program transitions: while switching, the outgoing and incoming programs
+// both keep running into their own buffers and a TransitionFunc mixes them.
+
+#include "programs.h"
+#include <stdbool.h>
+
+typedef struct {
+  const Program *from; // outgoing program, NULL when no transition runs
+  RGB *from_pixels;
+  RGB *to_pixels;
+  int num_pixels;
+  double start_ms;
+  double duration_ms;
+  TransitionFunc func;
+  // Cost of running both programs per overlap frame, checked against budget
+  double budget_ms;
+  double overlap_cost_ms;
+  bool warned;
+} Transition;
+
+// Transition registry for UI (entry 0 is a hard cut)
+typedef struct {
+  const char *name;
+  TransitionFunc func;
+} TransitionEntry;
+
+extern const TransitionEntry transition_registry[];
+extern const int NUM_TRANSITIONS;
+
+// Allocate both buffers (num_pixels LEDs each). Returns false without memory.
+bool transition_init(Transition *t, int num_pixels, double duration_ms,
+                     double budget_ms);
+
+// Begin switching away from `from`, whose latest frame is `current`.
+// from_cost_ms is what `from` alone costs per frame, used to warn up front if
+// running two such programs would not fit the frame budget.
+void transition_start(Transition *t, const Program *from, const RGB *current,
+                      double now_ms, double from_cost_ms);
+
+// True while a transition is running
+bool transition_active(const Transition *t);
+
+// 0-255 position of the transition at now_ms
+uint8_t transition_progress(const Transition *t, double now_ms);
+
+// Record what rendering both programs cost this frame
+void transition_record_cost(Transition *t, double from_ms, double to_ms);
+
+// Mix the two buffers into out strip by strip (stride LEDs per strip)
+void transition_mix(const Transition *t, RGB *out, int num_strips, int stride,
+                    uint8_t progress);
+
+// End the transition (the caller cleans up the outgoing program)
+void transition_end(Transition *t);
+
+// Free both buffers
+void transition_release(Transition *t);
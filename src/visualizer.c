@@ -2,6 +2,7 @@
 #include "programs.h"
 #include "raymath.h"
 #include "rlgl.h"
+#include "trace.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,168 +10,85 @@
 
 #define GLSL_VERSION 330
 
-// Light texture width: 2 pixels per light (pos+intensity, color+enabled)
-// We cluster LEDs into groups to reduce shader light count
-#define LIGHT_TEX_WIDTH (MAX_TOTAL_SHADER_LIGHTS * 2)
-
-// Global pointer to strips for pixel function (set before calling program
-// update)
-static LedStrip *g_strips = NULL;
-
-// Strip setup (for built-in programs using accessor functions)
-static const StripDef *g_strip_setup = NULL;
-static int g_num_strips = 0;
-
-// Runtime accessors (implementation for built-in programs)
-int get_num_strips(void) { return g_num_strips; }
-
-int get_strip_num_leds(int strip) {
-  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
-    return 0;
-  return g_strip_setup[strip].num_leds;
-}
-
-float get_strip_position(int strip) {
-  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
-    return 0.0f;
-  return g_strip_setup[strip].position;
-}
-
-float get_strip_length_cm(int strip) {
-  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
-    return 0.0f;
-  return g_strip_setup[strip].length_cm;
-}
-
-int get_matrix_width(int strip) {
-  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
-    return 0;
-  return g_strip_setup[strip].matrix_width;
-}
-
-int get_matrix_height(int strip) {
-  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
-    return 0;
-  return g_strip_setup[strip].matrix_height;
+// Light texture: 2 pixels per light (pos+intensity, color+enabled), in rows
+// of LIGHT_TEX_WIDTH texels, as many as the strips need. GL 3.3 guarantees
+// textures 1024 wide. We cluster LEDs into groups to reduce shader light count
+#define LIGHT_TEX_WIDTH 1024
+
+// Dirty tracking for the light texture. Strips the core flags as touched
+// (PixelFunc writes, direct spans, layers, transitions) are diffed against the
+// last uploaded colors, cluster by cluster. All in state->arena.
+static uint8_t *g_cluster_dirty = NULL; // per shader light
+static uint8_t *g_strip_dirty = NULL;
+static int *g_strip_light_offset = NULL;
+static int *g_strip_num_lights = NULL;
+static RGB *g_uploaded = NULL; // laid out like the core's framebuffer
+static float *g_light_data = NULL; // light texture contents, 4 per texel
+
+// Start and end a traced render stage: a CPU timer and a GPU timer query
+static uint64_t stage_begin(VisualizerState *state, TraceStage stage) {
+  uint64_t start = trace_begin();
+  gpu_timer_begin(&state->gpu_timer, stage, start);
+  return start;
 }
 
-bool is_matrix(int strip) {
-  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
-    return false;
-  return g_strip_setup[strip].matrix_width > 0 &&
-         g_strip_setup[strip].matrix_height > 0;
+static void stage_end(VisualizerState *state, TraceStage stage,
+                      uint64_t start) {
+  gpu_timer_end(&state->gpu_timer);
+  trace_end(stage, start);
 }
 
-int get_matrix_index(int strip, int x, int y) {
-  if (strip < 0 || strip >= g_num_strips || !g_strip_setup)
-    return 0;
-
-  int width = g_strip_setup[strip].matrix_width;
-  int height = g_strip_setup[strip].matrix_height;
-
-  if (width <= 0 || height <= 0)
-    return 0;
-
-  // Clamp coordinates
-  if (x < 0) x = 0;
-  if (x >= width) x = width - 1;
-  if (y < 0) y = 0;
-  if (y >= height) y = height - 1;
-
-  // Serpentine layout: even columns go down, odd columns go up
-  if (x & 1) {
-    // Odd column, reverse y
-    return x * height + (height - 1 - y);
-  } else {
-    // Even column, straight y
-    return x * height + y;
-  }
+// Framebuffer color of an LED as a drawable raylib color
+static inline Color led_color(const VisualizerState *state, int strip,
+                              int led) {
+  RGB px = state->core.framebuffer[strip * state->core.stride + led];
+  return (Color){px.r, px.g, px.b, 255};
 }
 
-// Pixel access function for simulator - reads/writes to LedStrip color data
-static void simulator_pixel(int strip, int led, uint8_t *r, uint8_t *g,
-                            uint8_t *b) {
-  Light *light = &g_strips[strip].leds[led];
-  if (r && g && b) {
-    // Set pixel
-    light->color.r = *r;
-    light->color.g = *g;
-    light->color.b = *b;
-  }
-  // Always return current values
-  *r = light->color.r;
-  *g = light->color.g;
-  *b = light->color.b;
+static Vector3 vector3_from(const float v[3]) {
+  return (Vector3){v[0], v[1], v[2]};
 }
 
-static void led_strip_create(LedStrip *strip, int num_leds, Vector3 position,
-                             Vector3 rotation, float spacing, float intensity,
+// Lights for the LEDs of strip s, where the core placed them (strip->leds
+// has room for them)
+static void led_strip_create(VisualizerState *state, int s, float intensity,
                              float radius) {
-  strip->num_leds = num_leds;
-  strip->position = position;
-  strip->rotation = rotation;
-  strip->spacing = spacing;
+  const StripLayout *layout = &state->core.layout[s];
+  LedStrip *strip = &state->strips[s];
+  strip->num_leds = layout->num_leds;
+  strip->position = vector3_from(layout->origin);
+  strip->rotation = vector3_from(layout->rotation);
+  strip->spacing = layout->spacing;
   strip->intensity = intensity;
   strip->radius = radius;
-  memset(strip->leds, 0, sizeof(strip->leds));
-
-  Matrix rot = MatrixRotateXYZ((Vector3){
-      rotation.x * DEG2RAD, rotation.y * DEG2RAD, rotation.z * DEG2RAD});
-
-  for (int i = 0; i < num_leds; i++) {
-    Vector3 local_pos = {(float)i * spacing, 0.0f, 0.0f};
-    Vector3 world_pos = Vector3Add(position, Vector3Transform(local_pos, rot));
 
+  for (int i = 0; i < layout->num_leds; i++) {
     strip->leds[i] = (Light){
         .enabled = true,
-        .position = world_pos,
-        .color = (Color){0, 0, 0, 255},
+        .position =
+            vector3_from(state->core.led_position[s * state->core.stride + i]),
         .radius = radius,
         .attenuation = intensity,
     };
   }
 }
 
-// Create a matrix with LEDs laid out in a 2D grid (serpentine wiring)
-static void led_matrix_create(LedStrip *strip, int width, int height,
-                              Vector3 position, float pixel_spacing,
-                              float intensity, float radius) {
-  int num_leds = width * height;
-  strip->num_leds = num_leds;
-  strip->position = position;
-  strip->rotation = (Vector3){0.0f, 0.0f, 0.0f};
-  strip->spacing = pixel_spacing;
-  strip->intensity = intensity;
-  strip->radius = radius;
-  memset(strip->leds, 0, sizeof(strip->leds));
-
-  // Lay out LEDs in a 2D grid matching serpentine layout
-  // x = column (0 to width-1, left to right)
-  // y = row (0 to height-1, bottom to top)
-  for (int x = 0; x < width; x++) {
-    for (int y = 0; y < height; y++) {
-      // Calculate linear index using serpentine layout
-      int idx;
-      if (x & 1) {
-        // Odd column, reverse y
-        idx = x * height + (height - 1 - y);
-      } else {
-        // Even column, straight y
-        idx = x * height + y;
-      }
+// Mark clusters of touched strips whose colors differ from the last upload
+static void diff_touched_strips(VisualizerState *state) {
+  for (int s = 0; s < state->core.num_strips; s++) {
+    if (!state->core.strip_touched[s])
+      continue;
+    state->core.strip_touched[s] = 0;
 
-      // Position: x horizontal, y vertical (centered on position)
-      float px = position.x + (x - (width - 1) / 2.0f) * pixel_spacing;
-      float py = position.y + (y - (height - 1) / 2.0f) * pixel_spacing;
-      float pz = position.z;
-
-      strip->leds[idx] = (Light){
-          .enabled = true,
-          .position = (Vector3){px, py, pz},
-          .color = (Color){0, 0, 0, 255},
-          .radius = radius,
-          .attenuation = intensity,
-      };
+    const RGB *pixels = &state->core.framebuffer[s * state->core.stride];
+    const RGB *uploaded = &g_uploaded[s * state->core.stride];
+    for (int g = 0; g < g_strip_num_lights[s]; g++) {
+      int start = g * LEDS_PER_SHADER_LIGHT;
+      if (memcmp(pixels + start, uploaded + start,
+                 LEDS_PER_SHADER_LIGHT * sizeof(RGB)) != 0) {
+        g_cluster_dirty[g_strip_light_offset[s] + g] = 1;
+        g_strip_dirty[s] = 1;
+      }
     }
   }
 }
@@ -178,15 +96,34 @@ static void led_matrix_create(LedStrip *strip, int width, int height,
 static void update_light_texture(VisualizerState *state) {
   // Each shader light uses 2 RGBA pixels: (pos.xyz, intensity), (color.rgb,
   // enabled) We cluster LEDS_PER_SHADER_LIGHT LEDs into one shader light
-  static float lightData[LIGHT_TEX_WIDTH * 4];
-  int numShaderLights = 0;
+  float *lightData = g_light_data;
+
+  // Positions and enabled flags only change with the layout (or KEY_T);
+  // otherwise only clusters whose colors changed are rebuilt and uploaded
+  bool full = state->lights_stale;
+  state->lights_stale = false;
+  diff_touched_strips(state);
+
+  int first = -1, last = -1;
+  for (int s = 0; s < state->core.num_strips; s++) {
+    if (!full && !g_strip_dirty[s])
+      continue;
+    g_strip_dirty[s] = 0;
 
-  for (int s = 0; s < state->num_strips; s++) {
     LedStrip *strip = &state->strips[s];
-    int numGroups = strip->num_leds / LEDS_PER_SHADER_LIGHT;
+    const RGB *pixels = &state->core.framebuffer[s * state->core.stride];
+    RGB *uploaded = &g_uploaded[s * state->core.stride];
+    int numGroups = g_strip_num_lights[s];
 
     for (int g = 0; g < numGroups; g++) {
+      int light = g_strip_light_offset[s] + g;
+      if (!full && !g_cluster_dirty[light])
+        continue;
+      g_cluster_dirty[light] = 0;
+
       int start = g * LEDS_PER_SHADER_LIGHT;
+      memcpy(uploaded + start, pixels + start,
+             LEDS_PER_SHADER_LIGHT * sizeof(RGB));
 
       // Average position and color across the group
       float px = 0, py = 0, pz = 0;
@@ -196,19 +133,20 @@ static void update_light_texture(VisualizerState *state) {
 
       for (int j = 0; j < LEDS_PER_SHADER_LIGHT; j++) {
         Light *led = &strip->leds[start + j];
+        const RGB *color = &pixels[start + j];
         px += led->position.x;
         py += led->position.y;
         pz += led->position.z;
-        r += led->color.r / 255.0f;
-        gr += led->color.g / 255.0f;
-        b += led->color.b / 255.0f;
+        r += color->r / 255.0f;
+        gr += color->g / 255.0f;
+        b += color->b / 255.0f;
         intensity += led->attenuation;
         if (led->enabled)
           enabledCount++;
       }
 
       float inv = 1.0f / LEDS_PER_SHADER_LIGHT;
-      int baseIdx = numShaderLights * 2 * 4;
+      int baseIdx = light * 2 * 4;
 
       // Pixel 0: averaged position + summed intensity
       lightData[baseIdx + 0] = px * inv;
@@ -222,16 +160,39 @@ static void update_light_texture(VisualizerState *state) {
       lightData[baseIdx + 6] = b * inv;
       lightData[baseIdx + 7] = enabledCount > 0 ? 1.0f : 0.0f;
 
-      numShaderLights++;
+      if (first < 0)
+        first = light;
+      last = light;
     }
   }
 
-  rlUpdateTexture(state->lightTexture, 0, 0, LIGHT_TEX_WIDTH, 1,
-                  RL_PIXELFORMAT_UNCOMPRESSED_R32G32B32A32, lightData);
+  // Upload only the texels between the first and last changed light: that
+  // span of one row, or every row it touches (lights never straddle rows)
+  if (first >= 0) {
+    int width = state->lightTexWidth;
+    int firstRow = first * 2 / width, lastRow = last * 2 / width;
+    if (firstRow == lastRow) {
+      rlUpdateTexture(state->lightTexture, first * 2 % width, firstRow,
+                      (last - first + 1) * 2, 1,
+                      RL_PIXELFORMAT_UNCOMPRESSED_R32G32B32A32,
+                      &lightData[first * 2 * 4]);
+    } else {
+      rlUpdateTexture(state->lightTexture, 0, firstRow, width,
+                      lastRow - firstRow + 1,
+                      RL_PIXELFORMAT_UNCOMPRESSED_R32G32B32A32,
+                      &lightData[firstRow * width * 4]);
+    }
+  }
 
-  int numLightsLoc = GetShaderLocation(state->deferredShader, "numLights");
-  SetShaderValue(state->deferredShader, numLightsLoc, &numShaderLights,
-                 SHADER_UNIFORM_INT);
+  if (full) {
+    int numShaderLights = 0;
+    for (int s = 0; s < state->core.num_strips; s++) {
+      numShaderLights += g_strip_num_lights[s];
+    }
+    int numLightsLoc = GetShaderLocation(state->deferredShader, "numLights");
+    SetShaderValue(state->deferredShader, numLightsLoc, &numShaderLights,
+                   SHADER_UNIFORM_INT);
+  }
 }
 
 static void draw_person(Person *p, double time_ms) {
@@ -293,6 +254,24 @@ static void init_gbuffer(GBuffer *gb, int width, int height) {
   }
 }
 
+// (Re)create the light texture with room for rows of lights
+static void load_light_texture(VisualizerState *state, int rows) {
+  if (state->lightTexture != 0) {
+    rlUnloadTexture(state->lightTexture);
+  }
+  state->lightTexture = rlLoadTexture(
+      NULL, LIGHT_TEX_WIDTH, rows, RL_PIXELFORMAT_UNCOMPRESSED_R32G32B32A32, 1);
+  rlTextureParameters(state->lightTexture, RL_TEXTURE_MIN_FILTER,
+                      RL_TEXTURE_FILTER_NEAREST);
+  rlTextureParameters(state->lightTexture, RL_TEXTURE_MAG_FILTER,
+                      RL_TEXTURE_FILTER_NEAREST);
+  rlTextureParameters(state->lightTexture, RL_TEXTURE_WRAP_S,
+                      RL_TEXTURE_WRAP_CLAMP);
+  rlTextureParameters(state->lightTexture, RL_TEXTURE_WRAP_T,
+                      RL_TEXTURE_WRAP_CLAMP);
+  state->lightTexHeight = rows;
+}
+
 void visualizer_init(VisualizerState *state) {
   if (state->gbufferShader.id != 0) {
     UnloadShader(state->gbufferShader);
@@ -350,27 +329,14 @@ void visualizer_init(VisualizerState *state) {
   int screenHeight = GetScreenHeight();
   init_gbuffer(&state->gbuffer, screenWidth, screenHeight);
 
-  // Create light data texture (1D texture as 1-row 2D texture)
-  state->lightTexture = rlLoadTexture(
-      NULL, LIGHT_TEX_WIDTH, 1, RL_PIXELFORMAT_UNCOMPRESSED_R32G32B32A32, 1);
-  rlTextureParameters(state->lightTexture, RL_TEXTURE_MIN_FILTER,
-                      RL_TEXTURE_FILTER_NEAREST);
-  rlTextureParameters(state->lightTexture, RL_TEXTURE_MAG_FILTER,
-                      RL_TEXTURE_FILTER_NEAREST);
-  rlTextureParameters(state->lightTexture, RL_TEXTURE_WRAP_S,
-                      RL_TEXTURE_WRAP_CLAMP);
-  rlTextureParameters(state->lightTexture, RL_TEXTURE_WRAP_T,
-                      RL_TEXTURE_WRAP_CLAMP);
+  // Create light data texture (one row until strips are configured)
+  load_light_texture(state, 1);
+  gpu_timer_init(&state->gpu_timer);
 
-  state->num_strips = 0;
-  state->active_program = 0;
-  state->current_program = NULL; // Set by main after loading
-  state->active_palette = 0;
-  state->current_palette = palette_registry[0].palette;
+  core_init(&state->core, 1000.0 / TARGET_FPS);
+  state->lights_stale = true;
   state->start_time = GetTime();
-  state->time_ms = 0;
-  state->last_frame_time = state->start_time;
-  state->smoothed_delta = 1.0 / 60.0; // assume 60fps initially
+  clock_init(&state->clock, CLOCK_WALL, TARGET_FPS, state->start_time);
 
   state->simple_render_mode = false;
 
@@ -402,77 +368,67 @@ void visualizer_init(VisualizerState *state) {
 
 void visualizer_configure_strips(VisualizerState *state,
                                  const StripDef *strip_setup, int num_strips) {
-  // Store for accessor functions
-  g_strip_setup = strip_setup;
-  g_num_strips = num_strips;
+  core_configure_strips(&state->core, strip_setup, num_strips);
+  const CoreState *core = &state->core;
 
-  // Clamp to max strips
-  if (num_strips > MAX_STRIPS)
-    num_strips = MAX_STRIPS;
-  state->num_strips = num_strips;
+  // Shader light clusters per strip, numbered across strips
+  int lights = 0;
+  for (int i = 0; i < core->num_strips; i++) {
+    lights += core->layout[i].num_leds / LEDS_PER_SHADER_LIGHT;
+  }
+  int rows = (lights * 2 + LIGHT_TEX_WIDTH - 1) / LIGHT_TEX_WIDTH;
+  if (rows < 1)
+    rows = 1;
+
+  // Everything per strip and per light in one block
+  size_t n = (size_t)core->num_strips;
+  size_t size = arena_size(n * sizeof(LedStrip)) + arena_size(lights) +
+                arena_size(n) + 2 * arena_size(n * sizeof(int)) +
+                arena_size(core_num_pixels(core) * sizeof(RGB)) +
+                arena_size((size_t)rows * LIGHT_TEX_WIDTH * 4 * sizeof(float));
+  for (int i = 0; i < core->num_strips; i++) {
+    size += arena_size(core->layout[i].num_leds * sizeof(Light));
+  }
+  if (!arena_reset(&state->arena, size)) {
+    TraceLog(LOG_ERROR, "No memory for the lights of %d strips",
+             core->num_strips);
+    core_configure_strips(&state->core, NULL, 0);
+    arena_reset(&state->arena, 0);
+    lights = 0;
+    rows = 1;
+    n = 0;
+  }
+  state->strips = arena_alloc(&state->arena, n * sizeof(LedStrip));
+  g_cluster_dirty = arena_alloc(&state->arena, lights);
+  g_strip_dirty = arena_alloc(&state->arena, n);
+  g_strip_light_offset = arena_alloc(&state->arena, n * sizeof(int));
+  g_strip_num_lights = arena_alloc(&state->arena, n * sizeof(int));
+  g_uploaded =
+      arena_alloc(&state->arena, core_num_pixels(core) * sizeof(RGB));
+  g_light_data = arena_alloc(&state->arena, (size_t)rows * LIGHT_TEX_WIDTH *
+                                                4 * sizeof(float));
 
   float led_radius = 0.004f;
   float led_intensity = 0.0015f;
-
-  // Create strips/matrices from StripDef array
-  for (int i = 0; i < num_strips; i++) {
-    int num_leds = strip_setup[i].num_leds;
-    if (num_leds > MAX_LEDS_PER_STRIP)
-      num_leds = MAX_LEDS_PER_STRIP;
-
-    // Map position (-1.0 to 1.0) to x coordinate (-0.75 to +0.75)
-    float x = strip_setup[i].position * 0.75f;
-
-    int matrix_w = strip_setup[i].matrix_width;
-    int matrix_h = strip_setup[i].matrix_height;
-
-    if (matrix_w > 0 && matrix_h > 0) {
-      // Create as 2D matrix
-      // Convert length_cm to pixel spacing (length_cm is width of matrix)
-      float width_m = strip_setup[i].length_cm > 0
-                          ? strip_setup[i].length_cm / 100.0f
-                          : (float)matrix_w * 0.01f;
-      float pixel_spacing = matrix_w > 1 ? width_m / (float)(matrix_w - 1)
-                                         : 0.01f;
-
-      led_matrix_create(&state->strips[i], matrix_w, matrix_h,
-                        (Vector3){x, 1.0f, -2.95f}, pixel_spacing,
-                        led_intensity, led_radius);
-    } else {
-      // Create as 1D strip
-      float length_m = strip_setup[i].length_cm > 0
-                           ? strip_setup[i].length_cm / 100.0f
-                           : 1.0f;
-      float led_spacing = num_leds > 1 ? length_m / (float)(num_leds - 1) : 0.0f;
-
-      led_strip_create(&state->strips[i], num_leds, (Vector3){x, 1.0f, -2.95f},
-                       (Vector3){0.0f, 0.0f, 90.0f}, led_spacing, led_intensity,
-                       led_radius);
-    }
+  lights = 0;
+  for (int i = 0; i < core->num_strips; i++) {
+    state->strips[i].leds = arena_alloc(
+        &state->arena, core->layout[i].num_leds * sizeof(Light));
+    led_strip_create(state, i, led_intensity, led_radius);
+    g_strip_light_offset[i] = lights;
+    g_strip_num_lights[i] = state->strips[i].num_leds / LEDS_PER_SHADER_LIGHT;
+    lights += g_strip_num_lights[i];
   }
 
-  TraceLog(LOG_INFO, "Configured %d strips", num_strips);
+  // The texture grows (or shrinks) to the rows the lights need
+  if (rows != state->lightTexHeight) {
+    load_light_texture(state, rows);
+  }
+  state->lights_stale = true;
 }
 
 void visualizer_update(VisualizerState *state) {
-  // Smoothed delta time accumulation to avoid frame jitter
-  double current_time = GetTime();
-  double raw_delta = current_time - state->last_frame_time;
-  state->last_frame_time = current_time;
-
-  // Clamp raw delta to avoid large jumps (e.g., after window drag)
-  if (raw_delta > 0.1)
-    raw_delta = 0.1;
-  if (raw_delta < 0.0)
-    raw_delta = 0.0;
-
-  // Exponential moving average smoothing (alpha ~0.2 for strong smoothing)
-  const double alpha = 0.2;
-  state->smoothed_delta =
-      alpha * raw_delta + (1.0 - alpha) * state->smoothed_delta;
-
-  // Accumulate smoothed time
-  state->time_ms += state->smoothed_delta * 1000.0;
+  state->core.time_ms = clock_next(&state->clock, GetTime());
 
   float cameraPos[3] = {state->camera.position.x, state->camera.position.y,
                         state->camera.position.z};
@@ -480,25 +436,24 @@ void visualizer_update(VisualizerState *state) {
                  state->deferredShader.locs[SHADER_LOC_VECTOR_VIEW], cameraPos,
                  SHADER_UNIFORM_VEC3);
 
-  if (IsKeyPressed(KEY_P) && state->programs && state->num_programs > 0) {
-    // Cleanup old program if it has a cleanup function
-    if (state->current_program && state->current_program->cleanup) {
-      state->current_program->cleanup();
-    }
-    state->active_program = (state->active_program + 1) % state->num_programs;
-    state->current_program = &state->programs[state->active_program];
-    // Initialize new program if it has an init function
-    if (state->current_program->init) {
-      state->current_program->init();
-    }
+  CoreState *core = &state->core;
+  if (IsKeyPressed(KEY_P) && core->programs && core->num_programs > 0) {
+    core_switch_program(core,
+                        (core->active_program + 1) % core->num_programs);
+  }
+
+  if (IsKeyPressed(KEY_C)) {
+    core->active_transition = (core->active_transition + 1) % NUM_TRANSITIONS;
+    core->transition.func = transition_registry[core->active_transition].func;
   }
 
   if (IsKeyPressed(KEY_T)) {
-    for (int s = 0; s < state->num_strips; s++) {
+    for (int s = 0; s < core->num_strips; s++) {
       for (int i = 0; i < state->strips[s].num_leds; i++) {
         state->strips[s].leds[i].enabled = !state->strips[s].leds[i].enabled;
       }
     }
+    state->lights_stale = true;
   }
 
   if (IsKeyPressed(KEY_X)) {
@@ -514,22 +469,29 @@ void visualizer_update(VisualizerState *state) {
   }
 
   if (IsKeyPressed(KEY_O)) {
-    state->active_palette = (state->active_palette + 1) % NUM_PALETTES;
-    state->current_palette = palette_registry[state->active_palette].palette;
+    core_select_palette(core, (core->active_palette + 1) % NUM_PALETTES);
   }
 
   if (state->camera_mode == CAMERA_FIRST_PERSON) {
     UpdateCamera(&state->camera, CAMERA_FIRST_PERSON);
   }
 
-  // Update LED colors via current program
-  g_strips = state->strips;
-  if (state->current_program && state->current_program->update) {
-    state->current_program->update(state->time_ms, simulator_pixel,
-                                   *state->current_palette);
+  if (IsKeyPressed(KEY_L) && core->compositor.num_layers > 0) {
+    core->compositor.enabled = !core->compositor.enabled;
   }
 
+  if (IsKeyPressed(KEY_F3)) {
+    state->perf_hud = !state->perf_hud;
+    perf_stats_reset(&state->perf);
+    trace_set_stats(state->perf_hud);
+  }
+
+  uint64_t trace_start = trace_begin();
+  core_render(core);
+  trace_end(TRACE_PROGRAM, trace_start);
+  trace_start = trace_begin();
   update_light_texture(state);
+  trace_end(TRACE_LIGHT_UPLOAD, trace_start);
 }
 
 static void draw_scene_geometry(VisualizerState *state) {
@@ -542,11 +504,11 @@ static void draw_scene_geometry(VisualizerState *state) {
   DrawCube((Vector3){0.0f, 1.5f, 3.0f}, 5.0f, 3.0f, 0.01f, GRAY);
 
   for (int p = 0; p < NUM_PEOPLE; p++) {
-    draw_person(&state->people[p], state->time_ms);
+    draw_person(&state->people[p], state->core.time_ms);
   }
 
   // LED strip housings
-  for (int s = 0; s < state->num_strips; s++) {
+  for (int s = 0; s < state->core.num_strips; s++) {
     LedStrip *strip = &state->strips[s];
     float strip_len = (strip->num_leds - 1) * strip->spacing;
     Vector3 rot = strip->rotation;
@@ -566,6 +528,94 @@ static void draw_scene_geometry(VisualizerState *state) {
   }
 }
 
+// Perf overlay, top right: frame time graph with the program, upload and
+// reload share of each frame, percentiles, and a stacked bar of the mean
+// time per part against the frame budget
+#define PERF_HUD_WIDTH (PERF_HISTORY * 3 / 2)
+#define PERF_GRAPH_HEIGHT 80
+
+static void draw_perf_hud(VisualizerState *state) {
+  const Color perf_part_colors[NUM_PERF_PARTS] = {
+      [PERF_PROGRAM] = GREEN,   [PERF_LIGHT_UPLOAD] = SKYBLUE,
+      [PERF_LIGHTING] = ORANGE, [PERF_SPHERES] = PURPLE,
+      [PERF_RELOAD] = MAGENTA,
+  };
+  PerfStats *perf = &state->perf;
+  int x = GetScreenWidth() - PERF_HUD_WIDTH - 10, y = 10;
+  float budget_ms = 1000.0f / TARGET_FPS;
+  float p50, p95, p99;
+  perf_stats_percentiles(perf, &p50, &p95, &p99);
+  float means[NUM_PERF_PARTS];
+  perf_stats_means(perf, means);
+
+  DrawRectangle(x - 5, y - 5, PERF_HUD_WIDTH + 10,
+                PERF_GRAPH_HEIGHT + 55 + 15 * (NUM_PERF_PARTS + 1),
+                Fade(BLACK, 0.6f));
+  DrawText(TextFormat("frame p50 %.1f  p95 %.1f  p99 %.1f ms", p50, p95,
+                      p99),
+           x, y, 10, RAYWHITE);
+  y += 15;
+
+  // One column per frame, scaled so twice the budget (or p99) fits
+  float scale_ms = p99 > 2.0f * budget_ms ? p99 : 2.0f * budget_ms;
+  float px_per_ms = PERF_GRAPH_HEIGHT / scale_ms;
+  int bottom = y + PERF_GRAPH_HEIGHT;
+  for (int i = 0; i < perf->count; i++) {
+    int slot = perf_stats_slot(perf, i);
+    const float *parts = perf->part_ms[slot];
+    float frame_ms = perf->frame_ms[slot];
+    int column = x + (PERF_HISTORY - perf->count + i) * 3 / 2;
+    float top = bottom - fminf(frame_ms, scale_ms) * px_per_ms;
+    DrawLine(column, bottom, column, (int)top,
+             frame_ms > budget_ms * 1.5f ? RED : GRAY);
+    // CPU parts that run inside the frame, stacked from the bottom
+    float level = bottom;
+    static const PerfPart stacked[] = {PERF_PROGRAM, PERF_LIGHT_UPLOAD,
+                                       PERF_RELOAD};
+    for (int p = 0; p < 3; p++) {
+      float height = parts[stacked[p]] * px_per_ms;
+      if (height < 0.5f)
+        continue;
+      float next = fmaxf(level - height, top);
+      DrawLine(column, (int)level, column, (int)next,
+               perf_part_colors[stacked[p]]);
+      level = next;
+    }
+  }
+  int budget_y = bottom - (int)(budget_ms * px_per_ms);
+  DrawLine(x, budget_y, x + PERF_HUD_WIDTH, budget_y, YELLOW);
+  y = bottom + 8;
+
+  // Mean of each part as a stacked bar, the full width being the budget
+  float bar_x = x;
+  for (int p = 0; p < NUM_PERF_PARTS; p++) {
+    float width = fminf(means[p] / budget_ms * PERF_HUD_WIDTH,
+                        x + PERF_HUD_WIDTH - bar_x);
+    DrawRectangle((int)bar_x, y, (int)ceilf(width), 10, perf_part_colors[p]);
+    bar_x += width;
+  }
+  DrawRectangleLines(x, y, PERF_HUD_WIDTH, 10, YELLOW);
+  y += 16;
+  for (int p = 0; p < NUM_PERF_PARTS; p++) {
+    DrawRectangle(x, y + 1, 8, 8, perf_part_colors[p]);
+    DrawText(TextFormat("%-12s %6.2f ms %s", perf_part_name(p), means[p],
+                        perf->part_gpu[p] ? "GPU" : "CPU"),
+             x + 14, y, 10, RAYWHITE);
+    y += 15;
+  }
+
+  // What the program costs per LED it lights
+  int num_leds = 0;
+  for (int s = 0; s < state->core.num_strips; s++) {
+    num_leds += state->strips[s].num_leds;
+  }
+  DrawText(TextFormat("program %.0f us per frame, %.1f ns per LED (%d)",
+                      means[PERF_PROGRAM] * 1000.0f,
+                      num_leds ? means[PERF_PROGRAM] * 1e6f / num_leds : 0.0f,
+                      num_leds),
+           x, y, 10, RAYWHITE);
+}
+
 void visualizer_draw(VisualizerState *state) {
   int screenWidth = GetScreenWidth();
   int screenHeight = GetScreenHeight();
@@ -576,23 +626,27 @@ void visualizer_draw(VisualizerState *state) {
     // === Simple mode: just draw LED pixels on black background ===
     ClearBackground(BLACK);
 
+    uint64_t trace_start = stage_begin(state, TRACE_SPHERES);
     BeginMode3D(state->camera);
 
-    for (int s = 0; s < state->num_strips; s++) {
+    for (int s = 0; s < state->core.num_strips; s++) {
       LedStrip *strip = &state->strips[s];
       for (int i = 0; i < strip->num_leds; i++) {
         Light *led = &strip->leds[i];
         if (led->enabled) {
-          DrawSphereEx(led->position, led->radius * 2.0f, 6, 6, led->color);
+          DrawSphereEx(led->position, led->radius * 2.0f, 6, 6,
+                       led_color(state, s, i));
         }
       }
     }
 
     EndMode3D();
+    stage_end(state, TRACE_SPHERES, trace_start);
   } else {
     // === Full deferred rendering ===
 
     // === PASS 1: Render geometry to G-buffer ===
+    uint64_t trace_start = stage_begin(state, TRACE_GBUFFER);
     rlEnableFramebuffer(state->gbuffer.framebuffer);
     rlClearColor(0, 0, 0, 0);
     rlClearScreenBuffers();
@@ -607,8 +661,10 @@ void visualizer_draw(VisualizerState *state) {
     EndMode3D();
 
     rlEnableColorBlend();
+    stage_end(state, TRACE_GBUFFER, trace_start);
 
     // === PASS 2: Deferred lighting to screen ===
+    trace_start = stage_begin(state, TRACE_LIGHTING);
     rlDisableFramebuffer();
     rlClearScreenBuffers();
 
@@ -632,46 +688,84 @@ void visualizer_draw(VisualizerState *state) {
 
     rlDisableShader();
     rlEnableColorBlend();
+    stage_end(state, TRACE_LIGHTING, trace_start);
 
     // Copy depth buffer for correct occlusion of forward-rendered elements
+    trace_start = stage_begin(state, TRACE_DEPTH_BLIT);
     rlBindFramebuffer(RL_READ_FRAMEBUFFER, state->gbuffer.framebuffer);
     rlBindFramebuffer(RL_DRAW_FRAMEBUFFER, 0);
     rlBlitFramebuffer(0, 0, screenWidth, screenHeight, 0, 0, screenWidth,
                       screenHeight, 0x00000100); // GL_DEPTH_BUFFER_BIT
     rlDisableFramebuffer();
+    stage_end(state, TRACE_DEPTH_BLIT, trace_start);
 
     // === Forward pass: Draw LED spheres (emissive, not lit) ===
+    trace_start = stage_begin(state, TRACE_SPHERES);
     BeginMode3D(state->camera);
     rlEnableShader(rlGetShaderIdDefault());
 
-    for (int s = 0; s < state->num_strips; s++) {
+    for (int s = 0; s < state->core.num_strips; s++) {
       LedStrip *strip = &state->strips[s];
       for (int i = 0; i < strip->num_leds; i++) {
         Light *led = &strip->leds[i];
+        Color color = led_color(state, s, i);
         if (led->enabled) {
           // Draw LED spheres at full brightness
-          DrawSphereEx(led->position, led->radius, 4, 4, led->color);
+          DrawSphereEx(led->position, led->radius, 4, 4, color);
         } else {
           DrawSphereWires(led->position, led->radius, 4, 4,
-                          ColorAlpha(led->color, 0.1f));
+                          ColorAlpha(color, 0.1f));
         }
       }
     }
 
     rlDisableShader();
     EndMode3D();
+    stage_end(state, TRACE_SPHERES, trace_start);
   }
 
   // === HUD ===
+  uint64_t trace_start = stage_begin(state, TRACE_HUD);
+  const CoreState *core = &state->core;
   DrawFPS(10, 10);
-  const char *prog_name =
-      state->current_program ? state->current_program->name : "(none)";
+  const char *prog_name = core->playback          ? "(recording)"
+                          : core->current_program ? core->current_program->name
+                                                  : "(none)";
   DrawText(TextFormat("Program: %s (P)", prog_name), 10, 40, 20, DARKGRAY);
   DrawText(TextFormat("Palette: %s (O)",
-                      palette_registry[state->active_palette].name),
+                      palette_registry[core->active_palette].name),
            10, 65, 20, DARKGRAY);
   DrawText(state->simple_render_mode ? "U: full render" : "U: simple render",
            10, 90, 20, DARKGRAY);
+  DrawText(TextFormat("Transition: %s (C)",
+                      transition_registry[core->active_transition].name),
+           10, 115, 20, DARKGRAY);
+  if (core->compositor.num_layers > 0) {
+    DrawText(TextFormat("Layers: %d %s (L)", core->compositor.num_layers,
+                        core->compositor.enabled ? "on" : "off"),
+             10, 140, 20, DARKGRAY);
+  }
+  if (trace_enabled()) {
+    DrawText("Tracing (F9 to save)", 10, GetScreenHeight() - 30, 20, RED);
+  }
+  if (state->perf_hud) {
+    draw_perf_hud(state);
+  }
+  stage_end(state, TRACE_HUD, trace_start);
 
+  trace_start = trace_begin();
   EndDrawing();
+  trace_end(TRACE_PRESENT, trace_start);
+  gpu_timer_next_frame(&state->gpu_timer);
+  if (state->perf_hud) {
+    perf_stats_frame(&state->perf);
+  }
+}
+
+void visualizer_shutdown(VisualizerState *state) {
+  gpu_timer_release(&state->gpu_timer);
+  clock_close(&state->clock);
+  core_shutdown(&state->core);
+  arena_release(&state->arena);
+  state->strips = NULL;
 }
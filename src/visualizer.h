@@ -1,16 +1,15 @@
 
 #pragma once
-#include "palette.h"
-#include "programs.h"
+#include "clock.h"
+#include "core.h"
+#include "gpu_timer.h"
+#include "perf_stats.h"
 #include "raylib.h"
 #include <stdbool.h>
 
-#define MAX_STRIPS 8
+#define TARGET_FPS 60
 #define NUM_PEOPLE 10
-#define MAX_LEDS_PER_STRIP 300
 #define LEDS_PER_SHADER_LIGHT 8
-#define MAX_SHADER_LIGHTS_PER_STRIP (MAX_LEDS_PER_STRIP / LEDS_PER_SHADER_LIGHT)
-#define MAX_TOTAL_SHADER_LIGHTS (MAX_STRIPS * MAX_SHADER_LIGHTS_PER_STRIP)
 
 // G-Buffer for deferred rendering
 typedef struct {
@@ -24,7 +23,6 @@ typedef struct {
 typedef struct {
   bool enabled;
   Vector3 position;
-  Color color;
   float attenuation;
   float radius;
 } Light;
@@ -36,7 +34,7 @@ typedef struct {
   float spacing;
   float intensity;
   float radius;
-  Light leds[MAX_LEDS_PER_STRIP];
+  Light *leds; // num_leds
 } LedStrip;
 
 typedef struct {
@@ -45,28 +43,27 @@ typedef struct {
 } Person;
 
 typedef struct VisualizerState {
+  // Strips, framebuffer and programs (shared with the headless runner)
+  CoreState core;
   Camera camera;
   CameraMode camera_mode;
   Shader gbufferShader;
   Shader deferredShader;
   GBuffer gbuffer;
   unsigned int lightTexture;
-  int lightTexWidth;
-  int num_strips;
-  LedStrip strips[MAX_STRIPS];
+  int lightTexWidth;  // texels per row
+  int lightTexHeight; // rows, enough for every shader light
+  // Strips and light upload state, sized in visualizer_configure_strips
+  Arena arena;
+  LedStrip *strips; // core.num_strips
+  bool lights_stale; // rebuild every shader light (layout or enable change)
   double start_time;
-  double time_ms;
-  double last_frame_time;
-  double smoothed_delta;
-  // Programs (loaded dynamically)
-  const Program *programs;
-  int num_programs;
-  int active_program;
-  const Program *current_program;
-  int active_palette;
-  const Palette16 *current_palette;
+  Clock clock; // advances core.time_ms every frame (wall clock by default)
   Person people[NUM_PEOPLE];
   bool simple_render_mode;
+  GpuTimer gpu_timer; // GL stage times while tracing
+  bool perf_hud;      // perf overlay shown (F3)
+  PerfStats perf;
 } VisualizerState;
 
 // Initialize state (load shaders, set up camera)
@@ -81,3 +78,7 @@ void visualizer_update(VisualizerState *state);
 
 // Draw scene
 void visualizer_draw(VisualizerState *state);
+
+// Release resources that outlive a frame (worker threads, strip storage,
+// layer and transition buffers)
+void visualizer_shutdown(VisualizerState *state);
@@ -0,0 +1,149 @@
+#include "worker_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MAX_POOL_WORKERS 32
+
+struct WorkerPool {
+  pthread_t threads[MAX_POOL_WORKERS];
+  int num_workers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;    // signalled when a new run begins (or on shutdown)
+  pthread_cond_t finished; // signalled when the last active worker leaves
+
+  // Current run (only changed under lock while no worker is active)
+  WorkerTask task;
+  void *ctx;
+  int count;
+  unsigned long generation;
+  bool shutdown;
+  int active; // workers currently draining tasks (under lock)
+
+  atomic_int next; // next task index to claim
+};
+
+// Claim and run tasks until none are left
+static void drain_tasks(WorkerPool *pool) {
+  for (;;) {
+    int i = atomic_fetch_add(&pool->next, 1);
+    if (i >= pool->count)
+      return;
+    pool->task(pool->ctx, i);
+  }
+}
+
+static void *worker_main(void *arg) {
+  WorkerPool *pool = arg;
+  unsigned long seen = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->shutdown && pool->generation == seen) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->shutdown) {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    seen = pool->generation;
+    pool->active++;
+    pthread_mutex_unlock(&pool->lock);
+
+    drain_tasks(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->active == 0) {
+      pthread_cond_signal(&pool->finished);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+WorkerPool *worker_pool_create(int num_workers) {
+  WorkerPool *pool = calloc(1, sizeof(*pool));
+  if (!pool)
+    return NULL;
+
+  if (num_workers < 0)
+    num_workers = 0;
+  if (num_workers > MAX_POOL_WORKERS)
+    num_workers = MAX_POOL_WORKERS;
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->finished, NULL);
+
+  for (int i = 0; i < num_workers; i++) {
+    if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0)
+      break;
+    pool->num_workers++;
+  }
+
+  return pool;
+}
+
+void worker_pool_run(WorkerPool *pool, WorkerTask task, void *ctx, int count) {
+  if (count <= 0)
+    return;
+
+  // Small batches or an empty pool are cheaper to run inline
+  if (!pool || pool->num_workers == 0 || count == 1) {
+    for (int i = 0; i < count; i++) {
+      task(ctx, i);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->active > 0) {
+    // A worker that woke late for the previous run is still leaving
+    pthread_cond_wait(&pool->finished, &pool->lock);
+  }
+  pool->task = task;
+  pool->ctx = ctx;
+  pool->count = count;
+  atomic_store(&pool->next, 0);
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  drain_tasks(pool);
+
+  // Barrier: every task is claimed, wait for workers still running one.
+  // Workers that wake late find nothing left and leave immediately.
+  pthread_mutex_lock(&pool->lock);
+  while (pool->active > 0) {
+    pthread_cond_wait(&pool->finished, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void worker_pool_destroy(WorkerPool *pool) {
+  if (!pool)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->num_workers; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->finished);
+  free(pool);
+}
+
+int worker_pool_default_size(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  // The render thread is the remaining participant
+  return cpus > 1 ? (int)(cpus - 1) : 0;
+}
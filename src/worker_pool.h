@@ -0,0 +1,22 @@
+#pragma once
+
+// Persistent pool of worker threads for data-parallel per-frame work.
+// The calling thread takes part in every run, so a pool with zero workers
+// simply runs tasks inline.
+
+typedef void (*WorkerTask)(void *ctx, int index);
+
+typedef struct WorkerPool WorkerPool;
+
+// Start num_workers threads (0 is valid). Returns NULL on failure.
+WorkerPool *worker_pool_create(int num_workers);
+
+// Run task(ctx, i) for every i in [0, count) across the pool and return once
+// all of them have finished (acts as a barrier)
+void worker_pool_run(WorkerPool *pool, WorkerTask task, void *ctx, int count);
+
+// Stop and join all workers
+void worker_pool_destroy(WorkerPool *pool);
+
+// Number of helper threads a pool should use on this machine
+int worker_pool_default_size(void);